@@ -1,6 +1,15 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <numeric>
 #include <ostream>
 #include <regex>
@@ -9,13 +18,27 @@
 #include <thread>
 #include <vector>
 
+#include "chunked_codec.hpp"
+#include "cmdline.h"
+#include "codec_context.hpp"
 #include "fmt/core.h"
+#include "frame_buffer.hpp"
+#include "frame_delta.hpp"
+#include "image_quality.hpp"
 #include "lz4.h"
 #include "lz4frame.h"
 #include "lz4hc.h"
+#include "lz4_sequence.hpp"
+#include "mapped_file.hpp"
+#include "multi_quality_jpeg.hpp"
+#include "pixel_convert.hpp"
 #include "thread_pool.hpp"
+#include "tile_classify.hpp"
+#include "tile_router.hpp"
+#include "tiled_jpeg.hpp"
 #include "turbojpeg.h"
 #include "zstd.h"
+#include "zstd_sequence.hpp"
 
 #define ANKERL_NANOBENCH_IMPLEMENT
 #include "nanobench.h"
@@ -25,6 +48,7 @@
 #include "xtensor/xarray.hpp"
 #include "xtensor/xio.hpp"
 #include "xtensor/xstrided_view.hpp"
+#include "xtensor/xview.hpp"
 
 #ifdef _WIN32
 #include <direct.h>
@@ -34,15 +58,45 @@
 #include <unistd.h>
 #endif
 
+// qoi 子模块可选, 没有拉取时不注册 qoi 编码器
+#if __has_include("qoi/qoi.h")
+#define QOI_IMPLEMENTATION
+#include "qoi/qoi.h"
+#define HAVE_QOI 1
+#endif
+
 #define IN_CHUNK_SIZE 16384  // 16 * 1024
 #undef max
 
-static std::string encBuf;  // 编码输出缓冲区
-static std::string cpsBuf;  // 压缩输出缓冲区
+static image_encode::FrameBufferPool bufferPool;  // 大页缓冲区池
+static image_encode::FrameBuffer encBuf(0, &bufferPool);  // 编码输出缓冲区
+static image_encode::FrameBuffer cpsBuf(0, &bufferPool);  // 压缩输出缓冲区
+static image_encode::FrameBuffer decBuf(0, &bufferPool);  // 解压输出缓冲区
+
+static image_encode::CodecContextPool codecContexts;  // 复用的编解码上下文
+static image_encode::FrameDelta frameDelta;  // 保存上一帧用于比较变化的块
+static image_encode::Lz4SequenceEncoder lz4Sequence;  // 帧间 lz4 压缩
+static image_encode::Lz4SequenceDecoder lz4SequenceDecoder;
+static image_encode::ZstdSequenceEncoder zstdSequence;  // 帧间 zstd 压缩
+static image_encode::ZstdSequenceDecoder zstdSequenceDecoder;
+static image_encode::QualityMeter qualityMeter;  // 原始帧与解码输出的质量指标
+static image_encode::TileClassifier tileClassifier;  // 图块内容分类
+static image_encode::TileRouter tileRouter(nullptr, &codecContexts,
+                                           &tileClassifier);  // 单线程图块帧
+
+static int benchWarmup = 3;   // 预热次数
+static int benchEpochs = 31;  // 采样轮数, 每轮执行一次
+static bool verbose = true;   // 输出每一项的测试结果
+
+static std::string benchFrame;  // 当前测试的帧名称
+static std::vector<ankerl::nanobench::Result> benchResults;  // 所有测试结果
 
 struct ImageInfo;
 typedef void (*EncFunc)(ImageInfo*);
 typedef void (*CpsFunc)(ImageInfo*);
+// 解码/解压 src 到 dst, 返回输出大小, 失败返回 -1
+typedef int (*DecFunc)(ImageInfo*, const char* src, int size, char* dst,
+                       int capacity);
 
 struct ImageInfo {
   int index;
@@ -73,10 +127,14 @@ struct ImageInfo {
         encTime(0),
         cpsTime(0),
         srcSize(srcSize),
+        encSize(0),
+        cpsSize(0),
         level(level),
         srcData(srcData),
         encData(encData),
-        cpsData(cpsData) {}
+        cpsData(cpsData),
+        encFunc(nullptr),
+        cpsFunc(nullptr) {}
 
   double getEncRatio() const { return 100.0 * (1 - 1.0 * encSize / srcSize); }
 
@@ -89,6 +147,229 @@ static int64_t getCurrentTime() {
       .count();
 }
 
+// 单项测试的统计结果, 时间单位 ms
+struct BenchStats {
+  double median;  // 中位数
+  double p90;     // 90 分位
+  double p99;     // 99 分位
+  double err;     // 中位数绝对百分比误差
+  double mbps;    // 吞吐量 MB/s
+};
+
+// 在 nanobench 默认 json/csv 模板的基础上增加帧信息和输出大小
+static const char* kJsonTemplate = R"DELIM({
+    "results": [
+{{#result}}        {
+            "frame": "{{context(frame)}}",
+            "width": {{context(width)}},
+            "height": {{context(height)}},
+            "frameSize": {{context(frameSize)}},
+            "title": "{{title}}",
+            "name": "{{name}}",
+            "unit": "{{unit}}",
+            "batch": {{batch}},
+            "dstSize": {{context(dstSize)}},
+            "ratio": {{context(ratio)}},
+            "epochs": {{epochs}},
+            "warmup": {{warmup}},
+            "median(elapsed)": {{median(elapsed)}},
+            "medianAbsolutePercentError(elapsed)": {{medianAbsolutePercentError(elapsed)}},
+            "minimum(elapsed)": {{minimum(elapsed)}},
+            "maximum(elapsed)": {{maximum(elapsed)}},
+            "totalTime": {{sumProduct(iterations, elapsed)}},
+            "measurements": [
+{{#measurement}}                {
+                    "iterations": {{iterations}},
+                    "elapsed": {{elapsed}}
+                }{{^-last}},{{/-last}}
+{{/measurement}}            ]
+        }{{^-last}},{{/-last}}
+{{/result}}    ]
+}
+)DELIM";
+
+static const char* kCsvTemplate =
+    R"DELIM("frame";"width";"height";"frameSize";"title";"name";"unit";"batch";"dstSize";"ratio";"elapsed";"error %";"minimum";"maximum";"total"
+{{#result}}"{{context(frame)}}";{{context(width)}};{{context(height)}};{{context(frameSize)}};"{{title}}";"{{name}}";"{{unit}}";{{batch}};{{context(dstSize)}};{{context(ratio)}};{{median(elapsed)}};{{medianAbsolutePercentError(elapsed)}};{{minimum(elapsed)}};{{maximum(elapsed)}};{{sumProduct(iterations, elapsed)}}
+{{/result}})DELIM";
+
+// pareto 前沿的散点图: 输出大小-耗时和输出大小-质量, 每个结果一个点
+static const char* kParetoHtmlTemplate = R"DELIM(<html>
+
+<head>
+    <script src="https://cdn.plot.ly/plotly-latest.min.js"></script>
+</head>
+
+<body>
+    <div id="time"></div>
+    <div id="quality"></div>
+    <script>
+        var time = [
+            {{#result}}{
+                name: '{{title}} {{name}}',
+                x: [{{context(dstSize)}}],
+                y: [{{median(elapsed)}}],
+                text: ['{{context(frame)}} psnr {{context(psnr)}} ssim {{context(ssim)}} ms-ssim {{context(msSsim)}}'],
+            },
+            {{/result}}
+        ];
+        var quality = [
+            {{#result}}{
+                name: '{{name}}',
+                x: [{{context(dstSize)}}],
+                y: [{{context(quality)}}],
+                text: ['{{context(frame)}} {{title}} {{median(elapsed)}} s'],
+            },
+            {{/result}}
+        ];
+
+        var points = a => Object.assign(a, { mode: 'markers', type: 'scatter' });
+        Plotly.newPlot('time', time.map(points), { title: { text: 'pareto front: size / time' }, showlegend: false, xaxis: { title: 'bytes', type: 'log' }, yaxis: { title: 'time per frame', rangemode: 'tozero' } }, {responsive: true});
+        Plotly.newPlot('quality', quality.map(points), { title: { text: 'pareto front: size / quality' }, showlegend: false, xaxis: { title: 'bytes', type: 'log' }, yaxis: { title: 'quality' } }, {responsive: true});
+    </script>
+</body>
+
+</html>)DELIM";
+
+// 预热后采样 benchEpochs 轮, 每轮只执行一次, 得到单帧延迟分布
+static ankerl::nanobench::Bench makeBench(const std::string& title,
+                                          int bytes) {
+  ankerl::nanobench::Bench bench;
+  bench.title(title)
+      .unit("byte")
+      .batch(bytes)
+      .warmup(benchWarmup)
+      .epochs(benchEpochs)
+      .epochIterations(1)
+      .output(nullptr);
+  return bench;
+}
+
+static BenchStats summarize(const ankerl::nanobench::Result& result) {
+  using Measure = ankerl::nanobench::Result::Measure;
+
+  std::vector<double> samples(result.size());
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = result.get(i, Measure::elapsed);
+  }
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&samples](double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+    return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+  };
+
+  double median = result.median(Measure::elapsed);
+  BenchStats stats;
+  stats.median = median * 1000.0;
+  stats.p90 = percentile(0.90) * 1000.0;
+  stats.p99 = percentile(0.99) * 1000.0;
+  stats.err = result.medianAbsolutePercentError(Measure::elapsed) * 100.0;
+  stats.mbps = median > 0 ? result.config().mBatch / median / 1e6 : 0;
+  return stats;
+}
+
+// 附加到结果中的 context, 可以在自定义模板中引用
+typedef std::vector<std::pair<std::string, std::string>> BenchContext;
+
+// op 返回输出大小, 先执行一次得到输出大小再开始计时
+template <typename Op>
+static BenchStats runBench(const ImageInfo& info, const std::string& title,
+                           const std::string& name, int bytes, Op&& op,
+                           const BenchContext& extra = {}) {
+  int dstSize = op();
+  double ratio = 100.0 * (1 - 1.0 * dstSize / info.srcSize);
+  ankerl::nanobench::Bench bench = makeBench(title, bytes);
+  bench.context("frame", benchFrame)
+      .context("width", std::to_string(info.width))
+      .context("height", std::to_string(info.height))
+      .context("frameSize", std::to_string(info.srcSize))
+      .context("dstSize", std::to_string(dstSize))
+      .context("ratio", fmt::format("{:.3f}", ratio));
+  for (const auto& item : extra) {
+    bench.context(item.first, item.second);
+  }
+  bench.run(name, [&op] { ankerl::nanobench::doNotOptimizeAway(op()); });
+  benchResults.emplace_back(bench.results().back());
+  return summarize(bench.results().back());
+}
+
+static std::string formatStats(const BenchStats& stats) {
+  return fmt::format(
+      "median: {:>6.2f} ms  p90: {:>6.2f} ms  p99: {:>6.2f} ms  err: "
+      "{:>5.2f}%  {:>7.1f} MB/s",
+      stats.median, stats.p90, stats.p99, stats.err, stats.mbps);
+}
+
+// 按 title + name 汇总所有帧的结果
+static void printSummary() {
+  struct Total {
+    int frames = 0;
+    double frameSize = 0;
+    double dstSize = 0;
+    double bytes = 0;
+    double elapsed = 0;
+  };
+  std::vector<std::string> keys;
+  std::map<std::string, Total> totals;
+  for (const auto& result : benchResults) {
+    const auto& config = result.config();
+    std::string key = fmt::format("{:<10} {:<34}", config.mBenchmarkTitle,
+                                  config.mBenchmarkName);
+    if (totals.find(key) == totals.end()) {
+      keys.emplace_back(key);
+    }
+    Total& total = totals[key];
+    total.frames++;
+    total.frameSize += std::stod(result.context("frameSize"));
+    total.dstSize += std::stod(result.context("dstSize"));
+    total.bytes += config.mBatch;
+    total.elapsed +=
+        result.median(ankerl::nanobench::Result::Measure::elapsed);
+  }
+
+  fmt::println("summary");
+  for (const auto& key : keys) {
+    const Total& total = totals[key];
+    fmt::println(
+        "    {} frames: {:>5}  ratio: {:>6.3f}  avg time: {:>7.2f} ms  "
+        "{:>7.1f} MB/s",
+        key, total.frames, 100.0 * (1 - total.dstSize / total.frameSize),
+        total.elapsed / total.frames * 1000.0,
+        total.elapsed > 0 ? total.bytes / total.elapsed / 1e6 : 0);
+  }
+  fmt::println("");
+}
+
+static bool writeResults(const std::string& path, const char* tmpl) {
+  std::ofstream out(path, std::ofstream::binary);
+  if (!out.is_open()) {
+    fmt::println(stderr, "File can not open: {}", path);
+    return false;
+  }
+  ankerl::nanobench::render(tmpl, benchResults, out);
+  return true;
+}
+
+// 从文件名 index_width_height.ext 中提取序号和宽高
+static bool parseFrameName(const std::string& name, int& index, int& width,
+                           int& height) {
+  std::regex regex("_|\\.");
+  std::vector<std::string> names(
+      std::sregex_token_iterator(name.begin(), name.end(), regex, -1),
+      std::sregex_token_iterator());
+  if (names.size() != 4) {
+    return false;
+  }
+  try {
+    index = std::stoi(names[0]);
+    width = std::stoi(names[1]);
+    height = std::stoi(names[2]);
+  } catch (const std::exception&) {
+    return false;
+  }
+  return true;
+}
+
 static std::string getCurrentDirectory() {
   std::string path;
   size_t pos = 0;
@@ -107,194 +388,2183 @@ static std::string getCurrentDirectory() {
   return path.substr(0, pos + 1);
 }
 
+// 按最大输出大小申请编码和压缩缓存, 不做零初始化
+static bool reserveBuffers(int width, int height, int srcSize) {
+  size_t encSize =
+      std::max({image_encode::JpegBufSize(width, height, TJSAMP_444),
+                image_encode::YuvBufSize(width, height, TJSAMP_444),
+                image_encode::TileFrameBound(width, height)});
+  size_t cpsSize = image_encode::CompressBound(
+      std::max(static_cast<size_t>(srcSize), encSize));
+  if (!encBuf.Reserve(encSize) || !cpsBuf.Reserve(cpsSize) ||
+      !decBuf.Reserve(encSize)) {
+    fmt::println(stderr, "Out of memory: {}x{}", width, height);
+    return false;
+  }
+  return true;
+}
+
+// 压缩直接读取编码输出所在的缓冲区, 输出写入 cpsBuf
 static void compress_lz4(ImageInfo& info, bool enc = false) {
-  int64_t start = getCurrentTime();
-  info.cpsSize = LZ4_compress_fast(
+  info.cpsSize = codecContexts.Get().CompressLz4(
       enc ? info.encData : info.srcData, (char*)info.cpsData,
-      enc ? info.encSize : info.srcSize,
-      LZ4_compressBound(enc ? info.encSize : info.srcSize), info.level);
-  info.cpsTime = (getCurrentTime() - start) / 1000.0;
+      enc ? info.encSize : info.srcSize, cpsBuf.capacity(), info.level);
 }
 
-static void compress_lz4_hc(ImageInfo& info) {
-  int64_t start = getCurrentTime();
-  info.cpsSize =
-      LZ4_compress_HC(info.srcData, (char*)info.cpsData, info.srcSize,
-                      LZ4_compressBound(info.srcSize), info.level);
-  info.cpsTime = (getCurrentTime() - start) / 1000.0;
+static void compress_lz4_hc(ImageInfo& info, bool enc = false) {
+  info.cpsSize = codecContexts.Get().CompressLz4Hc(
+      enc ? info.encData : info.srcData, (char*)info.cpsData,
+      enc ? info.encSize : info.srcSize, cpsBuf.capacity(), info.level);
 }
 
 static void compress_zstd(ImageInfo& info, bool enc = false) {
-  int64_t start = getCurrentTime();
-  info.cpsSize =
-      ZSTD_compress((char*)info.cpsData,
-                    ZSTD_compressBound(enc ? info.encSize : info.srcSize),
-                    enc ? info.encData : info.srcData,
-                    enc ? info.encSize : info.srcSize, info.level);
-  info.cpsTime = (getCurrentTime() - start) / 1000.0;
+  info.cpsSize = codecContexts.Get().CompressZstd(
+      (char*)info.cpsData, cpsBuf.capacity(),
+      enc ? info.encData : info.srcData, enc ? info.encSize : info.srcSize,
+      info.level);
 }
 
-static void encode_jpeg(ImageInfo& info) {
-  int subsamp = TJSAMP_420;
+static void encode_jpeg(ImageInfo& info, int subsamp = TJSAMP_420) {
+  image_encode::CodecContext& context = codecContexts.Get();
+
+  int ret = context.CompressJpeg((const unsigned char*)info.srcData,
+                                 info.width, 0, info.height, TJPF_BGRA, subsamp,
+                                 info.quality, info.flag, &encBuf);
+  info.encSize = encBuf.size();
 
-  tjhandle handle = tjInitCompress();
-  if (!handle) {
-    info.encTime = 999;
-    fmt::println(stderr, "tjInitCompress Init failed: {}", tjGetErrorStr());
-    return;
+  if (ret != 0) {
+    fmt::println(stderr, "tjInitCompress Compress failed: {}",
+                 tjGetErrorStr2(context.tj()));
   }
+}
 
-  int64_t start = getCurrentTime();
-  int ret = tjCompress2(
-      handle, (const unsigned char*)info.srcData, info.width, 0, info.height,
-      TJPF_BGRA, (unsigned char**)(&info.encData),
-      (unsigned long*)(&info.encSize), subsamp, info.quality, info.flag);
-  info.encTime = (getCurrentTime() - start) / 1000.0;
+static void encode_yuv(ImageInfo& info, int subsamp = TJSAMP_420) {
+  tjhandle handle = codecContexts.Get().tj();
+
+  info.encSize = image_encode::YuvBufSize(info.width, info.height, subsamp);
+  int ret = tjEncodeYUV2(handle, (unsigned char*)info.srcData, info.width, 0,
+                         info.height, TJPF_BGRA, (unsigned char*)info.encData,
+                         subsamp, info.flag);
 
   if (ret != 0) {
-    fmt::println(stderr, "tjInitCompress Compress failed: {}", tjGetErrorStr());
+    fmt::println(stderr, "tjInitCompress Compress failed: {}",
+                 tjGetErrorStr2(handle));
   }
+}
 
-  if (handle) {
-    tjDestroy(handle);
+#ifdef HAVE_QOI
+// 先转换为 qoi 需要的 RGB, qoi_encode 自己申请输出, 拷贝到 encBuf
+static void encode_qoi(ImageInfo& info) {
+  size_t pixels = (size_t)info.width * info.height;
+  image_encode::FrameBuffer rgb = bufferPool.Acquire(pixels * 3);
+  image_encode::BgraToRgb((const unsigned char*)info.srcData, info.width,
+                          info.width * 4, info.height, rgb.data());
+  qoi_desc desc = {(unsigned int)info.width, (unsigned int)info.height, 3,
+                   QOI_SRGB};
+  int size = 0;
+  void* encoded = qoi_encode(rgb.data(), &desc, &size);
+  info.encSize = 0;
+  if (encoded == nullptr || (size_t)size > encBuf.capacity()) {
+    fmt::println(stderr, "Qoi encode failed: {}x{}", info.width, info.height);
+  } else {
+    memcpy(encBuf.data(), encoded, size);
+    info.encSize = size;
   }
+  free(encoded);
 }
+#endif
 
-static void encode_yuv(ImageInfo& info) {
-  int subsamp = TJSAMP_420;
-  tjhandle handle = tjInitCompress();
-  if (!handle) {
-    info.encTime = 999;
-    fmt::println(stderr, "tjInitCompress Init failed: {}", tjGetErrorStr());
-    return;
+// 编码器/压缩器插件, 参数通过 ImageInfo 的 quality (编码) 和 level (压缩) 传入,
+// 压缩器在设置了 encFunc 时压缩编码输出, 否则直接压缩原始数据.
+// 解码器输出紧密排列的 BGRA, 解压器输出编码数据或原始数据
+struct CodecParam {
+  const char* name;  // 为空表示没有参数
+  int value;         // 默认值
+  int min;
+  int max;
+};
+
+struct CodecPlugin {
+  std::string name;
+  std::string help;
+  CodecParam param;
+  EncFunc encFunc;  // 编码器和压缩器只设置其中一个
+  CpsFunc cpsFunc;
+  DecFunc decFunc;
+  bool dct;  // 编码受 info.flag 中 DCT 方式的影响
+};
+
+static std::vector<CodecPlugin>& codecRegistry() {
+  static std::vector<CodecPlugin> registry;
+  return registry;
+}
+
+static bool registerCodec(const CodecPlugin& plugin) {
+  codecRegistry().emplace_back(plugin);
+  return true;
+}
+
+static const CodecPlugin* findCodec(const std::string& name) {
+  for (const CodecPlugin& plugin : codecRegistry()) {
+    if (plugin.name == name) {
+      return &plugin;
+    }
   }
+  return nullptr;
+}
 
-  int64_t start = getCurrentTime();
-  info.encSize = tjBufSizeYUV(info.width, info.height, subsamp);
-  int ret = tjEncodeYUV2(handle, (unsigned char*)info.srcData, info.width, 0,
-                         info.height, TJPF_BGRA, (unsigned char*)info.encData,
-                         subsamp, info.flag);
-  info.encTime = (getCurrentTime() - start) / 1000.0;
+// 在文件作用域注册, 新增编解码器不需要修改 main()
+#define REGISTER_CODEC(id, ...) \
+  static const bool registered_##id = registerCodec(CodecPlugin __VA_ARGS__)
+
+template <int Subsamp>
+static void plugin_jpeg(ImageInfo* info) {
+  encode_jpeg(*info, Subsamp);
+}
+
+template <int Subsamp>
+static void plugin_yuv(ImageInfo* info) {
+  encode_yuv(*info, Subsamp);
+}
+
+static void plugin_lz4(ImageInfo* info) {
+  compress_lz4(*info, info->encFunc != nullptr);
+}
+
+static void plugin_lz4_hc(ImageInfo* info) {
+  compress_lz4_hc(*info, info->encFunc != nullptr);
+}
+
+static void plugin_zstd(ImageInfo* info) {
+  compress_zstd(*info, info->encFunc != nullptr);
+  if (info->cpsSize < 0) info->cpsSize = 0;  // zstd 错误码
+}
 
+// 照片按 quality 编码, 细节图像的质量高 10
+static image_encode::TileRouterOptions tileOptions(const ImageInfo& info) {
+  image_encode::TileRouterOptions options;
+  options.flags = info.flag;
+  options.routes[(int)image_encode::TileClass::kDetail].quality =
+      std::min(100, info.quality + 10);
+  options.routes[(int)image_encode::TileClass::kPhoto].quality = info.quality;
+  return options;
+}
+
+static void plugin_tiles(ImageInfo* info) {
+  int ret = tileRouter.Encode((const unsigned char*)info->srcData,
+                              info->width, 0, info->height,
+                              tileOptions(*info), &encBuf);
+  info->encSize = ret == 0 ? encBuf.size() : 0;
   if (ret != 0) {
-    fmt::println(stderr, "tjInitCompress Compress failed: {}", tjGetErrorStr());
+    fmt::println(stderr, "Tile encode failed: {}", tileRouter.error());
+  }
+}
+
+static int plugin_decode_tiles(ImageInfo* info, const char* src, int size,
+                               char* dst, int capacity) {
+  int outSize = info->width * info->height * 4;
+  if (outSize > capacity ||
+      tileRouter.Decode((const unsigned char*)src, size, (unsigned char*)dst,
+                        0) != 0) {
+    return -1;
+  }
+  return outSize;
+}
+
+static int plugin_decode_jpeg(ImageInfo* info, const char* src, int size,
+                              char* dst, int capacity) {
+  int outSize = info->width * info->height * 4;
+  if (outSize > capacity ||
+      codecContexts.Get().DecompressJpeg((const unsigned char*)src, size,
+                                         (unsigned char*)dst, 0, TJPF_BGRA,
+                                         0) != 0) {
+    return -1;
   }
+  return outSize;
+}
 
-  if (handle) {
-    tjDestroy(handle);
+template <int Subsamp>
+static int plugin_decode_yuv(ImageInfo* info, const char* src, int size,
+                             char* dst, int capacity) {
+  int outSize = info->width * info->height * 4;
+  if (outSize > capacity ||
+      (size_t)size <
+          image_encode::YuvBufSize(info->width, info->height, Subsamp) ||
+      codecContexts.Get().DecodeYuv((const unsigned char*)src, 4, Subsamp,
+                                    (unsigned char*)dst, info->width, 0,
+                                    info->height, TJPF_BGRA, 0) != 0) {
+    return -1;
   }
+  return outSize;
+}
+
+#ifdef HAVE_QOI
+// qoi 按 RGBA 解码后交换 R 和 B
+static int plugin_decode_qoi(ImageInfo* info, const char* src, int size,
+                             char* dst, int capacity) {
+  int outSize = info->width * info->height * 4;
+  qoi_desc desc;
+  unsigned char* rgba = (unsigned char*)qoi_decode(src, size, &desc, 4);
+  if (rgba == nullptr || outSize > capacity ||
+      desc.width != (unsigned int)info->width ||
+      desc.height != (unsigned int)info->height) {
+    free(rgba);
+    return -1;
+  }
+  unsigned char* out = (unsigned char*)dst;
+  for (int i = 0; i < outSize; i += 4) {
+    out[i] = rgba[i + 2];
+    out[i + 1] = rgba[i + 1];
+    out[i + 2] = rgba[i];
+    out[i + 3] = rgba[i + 3];
+  }
+  free(rgba);
+  return outSize;
+}
+#endif
+
+static int plugin_decompress_lz4(ImageInfo* /*info*/, const char* src,
+                                 int size, char* dst, int capacity) {
+  int ret = LZ4_decompress_safe(src, dst, size, capacity);
+  return ret < 0 ? -1 : ret;
+}
+
+static int plugin_decompress_zstd(ImageInfo* /*info*/, const char* src,
+                                  int size, char* dst, int capacity) {
+  size_t ret = codecContexts.Get().DecompressZstd(dst, capacity, src, size);
+  return ZSTD_isError(ret) ? -1 : (int)ret;
+}
+
+REGISTER_CODEC(jpeg, {"jpeg", "jpeg 4:2:0", {"quality", 85, 1, 100},
+                      plugin_jpeg<TJSAMP_420>, nullptr, plugin_decode_jpeg,
+                      true});
+REGISTER_CODEC(jpeg422, {"jpeg422", "jpeg 4:2:2", {"quality", 85, 1, 100},
+                         plugin_jpeg<TJSAMP_422>, nullptr, plugin_decode_jpeg,
+                         true});
+REGISTER_CODEC(jpeg444, {"jpeg444", "jpeg 4:4:4", {"quality", 85, 1, 100},
+                         plugin_jpeg<TJSAMP_444>, nullptr, plugin_decode_jpeg,
+                         true});
+REGISTER_CODEC(jpeggray, {"jpeggray", "jpeg grayscale",
+                          {"quality", 85, 1, 100}, plugin_jpeg<TJSAMP_GRAY>,
+                          nullptr, plugin_decode_jpeg, true});
+REGISTER_CODEC(yuv420, {"yuv420", "planar yuv 4:2:0", {nullptr, 0, 0, 0},
+                        plugin_yuv<TJSAMP_420>, nullptr,
+                        plugin_decode_yuv<TJSAMP_420>, false});
+REGISTER_CODEC(yuv422, {"yuv422", "planar yuv 4:2:2", {nullptr, 0, 0, 0},
+                        plugin_yuv<TJSAMP_422>, nullptr,
+                        plugin_decode_yuv<TJSAMP_422>, false});
+REGISTER_CODEC(yuv444, {"yuv444", "planar yuv 4:4:4", {nullptr, 0, 0, 0},
+                        plugin_yuv<TJSAMP_444>, nullptr,
+                        plugin_decode_yuv<TJSAMP_444>, false});
+REGISTER_CODEC(tiles, {"tiles", "content-aware lz4/qoi/jpeg tiles",
+                       {"quality", 80, 1, 100}, plugin_tiles, nullptr,
+                       plugin_decode_tiles, true});
+#ifdef HAVE_QOI
+REGISTER_CODEC(qoi, {"qoi", "qoi rgb", {nullptr, 0, 0, 0},
+                     [](ImageInfo* info) { encode_qoi(*info); }, nullptr,
+                     plugin_decode_qoi, false});
+#endif
+REGISTER_CODEC(lz4, {"lz4", "lz4 fast", {"acceleration", 1, 1, 65537},
+                     nullptr, plugin_lz4, plugin_decompress_lz4, false});
+REGISTER_CODEC(lz4hc, {"lz4hc", "lz4 high compression", {"level", 9, 1, 12},
+                       nullptr, plugin_lz4_hc, plugin_decompress_lz4, false});
+REGISTER_CODEC(zstd, {"zstd", "zstd", {"level", 3, -7, 22}, nullptr,
+                      plugin_zstd, plugin_decompress_zstd, false});
+
+// 编码器和压缩器组成的链, 可以只有其中一个
+struct CodecChain {
+  std::string name;  // 补全默认参数后的名称, 如 yuv420+zstd:3
+  const CodecPlugin* encoder;
+  const CodecPlugin* compressor;
+  int quality;
+  int level;
+};
+
+// 解析 "name[:value]" 形式的一段, 没有参数时使用默认值
+static bool parseStage(const std::string& text, const CodecPlugin*& plugin,
+                       int& value, std::string& error) {
+  size_t pos = text.find(':');
+  std::string name = text.substr(0, pos);
+  plugin = findCodec(name);
+  if (plugin == nullptr) {
+    error = fmt::format("unknown codec '{}'", name);
+    return false;
+  }
+  const CodecParam& param = plugin->param;
+  value = param.value;
+  if (pos == std::string::npos) {
+    return true;
+  }
+  if (param.name == nullptr) {
+    error = fmt::format("codec '{}' takes no parameter", name);
+    return false;
+  }
+  size_t end = 0;
+  try {
+    value = std::stoi(text.substr(pos + 1), &end);
+  } catch (const std::exception&) {
+    end = 0;
+  }
+  if (end == 0 || end != text.size() - pos - 1 || value < param.min ||
+      value > param.max) {
+    error = fmt::format("{} of '{}' must be in [{}, {}]", param.name, name,
+                        param.min, param.max);
+    return false;
+  }
+  return true;
+}
+
+// 格式为 [encoder[:quality]+]compressor[:level] 或 encoder[:quality]
+static bool parseChain(const std::string& text, CodecChain& chain,
+                       std::string& error) {
+  std::vector<std::string> stages;
+  size_t begin = 0;
+  while (true) {
+    size_t pos = text.find('+', begin);
+    stages.emplace_back(text.substr(begin, pos - begin));
+    if (pos == std::string::npos) break;
+    begin = pos + 1;
+  }
+  if (stages.size() > 2) {
+    error = "at most one encoder and one compressor";
+    return false;
+  }
+
+  chain = CodecChain{"", nullptr, nullptr, 0, 0};
+  for (size_t i = 0; i < stages.size(); i++) {
+    const CodecPlugin* plugin = nullptr;
+    int value = 0;
+    if (!parseStage(stages[i], plugin, value, error)) {
+      return false;
+    }
+    if (plugin->encFunc != nullptr && i == 0) {
+      chain.encoder = plugin;
+      chain.quality = value;
+    } else if (plugin->cpsFunc != nullptr && i == stages.size() - 1) {
+      chain.compressor = plugin;
+      chain.level = value;
+    } else {
+      error = fmt::format("'{}' can not be used at stage {}", plugin->name,
+                          i + 1);
+      return false;
+    }
+    if (!chain.name.empty()) chain.name += "+";
+    chain.name += plugin->name;
+    if (plugin->param.name != nullptr) {
+      chain.name += fmt::format(":{}", value);
+    }
+  }
+  return true;
+}
+
+// 逗号分隔的多条链
+static bool parseChains(const std::string& text,
+                        std::vector<CodecChain>& chains) {
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (item.empty()) continue;
+    CodecChain chain;
+    std::string error;
+    if (!parseChain(item, chain, error)) {
+      fmt::println(stderr, "Invalid codec chain '{}': {}", item, error);
+      return false;
+    }
+    chains.emplace_back(chain);
+  }
+  return true;
+}
+
+static void printCodecs() {
+  fmt::println("codecs (chain: [encoder[:quality]+]compressor[:level])");
+  for (const CodecPlugin& plugin : codecRegistry()) {
+    const CodecParam& param = plugin.param;
+    std::string schema =
+        param.name == nullptr
+            ? std::string("-")
+            : fmt::format("{}={} [{}, {}]", param.name, param.value,
+                          param.min, param.max);
+    fmt::println("    {:<10} {:<10} {:<28} {}", plugin.name,
+                 plugin.encFunc != nullptr ? "encoder" : "compressor", schema,
+                 plugin.help);
+  }
+}
+
+// 单帧基准测试, 同样在文件作用域注册, 通过 -t 按名称选择
+struct BenchTest {
+  std::string name;
+  std::string help;
+  void (*func)(ImageInfo&);
+};
+
+static std::vector<BenchTest>& testRegistry() {
+  static std::vector<BenchTest> registry;
+  return registry;
+}
+
+static bool registerTest(const BenchTest& test) {
+  testRegistry().emplace_back(test);
+  return true;
+}
+
+static const BenchTest* findTest(const std::string& name) {
+  for (const BenchTest& test : testRegistry()) {
+    if (test.name == name) {
+      return &test;
+    }
+  }
+  return nullptr;
+}
+
+#define REGISTER_TEST(id, help) \
+  static const bool registered_test_##id = registerTest({#id, help, test_##id})
+
+// 逗号分隔的测试名称, 按给出的顺序执行
+static bool parseTests(const std::string& text,
+                       std::vector<const BenchTest*>& tests) {
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (item.empty()) continue;
+    const BenchTest* test = findTest(item);
+    if (test == nullptr) {
+      fmt::println(stderr, "Unknown test '{}', see --list", item);
+      return false;
+    }
+    tests.emplace_back(test);
+  }
+  return true;
+}
+
+static void printTests() {
+  fmt::println("tests (-t name[,name])");
+  for (const BenchTest& test : testRegistry()) {
+    fmt::println("    {:<16} {}", test.name, test.help);
+  }
+}
+
+// 按链的逆序解压和解码, 输出写入 dst, 返回输出大小, 失败返回 -1
+static int decode_chain(ImageInfo& info, const CodecChain& chain, char* dst,
+                        int capacity) {
+  const char* data = chain.compressor != nullptr ? info.cpsData : info.encData;
+  int size = chain.compressor != nullptr ? info.cpsSize : info.encSize;
+  if (chain.compressor != nullptr) {
+    if (chain.encoder == nullptr) {
+      return chain.compressor->decFunc(&info, data, size, dst, capacity);
+    }
+    size = chain.compressor->decFunc(&info, data, size, (char*)decBuf.data(),
+                                     decBuf.capacity());
+    if (size < 0) return -1;
+    data = (const char*)decBuf.data();
+  }
+  return chain.encoder->decFunc(&info, data, size, dst, capacity);
+}
+
+// 对编码后的数据分别进行 lz4(1) 和 zstd(3) 压缩测试
+static void bench_enc_compress(ImageInfo& info, const std::string& title,
+                               const std::string& name, BenchStats& lz4,
+                               int& lz4Size, BenchStats& zstd, int& zstdSize) {
+  info.level = 1;
+  lz4 = runBench(info, title + "+lz4", name, info.encSize, [&info] {
+    compress_lz4(info, true);
+    return info.cpsSize;
+  });
+  lz4Size = info.cpsSize;
+  info.level = 3;
+  zstd = runBench(info, title + "+zstd", name, info.encSize, [&info] {
+    compress_zstd(info, true);
+    return info.cpsSize;
+  });
+  zstdSize = info.cpsSize;
 }
 
 static void test_lz4(ImageInfo& info) {
   std::vector<int> levels = {1, 3, 6, 9, 10, 12};
 
-  fmt::println("test lz4");
+  if (verbose) fmt::println("test lz4");
   for (int level : levels) {
     info.level = level;
-    compress_lz4(info);
-    fmt::println(
-        "    level: {:>2}  ratio: {:>6.3f}  compress time: {:>4.1f} ms \t "
-        "({:^4} => {:^4}) kb",
-        level, info.getCpsRatio(), info.cpsTime, info.srcSize / 1024,
-        info.cpsSize / 1024);
+    BenchStats stats = runBench(info, "lz4", fmt::format("level {}", level),
+                                info.srcSize, [&info] {
+                                  compress_lz4(info);
+                                  return info.cpsSize;
+                                });
+    info.cpsTime = stats.median;
+    if (!verbose) continue;
+    fmt::println("    level: {:>2}  ratio: {:>6.3f}  {} \t ({:^4} => {:^4}) kb",
+                 level, info.getCpsRatio(), formatStats(stats),
+                 info.srcSize / 1024, info.cpsSize / 1024);
   }
 
-  fmt::println("");
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(lz4, "lz4 levels 1-12");
+
+// 以上一帧同位置的块作为字典压缩, 与 test_lz4 的逐帧独立压缩对比
+static void test_lz4_sequence(ImageInfo& info) {
+  const unsigned char* frame = (const unsigned char*)info.srcData;
+  size_t size = info.srcSize;
+  image_encode::FrameBuffer out =
+      bufferPool.Acquire(image_encode::Lz4SequenceBound(size));
+  bool keyframe = lz4Sequence.NextIsKeyframe(size);
+
+  if (verbose) fmt::println("test lz4 sequence");
+  std::string name = keyframe ? "keyframe" : "delta";
+  BenchStats enc = runBench(info, "lz4 sequence", name, info.srcSize, [&] {
+    if (lz4Sequence.Encode(frame, size, &out) != 0) {
+      fmt::println(stderr, "Lz4 sequence encode failed");
+    }
+    return (int)out.size();
+  });
+  info.cpsSize = out.size();
+  info.cpsTime = enc.median;
+
+  // 解码器每帧只能解码一次, 单独计时并校验
+  int64_t start = getCurrentTime();
+  int ret = lz4SequenceDecoder.Decode(out.data(), out.size());
+  double decTime = (getCurrentTime() - start) / 1000.0;
+  if (ret != 0 || lz4SequenceDecoder.frame_size() != size ||
+      memcmp(lz4SequenceDecoder.frame(), frame, size) != 0) {
+    fmt::println(stderr, "Lz4 sequence round trip mismatch");
+  }
+  start = getCurrentTime();
+  lz4Sequence.Commit(frame, size);
+  double commitTime = (getCurrentTime() - start) / 1000.0;
+
+  if (verbose) {
+    fmt::println(
+        "    {:<8}  ratio: {:>6.3f}  {}  commit: {:.2f} ms  decode: {:.2f} ms "
+        "\t ({:^4} => {:^4}) kb",
+        name, info.getCpsRatio(), formatStats(enc), commitTime, decTime,
+        info.srcSize / 1024, info.cpsSize / 1024);
+    fmt::println("");
+  }
 }
+REGISTER_TEST(lz4_sequence, "lz4 with the previous frame as dictionary");
 
 static void test_lz4_hc(ImageInfo& info) {
   std::vector<int> levels = {1, 3, 6, 9, 10, 12};
 
-  fmt::println("test lz4hc");
+  if (verbose) fmt::println("test lz4hc");
   for (int level : levels) {
     info.level = level;
-    compress_lz4_hc(info);
-    fmt::println(
-        "    level: {:>2}  ratio: {:>6.3f}  compress time: {:>4.1f} ms \t "
-        "({:^4} => {:^4}) kb",
-        level, info.getCpsRatio(), info.cpsTime, info.srcSize / 1024,
-        info.cpsSize / 1024);
+    BenchStats stats = runBench(info, "lz4hc", fmt::format("level {}", level),
+                                info.srcSize, [&info] {
+                                  compress_lz4_hc(info);
+                                  return info.cpsSize;
+                                });
+    info.cpsTime = stats.median;
+    if (!verbose) continue;
+    fmt::println("    level: {:>2}  ratio: {:>6.3f}  {} \t ({:^4} => {:^4}) kb",
+                 level, info.getCpsRatio(), formatStats(stats),
+                 info.srcSize / 1024, info.cpsSize / 1024);
   }
 
-  fmt::println("");
+  if (verbose) fmt::println("");
 }
+REGISTER_TEST(lz4_hc, "lz4hc levels 1-12");
 
 static void test_zstd(ImageInfo& info) {
-  fmt::println("test zstd");
+  if (verbose) fmt::println("test zstd");
   for (int level = 0; level <= 4; level++) {
     info.level = level;
-    compress_zstd(info);
-    fmt::println(
-        "    level: {:>2}  ratio: {:>6.3f}  compress time: {:>4.1f} ms \t "
-        "({:^4} => {:^4}) kb",
-        level, info.getCpsRatio(), info.cpsTime, info.srcSize / 1024,
-        info.cpsSize / 1024);
+    BenchStats stats = runBench(info, "zstd", fmt::format("level {}", level),
+                                info.srcSize, [&info] {
+                                  compress_zstd(info);
+                                  return info.cpsSize;
+                                });
+    info.cpsTime = stats.median;
+    if (!verbose) continue;
+    fmt::println("    level: {:>2}  ratio: {:>6.3f}  {} \t ({:^4} => {:^4}) kb",
+                 level, info.getCpsRatio(), formatStats(stats),
+                 info.srcSize / 1024, info.cpsSize / 1024);
   }
 
-  fmt::println("");
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(zstd, "zstd levels 0-4");
+
+// zstd 多线程压缩, 按等级、线程数和分段大小扫描吞吐量和压缩率
+static void test_zstd_workers(ImageInfo& info) {
+  std::vector<int> levels = {3, 6, 9};
+  std::vector<int> workers = {0, 1, 2, 4, 8, 16};
+  std::vector<int> jobSizes = {0, 512 * 1024, 1024 * 1024, 2 * 1024 * 1024};
+  int cores = (int)std::thread::hardware_concurrency();
+
+  if (verbose) fmt::println("test zstd workers");
+  for (int level : levels) {
+    info.level = level;
+    for (int count : workers) {
+      if (count > 1 && count > cores) {
+        break;
+      }
+      for (int jobSize : jobSizes) {
+        // 单线程时分段大小无效
+        if (count == 0 && jobSize != 0) {
+          break;
+        }
+        std::string name =
+            fmt::format("level {} workers {} job {}k", level, count,
+                        jobSize / 1024);
+        BenchStats stats =
+            runBench(info, "zstd workers", name, info.srcSize, [&] {
+              size_t ret = codecContexts.Get().CompressZstdParallel(
+                  (char*)info.cpsData, cpsBuf.capacity(), info.srcData,
+                  info.srcSize, level, count, jobSize);
+              if (ZSTD_isError(ret)) {
+                fmt::println(stderr, "Zstd compress failed: {}",
+                             ZSTD_getErrorName(ret));
+                ret = 0;
+              }
+              info.cpsSize = (int)ret;
+              return info.cpsSize;
+            });
+        info.cpsTime = stats.median;
+        if (!verbose) continue;
+        fmt::println(
+            "    {:<32}  ratio: {:>6.3f}  {} \t ({:^4} => {:^4}) kb", name,
+            info.getCpsRatio(), formatStats(stats), info.srcSize / 1024,
+            info.cpsSize / 1024);
+      }
+    }
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(zstd_workers, "multithreaded zstd level/worker/job size sweep");
+
+// 分块独立压缩, 块在线程池上并行压缩和解压
+static void test_chunked(ImageInfo& info) {
+  struct ChunkedCase {
+    const char* name;
+    image_encode::ChunkCodec codec;
+    int level;
+  };
+  std::vector<ChunkedCase> cases = {
+      {"lz4", image_encode::ChunkCodec::kLz4, 1},
+      {"lz4hc", image_encode::ChunkCodec::kLz4Hc, 9},
+      {"zstd", image_encode::ChunkCodec::kZstd, 3}};
+  std::vector<size_t> chunkSizes = {IN_CHUNK_SIZE, 256 * 1024, 1024 * 1024};
+  std::vector<int> threads = {1, 2, 4, 8, 16};
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  size_t size = info.srcSize;
+  image_encode::FrameBuffer out = bufferPool.Acquire(0);
+  image_encode::FrameBuffer raw = bufferPool.Acquire(size);
+
+  if (verbose) fmt::println("test chunked");
+  for (int count : threads) {
+    if (count > 1 && count > (int)std::thread::hardware_concurrency()) {
+      break;
+    }
+    thread_pool::ThreadPool pool(count);
+    image_encode::CodecContextPool contexts(pool);
+    image_encode::ChunkedCodec codec(&pool, &contexts);
+    for (const ChunkedCase& it : cases) {
+      for (size_t chunkSize : chunkSizes) {
+        std::string name = fmt::format("{} level {} chunk {}k threads {}",
+                                       it.name, it.level, chunkSize / 1024,
+                                       count);
+        BenchStats stats =
+            runBench(info, "chunked", name, info.srcSize, [&] {
+              if (codec.Compress(src, size, it.codec, it.level, chunkSize,
+                                 &out) != 0) {
+                fmt::println(stderr, "Chunked compress failed: {}",
+                             codec.error());
+              }
+              return (int)out.size();
+            });
+        info.cpsSize = out.size();
+        info.cpsTime = stats.median;
+        BenchStats decode =
+            runBench(info, "chunked decompress", name, info.srcSize, [&] {
+              if (codec.Decompress(out.data(), out.size(), &raw) != 0) {
+                fmt::println(stderr, "Chunked decompress failed: {}",
+                             codec.error());
+              }
+              return (int)raw.size();
+            });
+        if (raw.size() != size || std::memcmp(raw.data(), src, size) != 0) {
+          fmt::println(stderr, "Chunked round trip mismatch: {}", name);
+        }
+        if (!verbose) continue;
+        fmt::println(
+            "    {:<36}  ratio: {:>6.3f}  {} \t ({:^4} => {:^4}) kb", name,
+            info.getCpsRatio(), formatStats(stats), info.srcSize / 1024,
+            info.cpsSize / 1024);
+        fmt::println("    {:<36}  decompress    {}", "", formatStats(decode));
+      }
+    }
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(chunked, "chunked lz4/lz4hc/zstd on the thread pool");
+
+// 以上一帧作为前缀压缩, 与 test_zstd 的逐帧独立压缩对比
+static void test_zstd_sequence(ImageInfo& info) {
+  const unsigned char* frame = (const unsigned char*)info.srcData;
+  size_t size = info.srcSize;
+  image_encode::FrameBuffer out =
+      bufferPool.Acquire(image_encode::ZstdSequenceBound(size));
+  const char* type = zstdSequence.NextIsKeyframe(size) ? "keyframe" : "delta";
+  std::vector<int> levels = {1, 3};
+
+  if (verbose) fmt::println("test zstd sequence");
+  for (int level : levels) {
+    for (bool ldm : {true, false}) {
+      zstdSequence.set_level(level);
+      zstdSequence.set_long_distance(ldm);
+      std::string name =
+          fmt::format("{} level {}{}", type, level, ldm ? " ldm" : "");
+      BenchStats stats =
+          runBench(info, "zstd sequence", name, info.srcSize, [&] {
+            if (zstdSequence.Encode(frame, size, &out) != 0) {
+              fmt::println(stderr, "Zstd sequence encode failed");
+            }
+            return (int)out.size();
+          });
+      info.cpsSize = out.size();
+      info.cpsTime = stats.median;
+      if (!verbose) continue;
+      fmt::println("    {:<24}  ratio: {:>6.3f}  {} \t ({:^4} => {:^4}) kb",
+                   name, info.getCpsRatio(), formatStats(stats),
+                   info.srcSize / 1024, info.cpsSize / 1024);
+    }
+  }
+
+  // 解码器每帧只能解码一次, 用最后一次的输出校验
+  int ret = zstdSequenceDecoder.Decode(out.data(), out.size());
+  if (ret != 0 || zstdSequenceDecoder.frame_size() != size ||
+      memcmp(zstdSequenceDecoder.frame(), frame, size) != 0) {
+    fmt::println(stderr, "Zstd sequence round trip mismatch");
+  }
+  zstdSequence.Commit(frame, size);
+
+  if (verbose) fmt::println("");
 }
+REGISTER_TEST(zstd_sequence, "zstd with the previous frame as prefix");
 
 static void test_jpeg(ImageInfo& info) {
   std::vector<int> qualities = {70, 75, 80, 85, 90, 95, 100};
   std::vector<int> flags = {TJFLAG_FASTDCT, TJFLAG_ACCURATEDCT};
   std::vector<std::string> flagNames = {"TJFLAG_FASTDCT", "TJFLAG_ACCURATEDCT"};
 
-  fmt::println("test jpeg");
+  if (verbose) fmt::println("test jpeg");
   for (int quality : qualities) {
     for (size_t i = 0; i < flags.size(); i++) {
       info.quality = quality;
       info.flag = flags[i];
-      encode_jpeg(info);
+      std::string name = fmt::format("quality {} {}", quality, flagNames[i]);
+      BenchStats enc = runBench(info, "jpeg", name, info.srcSize, [&info] {
+        encode_jpeg(info);
+        return info.encSize;
+      });
+      info.encTime = enc.median;
 
-      info.level = 1;
-      compress_lz4(info, true);
-      double lz4Time = info.cpsTime;
-      int lz4Size = info.cpsSize;
-      info.level = 3;
-      compress_zstd(info, true);
-      double zstdTime = info.cpsTime;
-      int zstdSize = info.cpsSize;
+      BenchStats lz4, zstd;
+      int lz4Size = 0, zstdSize = 0;
+      bench_enc_compress(info, "jpeg", name, lz4, lz4Size, zstd, zstdSize);
+      if (!verbose) continue;
 
       fmt::println(
-          "enc ratio: {:>6.3f}  cps ratio: {:>6.3f}  quality: {:<3}  encode "
-          "time: {:>4.1f} ms  lz4 time: {:>4.1f} ms  zstd time: {:>4.1f} ms "
-          " flag: {:<18} \t ({:^4} => {:^4} => [{:^4}|{:^4}] [lz4/zstd]) kb",
-          info.getEncRatio(), info.getCpsRatio(), quality, info.encTime,
-          lz4Time, zstdTime, flagNames[i], info.srcSize / 1024,
-          info.encSize / 1024, lz4Size / 1024, zstdSize / 1024);
+          "enc ratio: {:>6.3f}  cps ratio: {:>6.3f}  quality: {:<3}  flag: "
+          "{:<18} \t ({:^4} => {:^4} => [{:^4}|{:^4}] [lz4/zstd]) kb",
+          info.getEncRatio(), info.getCpsRatio(), quality, flagNames[i],
+          info.srcSize / 1024, info.encSize / 1024, lz4Size / 1024,
+          zstdSize / 1024);
+      fmt::println("    encode {}", formatStats(enc));
+      fmt::println("    lz4    {}", formatStats(lz4));
+      fmt::println("    zstd   {}", formatStats(zstd));
     }
   }
 
-  fmt::println("");
+  if (verbose) fmt::println("");
 }
+REGISTER_TEST(jpeg, "jpeg qualities and dct methods, then lz4/zstd");
+
+// 同一帧输出多个质量, 逐个从 BGRA 编码与共享 yuv 并行编码对比
+static void test_jpeg_multi(ImageInfo& info) {
+  int subsamp = TJSAMP_420;
+  std::vector<int> qualities = {70, 75, 80, 85, 90, 95, 100};
+  std::vector<int> threads = {1, 2, 4, 8, 16};
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  image_encode::CodecContext& context = codecContexts.Get();
+  std::vector<image_encode::FrameBuffer> refs;
+  for (size_t i = 0; i < qualities.size(); i++) {
+    refs.emplace_back(bufferPool.Acquire(
+        image_encode::JpegBufSize(info.width, info.height, subsamp)));
+  }
+  std::string tiers = fmt::format("{} tiers", qualities.size());
+
+  if (verbose) fmt::println("test jpeg multi");
+  BenchStats base = runBench(info, "jpeg multi", tiers + " bgra",
+                             info.srcSize, [&] {
+                               int total = 0;
+                               for (size_t i = 0; i < qualities.size(); i++) {
+                                 context.CompressJpeg(
+                                     src, info.width, 0, info.height,
+                                     TJPF_BGRA, subsamp, qualities[i],
+                                     info.flag, &refs[i]);
+                                 total += refs[i].size();
+                               }
+                               return total;
+                             });
+  if (verbose) {
+    fmt::println("    {:<24} {}", tiers + " bgra", formatStats(base));
+  }
+
+  std::vector<image_encode::FrameBuffer> outs;
+  for (int count : threads) {
+    if (count > 1 && count > (int)std::thread::hardware_concurrency()) {
+      break;
+    }
+    thread_pool::ThreadPool pool(count);
+    image_encode::CodecContextPool contexts(pool);
+    image_encode::MultiQualityJpegEncoder encoder(&pool, &contexts,
+                                                  &bufferPool);
+    std::string name = fmt::format("{} yuv threads {}", tiers, count);
+    BenchStats stats = runBench(info, "jpeg multi", name, info.srcSize, [&] {
+      if (encoder.Encode(src, info.width, 0, info.height, TJPF_BGRA, subsamp,
+                         info.flag, qualities, &outs) != 0) {
+        fmt::println(stderr, "Multi quality encode failed: {}",
+                     encoder.error());
+      }
+      int total = 0;
+      for (const auto& out : outs) total += out.size();
+      return total;
+    });
+    // 颜色转换相同, 输出应与直接从 BGRA 编码逐字节一致
+    for (size_t i = 0; i < qualities.size(); i++) {
+      if (outs[i].size() != refs[i].size() ||
+          memcmp(outs[i].data(), refs[i].data(), refs[i].size()) != 0) {
+        fmt::println(stderr, "Multi quality mismatch: quality {}",
+                     qualities[i]);
+      }
+    }
+    if (!verbose) continue;
+    fmt::println("    {:<24} {}", name, formatStats(stats));
+  }
+  if (verbose) {
+    for (size_t i = 0; i < qualities.size(); i++) {
+      fmt::println("    quality: {:>3}  ratio: {:>6.3f} \t ({:^4} => {:^4}) kb",
+                   qualities[i],
+                   100.0 * (1 - 1.0 * outs[i].size() / info.srcSize),
+                   info.srcSize / 1024, outs[i].size() / 1024);
+    }
+    fmt::println("");
+  }
+}
+REGISTER_TEST(jpeg_multi, "several jpeg qualities from one frame, shared yuv");
 
 static void test_jpeg_yuv(ImageInfo& info) {
   std::vector<int> flags = {TJFLAG_FASTDCT, TJFLAG_ACCURATEDCT};
   std::vector<std::string> flagNames = {"TJFLAG_FASTDCT", "TJFLAG_ACCURATEDCT"};
 
-  fmt::println("test yuv");
+  if (verbose) fmt::println("test yuv");
   for (size_t i = 0; i < flags.size(); i++) {
     info.flag = flags[i];
-    encode_yuv(info);
-    info.level = 1;
-    compress_lz4(info, true);
-    double lz4Time = info.cpsTime;
-    int lz4Size = info.cpsSize;
-    info.level = 3;
-    compress_zstd(info, true);
-    double zstdTime = info.cpsTime;
-    int zstdSize = info.cpsSize;
+    BenchStats enc = runBench(info, "yuv", flagNames[i], info.srcSize, [&info] {
+      encode_yuv(info);
+      return info.encSize;
+    });
+    info.encTime = enc.median;
+
+    BenchStats lz4, zstd;
+    int lz4Size = 0, zstdSize = 0;
+    bench_enc_compress(info, "yuv", flagNames[i], lz4, lz4Size, zstd,
+                       zstdSize);
+    if (!verbose) continue;
 
     fmt::println(
-        "enc ratio: {:>6.3f}  cps ratio: {:>6.3f}  encode time: {:>4.1f} ms  "
-        "lz4 time: {:>4.1f} ms  zstd time: {:>4.1f} ms  flag: {:<18} \t "
+        "enc ratio: {:>6.3f}  cps ratio: {:>6.3f}  flag: {:<18} \t "
         "({:^4} => {:^4} => [{:^4}|{:^4}] [lz4/zstd]) kb",
-        info.getEncRatio(), info.getCpsRatio(), info.encTime, lz4Time, zstdTime,
-        flagNames[i], info.srcSize / 1024, info.encSize / 1024, lz4Size / 1024,
+        info.getEncRatio(), info.getCpsRatio(), flagNames[i],
+        info.srcSize / 1024, info.encSize / 1024, lz4Size / 1024,
         zstdSize / 1024);
+    fmt::println("    encode {}", formatStats(enc));
+    fmt::println("    lz4    {}", formatStats(lz4));
+    fmt::println("    zstd   {}", formatStats(zstd));
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(jpeg_yuv, "planar yuv, then lz4/zstd");
+
+// 解码/解压测试, 无损格式逐字节校验, 有损格式校验 PSNR 下限
+static void test_decode(ImageInfo& info) {
+  const double kMinPsnr = 30.0;
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  image_encode::FrameBuffer out = bufferPool.Acquire(info.srcSize);
+  image_encode::CodecContext& context = codecContexts.Get();
+
+  if (verbose) fmt::println("test decode");
+  auto report = [&](const std::string& name, int inSize,
+                    const BenchStats& stats, bool ok, double psnr) {
+    if (!ok) fmt::println(stderr, "Decode round trip mismatch: {}", name);
+    if (!verbose) return;
+    std::string check = std::isinf(psnr) ? std::string("exact")
+                                         : fmt::format("{:.2f} dB", psnr);
+    fmt::println("    {:<36} {:>9}  {} \t ({:^4} => {:^4}) kb", name, check,
+                 formatStats(stats), inSize / 1024, info.srcSize / 1024);
+  };
+
+  // 无损压缩, 输出与原始数据逐字节一致
+  struct Lossless {
+    std::string name;
+    std::function<void()> compress;
+    std::function<int()> decompress;
+  };
+  std::vector<Lossless> lossless = {
+      {"lz4 level 1",
+       [&] {
+         info.level = 1;
+         compress_lz4(info);
+       },
+       [&] {
+         return LZ4_decompress_safe(info.cpsData, (char*)out.data(),
+                                    info.cpsSize, info.srcSize);
+       }},
+      {"lz4hc level 9",
+       [&] {
+         info.level = 9;
+         compress_lz4_hc(info);
+       },
+       [&] {
+         return LZ4_decompress_safe(info.cpsData, (char*)out.data(),
+                                    info.cpsSize, info.srcSize);
+       }},
+      {"zstd level 3",
+       [&] {
+         info.level = 3;
+         compress_zstd(info);
+       },
+       [&] {
+         // 复用上下文中的 ZSTD_DCtx
+         return (int)context.DecompressZstd(out.data(), info.srcSize,
+                                            info.cpsData, info.cpsSize);
+       }},
+  };
+  for (const Lossless& item : lossless) {
+    item.compress();
+    int size = 0;
+    BenchStats stats = runBench(info, "decode", item.name, info.srcSize, [&] {
+      size = item.decompress();
+      return info.cpsSize;
+    });
+    bool ok = size == info.srcSize && memcmp(out.data(), src, size) == 0;
+    report(item.name, info.cpsSize, stats, ok,
+           std::numeric_limits<double>::infinity());
+  }
+
+  // jpeg 解压, 分别测试快速上采样和快速 DCT
+  std::vector<int> flags = {0, TJFLAG_FASTUPSAMPLE, TJFLAG_FASTDCT,
+                            TJFLAG_FASTUPSAMPLE | TJFLAG_FASTDCT};
+  std::vector<std::string> flagNames = {"", " fastupsample", " fastdct",
+                                        " fastupsample fastdct"};
+  info.quality = 85;
+  encode_jpeg(info, TJSAMP_420);
+  for (size_t i = 0; i < flags.size(); i++) {
+    std::string name = fmt::format("jpeg quality {}{}", info.quality,
+                                   flagNames[i]);
+    int ret = 0;
+    BenchStats stats = runBench(info, "decode", name, info.srcSize, [&] {
+      ret = context.DecompressJpeg(encBuf.data(), info.encSize, out.data(), 0,
+                                   TJPF_BGRA, flags[i]);
+      return info.encSize;
+    });
+    image_encode::QualityMetrics metrics = {};
+    qualityMeter.Compare(src, 0, out.data(), 0, info.width, info.height,
+                         &metrics);
+    double psnr = metrics.psnr_bgr;
+    report(name, info.encSize, stats, ret == 0 && psnr >= kMinPsnr, psnr);
+  }
+
+  // yuv 解码, 4:4:4 没有色度上采样
+  for (int subsamp : {TJSAMP_420, TJSAMP_444}) {
+    encode_yuv(info, subsamp);
+    for (int flag : {0, TJFLAG_FASTUPSAMPLE}) {
+      if (subsamp == TJSAMP_444 && flag != 0) continue;
+      std::string name = fmt::format("yuv{}{}",
+                                     subsamp == TJSAMP_420 ? 420 : 444,
+                                     flag != 0 ? " fastupsample" : "");
+      int ret = 0;
+      BenchStats stats = runBench(info, "decode", name, info.srcSize, [&] {
+        ret = context.DecodeYuv((const unsigned char*)info.encData, 4,
+                                subsamp, out.data(), info.width, 0,
+                                info.height, TJPF_BGRA, flag);
+        return info.encSize;
+      });
+      image_encode::QualityMetrics metrics = {};
+      qualityMeter.Compare(src, 0, out.data(), 0, info.width, info.height,
+                           &metrics);
+      double psnr = metrics.psnr_bgr;
+      report(name, info.encSize, stats, ret == 0 && psnr >= kMinPsnr, psnr);
+    }
   }
 
+#ifdef HAVE_QOI
+  // qoi 按 RGB 编码, 与转换后的 RGB 比较
+  const size_t pixels = (size_t)info.width * info.height;
+  encode_qoi(info);
+  image_encode::FrameBuffer rgb = bufferPool.Acquire(pixels * 3);
+  image_encode::BgraToRgb(src, info.width, info.width * 4, info.height,
+                          rgb.data());
+  void* decoded = nullptr;
+  BenchStats stats = runBench(info, "decode", "qoi", info.srcSize, [&] {
+    // qoi_decode 每次都分配输出, 只保留最后一次用于校验
+    free(decoded);
+    qoi_desc desc;
+    decoded = qoi_decode(info.encData, info.encSize, &desc, 3);
+    return info.encSize;
+  });
+  bool same =
+      decoded != nullptr && memcmp(decoded, rgb.data(), pixels * 3) == 0;
+  free(decoded);
+  report("qoi", info.encSize, stats, same,
+         std::numeric_limits<double>::infinity());
+#endif
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(decode, "decode and decompress with round-trip checks");
+
+// jpeg 各质量和 DCT 方式的码率、编码时间和失真, 以及质量指标本身的耗时
+static void test_quality(ImageInfo& info) {
+  int subsamp = TJSAMP_420;
+  std::vector<int> qualities = {50, 60, 70, 75, 80, 85, 90, 95, 100};
+  std::vector<int> flags = {TJFLAG_FASTDCT, TJFLAG_ACCURATEDCT};
+  std::vector<std::string> flagNames = {"fastdct", "accuratedct"};
+  std::vector<int> threads = {1, 2, 4, 8, 16};
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  image_encode::FrameBuffer out = bufferPool.Acquire(info.srcSize);
+  image_encode::CodecContext& context = codecContexts.Get();
+  image_encode::QualityMetrics metrics = {};
+
+  if (verbose) fmt::println("test quality");
+  for (int quality : qualities) {
+    for (size_t i = 0; i < flags.size(); i++) {
+      info.quality = quality;
+      info.flag = flags[i];
+      std::string name = fmt::format("quality {} {}", quality, flagNames[i]);
+      BenchStats enc = runBench(info, "quality", name, info.srcSize, [&] {
+        encode_jpeg(info, subsamp);
+        return info.encSize;
+      });
+      if (context.DecompressJpeg(encBuf.data(), info.encSize, out.data(), 0,
+                                 TJPF_BGRA, 0) != 0 ||
+          qualityMeter.Compare(src, 0, out.data(), 0, info.width,
+                               info.height, &metrics) != 0) {
+        fmt::println(stderr, "Quality measure failed: {}", name);
+        continue;
+      }
+      if (!verbose) continue;
+      fmt::println(
+          "    {:<24} {:>4} kb  {:>6.2f} ms  psnr: {:>5.2f} (b {:>5.2f} g "
+          "{:>5.2f} r {:>5.2f})  ssim: {:.4f}  ms-ssim: {:.4f}",
+          name, info.encSize / 1024, enc.median, metrics.psnr_bgr,
+          metrics.psnr[0], metrics.psnr[1], metrics.psnr[2], metrics.ssim,
+          metrics.ms_ssim);
+    }
+  }
+
+  // 指标计算按行分段并行
+  for (int count : threads) {
+    if (count > 1 && count > (int)std::thread::hardware_concurrency()) {
+      break;
+    }
+    thread_pool::ThreadPool pool(count);
+    image_encode::QualityMeter meter(&pool);
+    std::string name = fmt::format(
+        "meter {} threads {}", image_encode::PixelIsaName(meter.isa()), count);
+    BenchStats stats = runBench(info, "quality", name, info.srcSize, [&] {
+      meter.Compare(src, 0, out.data(), 0, info.width, info.height, &metrics);
+      return info.srcSize;
+    });
+    if (!verbose) continue;
+    fmt::println("    {:<24} {}", name, formatStats(stats));
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(quality, "jpeg rate-distortion and quality metric cost");
+
+// 切分成条带并行编码, 与整帧一次编码对比; 拼接结果按标准解码校验尺寸和 PSNR
+static void test_jpeg_tiled(ImageInfo& info) {
+  const double kMaxPsnrLoss = 0.05;
+  int subsamp = TJSAMP_420;
+  std::vector<int> strips = {1, 2, 3, 7};
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  image_encode::FrameBuffer out = bufferPool.Acquire(info.srcSize);
+  thread_pool::ThreadPool pool(std::thread::hardware_concurrency());
+  image_encode::CodecContextPool contexts(pool);
+  image_encode::TiledJpegEncoder encoder(&pool, &contexts, &bufferPool);
+  image_encode::CodecContext& context = codecContexts.Get();
+
+  // 出现警告即失败, 尺寸必须与原图一致, 返回 PSNR, 失败返回 -1
+  auto decode = [&]() -> double {
+    if (context.DecompressJpeg(encBuf.data(), encBuf.size(), out.data(), 0,
+                               TJPF_BGRA, TJFLAG_STOPONWARNING) != 0 ||
+        tj3Get(context.tjd(), TJPARAM_JPEGWIDTH) != info.width ||
+        tj3Get(context.tjd(), TJPARAM_JPEGHEIGHT) != info.height) {
+      return -1;
+    }
+    image_encode::QualityMetrics metrics = {};
+    qualityMeter.Compare(src, 0, out.data(), 0, info.width, info.height,
+                         &metrics);
+    return metrics.psnr_bgr;
+  };
+  auto report = [&](const std::string& name, const BenchStats& stats,
+                    double psnr) {
+    if (!verbose) return;
+    fmt::println(
+        "    {:<10} ratio: {:>6.3f}  psnr: {:>6.2f}  {} \t ({:^4} => {:^4}) kb",
+        name, info.getEncRatio(), psnr, formatStats(stats),
+        info.srcSize / 1024, info.encSize / 1024);
+  };
+
+  if (verbose) fmt::println("test jpeg tiled");
+  BenchStats stats = runBench(info, "jpeg tiled", "single", info.srcSize, [&] {
+    if (context.CompressJpeg(src, info.width, 0, info.height, TJPF_BGRA,
+                             subsamp, info.quality, info.flag, &encBuf) != 0) {
+      fmt::println(stderr, "Jpeg encode failed: {}", tjGetErrorStr());
+    }
+    info.encSize = encBuf.size();
+    return info.encSize;
+  });
+  double basePsnr = decode();
+  if (basePsnr < 0) {
+    fmt::println(stderr, "Jpeg round trip failed: single");
+  }
+  report("single", stats, basePsnr);
+
+  for (int count : strips) {
+    std::string name = fmt::format("strips {}", count);
+    stats = runBench(info, "jpeg tiled", name, info.srcSize, [&] {
+      int ret = encoder.Encode(src, info.width, 0, info.height, TJPF_BGRA,
+                               subsamp, info.quality, info.flag, &encBuf,
+                               count);
+      if (ret != 0) {
+        fmt::println(stderr, "Tiled encode failed: {}", encoder.error());
+      }
+      info.encSize = encBuf.size();
+      return info.encSize;
+    });
+    info.encTime = stats.median;
+    double psnr = decode();
+    if (psnr < 0 || psnr < basePsnr - kMaxPsnrLoss) {
+      fmt::println(stderr, "Tiled jpeg round trip mismatch: {}", name);
+    }
+    report(name, stats, psnr);
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(jpeg_tiled, "strip-parallel jpeg against a single-call encode");
+
+// 按内容选择每个图块的编码, 与整帧使用单一编码比较大小、时间和质量
+static void test_tile_router(ImageInfo& info) {
+  std::vector<int> threads = {1, 2, 4, 8, 16};
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  image_encode::FrameBuffer out = bufferPool.Acquire(info.srcSize);
+  image_encode::QualityMetrics metrics = {};
+  int flag = info.flag;
+  int quality = info.quality;
+  info.quality = 80;
+  image_encode::TileRouterOptions options = tileOptions(info);
+
+  if (verbose) fmt::println("test tile router");
+  auto report = [&](const std::string& name, int size, const BenchStats& enc,
+                    const BenchStats& dec) {
+    if (!verbose) return;
+    fmt::println(
+        "    {:<24} {:>5} kb  enc: {:>6.2f} ms  dec: {:>6.2f} ms  psnr: "
+        "{:>6.2f}  ms-ssim: {:.4f}",
+        name, size / 1024, enc.median, dec.median,
+        std::isinf(metrics.psnr_bgr) ? 100.0 : metrics.psnr_bgr,
+        metrics.ms_ssim);
+  };
+
+  for (int count : threads) {
+    if (count > 1 && count > (int)std::thread::hardware_concurrency()) {
+      break;
+    }
+    thread_pool::ThreadPool pool(count);
+    image_encode::CodecContextPool contexts(pool);
+    image_encode::TileRouter router(&pool, &contexts, &tileClassifier);
+    std::string name = fmt::format("tiles {} threads {}", info.quality, count);
+    BenchStats enc = runBench(info, "tile router", name, info.srcSize, [&] {
+      if (router.Encode(src, info.width, 0, info.height, options, &encBuf) !=
+          0) {
+        fmt::println(stderr, "Tile encode failed: {}", router.error());
+      }
+      info.encSize = encBuf.size();
+      return info.encSize;
+    });
+    BenchStats dec = runBench(info, "tile router", name + " decode",
+                              info.srcSize, [&] {
+                                if (router.Decode(encBuf.data(), info.encSize,
+                                                  out.data(), 0) != 0) {
+                                  fmt::println(stderr,
+                                               "Tile decode failed: {}",
+                                               router.error());
+                                }
+                                return info.encSize;
+                              });
+    qualityMeter.Compare(src, 0, out.data(), 0, info.width, info.height,
+                         &metrics);
+    report(name, info.encSize, enc, dec);
+    if (count == 1 && verbose) {
+      const auto& counts = router.class_counts();
+      const auto& bytes = router.class_bytes();
+      std::string classes;
+      for (int i = 0; i < image_encode::kTileClasses; i++) {
+        classes += fmt::format(
+            " {}: {} ({} kb)",
+            image_encode::TileClassName((image_encode::TileClass)i),
+            counts[i], bytes[i] / 1024);
+      }
+      fmt::println("    {:<24}{}  qoi: {}", "tile classes", classes,
+                   image_encode::HaveQoi() ? "yes" : "no (palette)");
+    }
+  }
+
+  // 整帧使用单一编码, 单线程
+  std::vector<std::string> items = {
+      fmt::format("jpeg:{}", info.quality),
+      fmt::format("jpeg444:{}", info.quality), "lz4:1", "zstd:1", "zstd:3"};
+#ifdef HAVE_QOI
+  items.emplace_back("qoi");
+#endif
+  for (const std::string& item : items) {
+    CodecChain chain;
+    std::string error;
+    if (!parseChain(item, chain, error)) continue;
+    info.encFunc = chain.encoder != nullptr ? chain.encoder->encFunc : nullptr;
+    info.cpsFunc =
+        chain.compressor != nullptr ? chain.compressor->cpsFunc : nullptr;
+    info.quality = chain.quality;
+    info.level = chain.level;
+    int size = 0;
+    BenchStats enc = runBench(info, "tile router", item, info.srcSize, [&] {
+      if (info.encFunc != nullptr) info.encFunc(&info);
+      if (info.cpsFunc != nullptr) info.cpsFunc(&info);
+      size = info.cpsFunc != nullptr ? info.cpsSize : info.encSize;
+      return size;
+    });
+    BenchStats dec = runBench(info, "tile router", item + " decode",
+                              info.srcSize, [&] {
+                                decode_chain(info, chain, (char*)out.data(),
+                                             info.srcSize);
+                                return size;
+                              });
+    qualityMeter.Compare(src, 0, out.data(), 0, info.width, info.height,
+                         &metrics);
+    report(item, size, enc, dec);
+  }
+  info.encFunc = nullptr;
+  info.cpsFunc = nullptr;
+  info.flag = flag;
+  info.quality = quality;
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(tile_router, "content-aware tiles against single codecs");
+
+// ParallelFor 和 ParallelReduce 的结果校验, 尺寸和粒度取奇数覆盖不整除的切分
+static bool check_parallel_for(thread_pool::ThreadPool& pool) {
+  std::atomic<bool> ok(true);
+
+  // 二维范围的每一格恰好访问一次, 块不超过粒度
+  for (size_t rows : {1, 7, 33}) {
+    for (size_t cols : {1, 5, 61}) {
+      for (size_t grain : {1, 3, 8}) {
+        std::vector<std::atomic<int>> visits(rows * cols);
+        thread_pool::Range2d range = {2, 2 + rows, 3, 3 + cols};
+        pool.ParallelFor(range, grain, grain + 1,
+                         [&](const thread_pool::Range2d& block) {
+          if (block.row_end - block.row_begin > grain ||
+              block.col_end - block.col_begin > grain + 1) {
+            ok = false;
+          }
+          for (size_t r = block.row_begin; r < block.row_end; r++) {
+            for (size_t c = block.col_begin; c < block.col_end; c++) {
+              visits[(r - 2) * cols + c - 3]++;
+            }
+          }
+        });
+        for (const auto& it : visits) {
+          ok = ok && it.load() == 1;
+        }
+      }
+    }
+  }
+
+  // 块的值按下标顺序合并, 结果与串行的顺序一致
+  for (size_t size : {0, 1, 17, 1001}) {
+    for (size_t grain : {1, 7, 64}) {
+      std::vector<size_t> serial(size);
+      std::iota(serial.begin(), serial.end(), 5);
+      std::vector<size_t> result = pool.ParallelReduce(
+          5, 5 + size, grain, std::vector<size_t>(),
+          [&](size_t begin, size_t end) {
+            if ((begin - 5) % grain != 0 || end - begin > grain) {
+              ok = false;
+            }
+            std::vector<size_t> chunk(end - begin);
+            std::iota(chunk.begin(), chunk.end(), begin);
+            return chunk;
+          },
+          [](std::vector<size_t> a, std::vector<size_t> b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+          });
+      ok = ok && result == serial;
+    }
+  }
+
+  // 嵌套: 外层每个下标再并行一次, 等待的线程帮助执行内层的块
+  std::atomic<uint64_t> sum(0);
+  uint64_t expected = 0;
+  for (size_t i = 0; i < 9; i++) {
+    for (size_t j = 0; j < (i + 1) * 13; j++) expected += i * 1000 + j;
+  }
+  pool.ParallelFor(0, 9, 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      pool.ParallelFor(0, (i + 1) * 13, 4, [&](size_t first, size_t last) {
+        for (size_t j = first; j < last; j++) sum += i * 1000 + j;
+      });
+    }
+  });
+  ok = ok && sum.load() == expected;
+
+  // 循环体为具名的左值, 包括 const
+  std::atomic<size_t> cells(0);
+  auto body = [&](const thread_pool::Range2d& block) {
+    cells += (block.row_end - block.row_begin) *
+             (block.col_end - block.col_begin);
+  };
+  const auto& constBody = body;
+  pool.ParallelFor(thread_pool::Range2d{0, 4, 0, 5}, 1, 2, body);
+  pool.ParallelFor(thread_pool::Range2d{0, 3, 0, 3}, 2, 1, constBody);
+  auto rows = [&](size_t begin, size_t end) { cells += end - begin; };
+  pool.ParallelFor(0, 11, 3, rows);
+  return ok && cells.load() == 20 + 9 + 11;
+}
+
+// TaskGraph 的结果校验: 有环时不执行任何节点, 按帧流水线连接的链重复运行时
+// 每个节点执行一次且顺序满足所有依赖
+static bool check_task_graph(thread_pool::ThreadPool& pool) {
+  std::atomic<int> ran(0);
+  thread_pool::TaskGraph cycle(&pool);
+  size_t a = cycle.Emplace([&] { ran++; });
+  size_t b = cycle.Emplace([&] { ran++; });
+  size_t c = cycle.Emplace([&] { ran++; });
+  cycle.Emplace([&] { ran++; });
+  cycle.Precede(a, b);
+  cycle.Precede(b, c);
+  cycle.Precede(c, a);
+  bool ok = !cycle.Run() && ran.load() == 0;
+
+  // 每帧 读取 -> 编码 -> 压缩 -> 写入, 读取和写入各自按帧顺序,
+  // 第 k 帧的读取等待第 k - depth 帧写入, 同时最多 depth 帧
+  const size_t frames = 12;
+  const size_t stages = 4;
+  const size_t depth = 3;
+  std::atomic<int> clock(0);
+  std::vector<std::atomic<int>> stamps(frames * stages);
+  thread_pool::TaskGraph graph(&pool);
+  for (size_t k = 0; k < frames; k++) {
+    size_t prev = 0;
+    for (size_t stage = 0; stage < stages; stage++) {
+      std::atomic<int>* stamp = &stamps[k * stages + stage];
+      size_t node = graph.Emplace([&clock, stamp] { *stamp = ++clock; });
+      if (stage > 0) {
+        graph.Precede(prev, node);
+      }
+      prev = node;
+    }
+    if (k > 0) {
+      graph.Precede((k - 1) * stages, k * stages);
+      graph.Precede((k - 1) * stages + stages - 1, k * stages + stages - 1);
+    }
+    if (k >= depth) {
+      graph.Precede((k - depth) * stages + stages - 1, k * stages);
+    }
+  }
+  auto at = [&](size_t k, size_t stage) {
+    return stamps[k * stages + stage].load();
+  };
+  for (int run = 0; run < 3; run++) {
+    clock = 0;
+    for (auto& it : stamps) it = 0;
+    ok = ok && graph.Run() && clock.load() == (int)(frames * stages);
+    for (size_t k = 0; k < frames; k++) {
+      for (size_t stage = 1; stage < stages; stage++) {
+        ok = ok && at(k, stage - 1) != 0 && at(k, stage - 1) < at(k, stage);
+      }
+      if (k > 0) {
+        ok = ok && at(k - 1, 0) < at(k, 0) &&
+             at(k - 1, stages - 1) < at(k, stages - 1);
+      }
+      if (k >= depth) {
+        ok = ok && at(k - depth, stages - 1) < at(k, 0);
+      }
+    }
+  }
+  return ok;
+}
+
+// 线程池调度开销: 每个 64x64 块一个只读一个像素的任务, 时间几乎都是调度
+static void test_thread_pool(ImageInfo& info) {
+  std::vector<int> threads = {1, 2, 4, 8, 16};
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  int pitch = info.width * 4;
+  int cols = (info.width + 63) / 64;
+  int tiles = cols * ((info.height + 63) / 64);
+  std::vector<uint32_t> sums(tiles);
+  auto touch = [&](int tile) {
+    int x = tile % cols * 64;
+    int y = tile / cols * 64;
+    std::memcpy(&sums[tile], src + y * pitch + x * 4, sizeof(uint32_t));
+  };
+
+  if (verbose) fmt::println("test thread pool");
+  for (int count : threads) {
+    if (count > 1 && count > (int)std::thread::hardware_concurrency()) {
+      break;
+    }
+    thread_pool::ThreadPool pool(count);
+    if (!check_parallel_for(pool)) {
+      fmt::println(stderr, "Parallel for check failed: threads {}", count);
+    }
+    if (!check_task_graph(pool)) {
+      fmt::println(stderr, "Task graph check failed: threads {}", count);
+    }
+    std::vector<std::future<void>> futures;
+    futures.reserve(tiles);
+    std::string name = fmt::format("submit {} tasks threads {}", tiles, count);
+    BenchStats stats = runBench(info, "thread pool", name, info.srcSize, [&] {
+      futures.clear();
+      for (int tile = 0; tile < tiles; tile++) {
+        futures.emplace_back(pool.Submit(touch, tile));
+      }
+      for (auto& it : futures) {
+        it.wait();
+      }
+      return info.srcSize;
+    });
+    if (verbose) {
+      fmt::println("    {:<36} {:>7.1f} ns/task  {}", name,
+                   stats.median * 1e6 / tiles, formatStats(stats));
+    }
+
+    // 不返回 future, 任务从线程本地的空闲链表分配
+    std::atomic<int> left(0);
+    name = fmt::format("execute {} tasks threads {}", tiles, count);
+    stats = runBench(info, "thread pool", name, info.srcSize, [&] {
+      left.store(tiles);
+      for (int tile = 0; tile < tiles; tile++) {
+        pool.Execute([&touch, &left](int tile) {
+          touch(tile);
+          left.fetch_sub(1, std::memory_order_release);
+        }, tile);
+      }
+      while (left.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+      }
+      return info.srcSize;
+    });
+    if (verbose) {
+      fmt::println("    {:<36} {:>7.1f} ns/task  {}", name,
+                   stats.median * 1e6 / tiles, formatStats(stats));
+    }
+
+    // 块网格递归二分, 每个块一个任务, 调用线程也参与
+    thread_pool::Range2d grid = {0, (size_t)(tiles / cols), 0, (size_t)cols};
+    name = fmt::format("parallel_for {} tiles threads {}", tiles, count);
+    stats = runBench(info, "thread pool", name, info.srcSize, [&] {
+      pool.ParallelFor(grid, 1, 1, [&](const thread_pool::Range2d& range) {
+        touch((int)(range.row_begin * cols + range.col_begin));
+      });
+      return info.srcSize;
+    });
+    if (verbose) {
+      fmt::println("    {:<36} {:>7.1f} ns/task  {}", name,
+                   stats.median * 1e6 / tiles, formatStats(stats));
+    }
+
+    // 每个块一个节点, 全部完成后汇总节点才执行, 图建好后每次只重置计数
+    thread_pool::TaskGraph graph(&pool);
+    uint32_t total = 0;
+    size_t sink = graph.Emplace([&] {
+      total = std::accumulate(sums.begin(), sums.end(), 0u);
+    });
+    for (int tile = 0; tile < tiles; tile++) {
+      graph.Precede(graph.Emplace([&touch, tile] { touch(tile); }), sink);
+    }
+    name = fmt::format("graph {} nodes threads {}", tiles + 1, count);
+    stats = runBench(info, "thread pool", name, info.srcSize, [&] {
+      graph.Run();
+      return info.srcSize;
+    });
+    if (!verbose) continue;
+    fmt::println("    {:<36} {:>7.1f} ns/task  {}", name,
+                 stats.median * 1e6 / (tiles + 1), formatStats(stats));
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(thread_pool, "thread pool scheduling overhead per task");
+
+// 后台的 zstd 压缩持续占满线程池时实时帧的延迟: 不加负载, 两者同一优先级,
+// 实时帧高优先级并带截止时间而后台任务为后台优先级
+static void test_priority(ImageInfo& info) {
+  using thread_pool::Priority;
+  std::vector<int> threads = {1, 2, 4, 8, 16};
+  const int bands = 16;
+  const int band = info.srcSize / bands;
+  const int chunk = std::min(info.srcSize, 64 * 1024);
+  std::vector<std::vector<char>> bandOut(
+      bands, std::vector<char>(LZ4_compressBound(info.srcSize - band * 15)));
+
+  // 压缩一块后重新提交自己, 直到 stop
+  struct Chain {
+    thread_pool::ThreadPool* pool;
+    thread_pool::TaskOptions options;
+    const char* src;
+    int size;
+    std::vector<char> dst;
+    std::atomic<bool>* stop;
+    std::atomic<int>* active;
+
+    void Run() {
+      ZSTD_compress(dst.data(), dst.size(), src, size, 19);
+      if (stop->load()) {
+        active->fetch_sub(1);
+        return;
+      }
+      pool->ExecuteWith(options, [this] { Run(); });
+    }
+  };
+
+  struct Mode {
+    const char* name;
+    bool loaded;
+    Priority live;
+    Priority bulk;
+  };
+  std::vector<Mode> modes = {
+      {"idle", false, Priority::kNormal, Priority::kNormal},
+      {"shared", true, Priority::kNormal, Priority::kNormal},
+      {"priority", true, Priority::kHigh, Priority::kBackground},
+  };
+
+  if (verbose) fmt::println("test priority");
+  for (int count : threads) {
+    if (count > 1 && count > (int)std::thread::hardware_concurrency()) {
+      break;
+    }
+    for (const Mode& mode : modes) {
+      thread_pool::ThreadPool pool(count);
+      std::atomic<bool> stop(false);
+      std::atomic<int> active(0);
+      std::vector<Chain> chains;
+      if (mode.loaded) {
+        chains.resize(count);
+      }
+      for (size_t i = 0; i < chains.size(); i++) {
+        int offset = (int)(i * chunk % (info.srcSize - chunk + 1));
+        chains[i] = {&pool, {mode.bulk}, info.srcData + offset, chunk,
+                     std::vector<char>(ZSTD_compressBound(chunk)), &stop,
+                     &active};
+      }
+      for (Chain& chain : chains) {
+        active.fetch_add(1);
+        pool.ExecuteWith(chain.options, [&chain] { chain.Run(); });
+      }
+
+      // 每帧 16 个条带并行 lz4 压缩, 截止时间为 60 fps 的一帧
+      std::string name = fmt::format("{} threads {}", mode.name, count);
+      BenchStats stats = runBench(info, "priority", name, info.srcSize, [&] {
+        thread_pool::PriorityScope scope(
+            {mode.live,
+             std::chrono::steady_clock::now() + std::chrono::milliseconds(16)});
+        std::atomic<int> total(0);
+        pool.ParallelFor(0, bands, 1, [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; i++) {
+            int size = i + 1 == bands ? info.srcSize - band * (int)i : band;
+            total += LZ4_compress_default(info.srcData + band * i,
+                                          bandOut[i].data(), size,
+                                          (int)bandOut[i].size());
+          }
+        });
+        return total.load();
+      });
+      stop.store(true);
+      while (active.load() != 0) {
+        std::this_thread::yield();
+      }
+      if (!verbose) continue;
+      fmt::println("    {:<24} misses: {:>4}  {}", name,
+                   pool.deadline_misses(), formatStats(stats));
+    }
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(priority, "live frame latency under background load");
+
+// 与上一帧比较, 只编码变化的 64x64 块
+static void test_delta(ImageInfo& info) {
+  const double kMinPsnr = 30.0;
+  const unsigned char* frame = (const unsigned char*)info.srcData;
+  const size_t frameSize = (size_t)info.width * info.height * 4;
+  image_encode::FrameBuffer rebuilt = bufferPool.Acquire(frameSize);
+  image_encode::CodecContext& context = codecContexts.Get();
+  std::vector<image_encode::TileRect> tiles;
+  image_encode::DeltaFrame delta;
+  delta.payload = bufferPool.Acquire(0);
+
+  std::vector<int> qualities = {85, 100};
+  std::vector<std::string> names;
+  std::vector<image_encode::TileEncoder> encoders;
+  std::vector<bool> lossless;
+  for (int quality : qualities) {
+    names.emplace_back(fmt::format("jpeg quality {}", quality));
+    lossless.push_back(false);
+    encoders.emplace_back(image_encode::JpegTileEncoder(
+        &context, quality, TJSAMP_420, info.flag));
+  }
+  names.emplace_back("lz4 level 1");
+  lossless.push_back(true);
+  encoders.emplace_back(image_encode::Lz4TileEncoder(&context, 1));
+#ifdef HAVE_QOI
+  names.emplace_back("qoi");
+  lossless.push_back(true);
+  encoders.emplace_back(image_encode::QoiTileEncoder());
+#endif
+
+  if (verbose) fmt::println("test delta");
+  for (size_t i = 0; i < encoders.size(); i++) {
+    std::string name =
+        fmt::format("{} tile {}", names[i], frameDelta.tile_size());
+    BenchStats stats = runBench(info, "delta", name, info.srcSize, [&] {
+      tiles = frameDelta.Diff(frame, info.width, 0, info.height);
+      if (frameDelta.Encode(frame, info.width, 0, tiles, encoders[i],
+                            &delta) != 0) {
+        fmt::println(stderr, "Delta encode failed: {}", name);
+      }
+      return (int)delta.payload.size();
+    });
+    info.encSize = delta.payload.size();
+    info.encTime = stats.median;
+
+    // 在上一帧的副本上应用块更新, 无损编码逐字节一致, jpeg 校验 PSNR 下限
+    if (!frameDelta.CopyPrevious(rebuilt.data(), info.width, 0,
+                                 info.height)) {
+      std::memset(rebuilt.data(), 0, frameSize);
+    }
+    bool ok = frameDelta.Apply(delta, encoders[i], rebuilt.data(),
+                               info.width, 0, info.height) == 0;
+    double psnr = std::numeric_limits<double>::infinity();
+    if (lossless[i]) {
+      ok = ok && memcmp(rebuilt.data(), frame, frameSize) == 0;
+    } else {
+      image_encode::QualityMetrics metrics = {};
+      qualityMeter.Compare(frame, 0, rebuilt.data(), 0, info.width,
+                           info.height, &metrics);
+      psnr = metrics.psnr_bgr;
+      ok = ok && psnr >= kMinPsnr;
+    }
+    if (!ok) fmt::println(stderr, "Delta round trip mismatch: {}", name);
+    if (!verbose) continue;
+    std::string check = std::isinf(psnr) ? std::string("exact")
+                                         : fmt::format("{:.2f} dB", psnr);
+    fmt::println(
+        "    {:<24} dirty: {:>5} tiles  {:>9}  ratio: {:>6.3f}  {} \t ({:^4} "
+        "=> {:^4}) kb",
+        names[i], tiles.size(), check, info.getEncRatio(), formatStats(stats),
+        info.srcSize / 1024, info.encSize / 1024);
+  }
+  frameDelta.Commit(frame, info.width, 0, info.height, tiles);
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(delta, "dirty 64x64 tiles against the previous frame");
+
+// BGRA 转换为 bgr/rgb/rgba/平面, 各指令集与 xtensor 视图赋值对比
+static void test_convert(ImageInfo& info) {
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  const size_t pixels = (size_t)info.width * info.height;
+  image_encode::FrameBuffer out = bufferPool.Acquire(pixels * 4);
+  image_encode::FrameBuffer ref = bufferPool.Acquire(pixels * 4);
+  unsigned char* dst = out.data();
+
+  using Convert = void (*)(const image_encode::PixelConverter&,
+                           const unsigned char*, int, int, unsigned char*);
+  struct Case {
+    const char* name;
+    int channels;
+    Convert convert;
+  };
+  std::vector<Case> cases = {
+      {"bgr", 3,
+       [](const image_encode::PixelConverter& c, const unsigned char* s,
+          int w, int h, unsigned char* d) { c.ToBgr(s, w, w * 4, h, d); }},
+      {"rgb", 3,
+       [](const image_encode::PixelConverter& c, const unsigned char* s,
+          int w, int h, unsigned char* d) { c.ToRgb(s, w, w * 4, h, d); }},
+      {"rgba", 4,
+       [](const image_encode::PixelConverter& c, const unsigned char* s,
+          int w, int h, unsigned char* d) { c.ToRgba(s, w, w * 4, h, d); }},
+      {"planar", 3,
+       [](const image_encode::PixelConverter& c, const unsigned char* s,
+          int w, int h, unsigned char* d) {
+         size_t n = (size_t)w * h;
+         c.ToPlanar(s, w, w * 4, h, d, d + n, d + n * 2);
+       }},
+  };
+  std::vector<image_encode::PixelIsa> isas = {
+      image_encode::PixelIsa::kScalar, image_encode::PixelIsa::kSse41,
+      image_encode::PixelIsa::kAvx2, image_encode::PixelIsa::kAvx512};
+
+  if (verbose) fmt::println("test convert");
+  for (const Case& item : cases) {
+    size_t outSize = pixels * item.channels;
+    image_encode::PixelConverter scalar(image_encode::PixelIsa::kScalar);
+    item.convert(scalar, src, info.width, info.height, ref.data());
+    for (image_encode::PixelIsa isa : isas) {
+      image_encode::PixelConverter converter(isa);
+      if (!converter.valid()) continue;
+      std::string name = fmt::format("{} {}", item.name,
+                                     image_encode::PixelIsaName(isa));
+      BenchStats stats = runBench(info, "convert", name, info.srcSize, [&] {
+        item.convert(converter, src, info.width, info.height, dst);
+        return (int)outSize;
+      });
+      bool same = memcmp(dst, ref.data(), outSize) == 0;
+      if (!same) fmt::println(stderr, "Convert mismatch: {}", name);
+      if (!verbose) continue;
+      fmt::println("    {:<16} {}", name, formatStats(stats));
+    }
+  }
+
+  // xtensor 视图赋值到调用方的缓冲区, 实际搬运像素
+  using namespace xt::placeholders;
+  std::vector<size_t> shape = {(size_t)info.height, (size_t)info.width, 4};
+  auto a = xt::adapt(src, pixels * 4, xt::no_ownership(), shape);
+  std::vector<size_t> shape3 = {(size_t)info.height, (size_t)info.width, 3};
+  std::vector<size_t> planes = {3, (size_t)info.height, (size_t)info.width};
+  auto rgb = xt::adapt(dst, pixels * 3, xt::no_ownership(), shape3);
+  auto rgba = xt::adapt(dst, pixels * 4, xt::no_ownership(), shape);
+  auto planar = xt::adapt(dst, pixels * 3, xt::no_ownership(), planes);
+  std::vector<std::pair<std::string, std::function<void()>>> views = {
+      {"bgr xtensor",
+       [&] { rgb = xt::strided_view(a, {xt::ellipsis(), xt::range(_, 3)}); }},
+      {"rgb xtensor",
+       [&] {
+         rgb = xt::strided_view(a, {xt::ellipsis(), xt::range(2, _, -1)});
+       }},
+      {"rgba xtensor",
+       [&] { rgba = xt::view(a, xt::all(), xt::all(), xt::keep(2, 1, 0, 3)); }},
+      {"planar xtensor",
+       [&] {
+         planar = xt::transpose(
+             xt::strided_view(a, {xt::ellipsis(), xt::range(_, 3)}),
+             {2, 0, 1});
+       }},
+  };
+  for (size_t i = 0; i < views.size(); i++) {
+    BenchStats stats = runBench(info, "convert", views[i].first, info.srcSize,
+                                [&] {
+                                  views[i].second();
+                                  return (int)(pixels * (i == 2 ? 4 : 3));
+                                });
+    if (!verbose) continue;
+    fmt::println("    {:<16} {}", views[i].first, formatStats(stats));
+  }
+
+  if (verbose) fmt::println("");
+}
+REGISTER_TEST(convert, "bgra pixel conversion per instruction set");
+
+// 按命令行指定的链测试, 编码和压缩一起计时
+static void test_chain(ImageInfo& info, const CodecChain& chain) {
+  info.encFunc = chain.encoder != nullptr ? chain.encoder->encFunc : nullptr;
+  info.cpsFunc =
+      chain.compressor != nullptr ? chain.compressor->cpsFunc : nullptr;
+  info.quality = chain.quality;
+  info.level = chain.level;
+  BenchStats stats = runBench(info, "chain", chain.name, info.srcSize, [&] {
+    if (info.encFunc != nullptr) info.encFunc(&info);
+    if (info.cpsFunc == nullptr) return info.encSize;
+    info.cpsFunc(&info);
+    return info.cpsSize;
+  });
+  if (verbose) {
+    int dstSize = info.cpsFunc != nullptr ? info.cpsSize : info.encSize;
+    fmt::println(
+        "    {:<24}  ratio: {:>6.3f}  {} \t ({:^4} => {:^4}) kb", chain.name,
+        100.0 * (1 - 1.0 * dstSize / info.srcSize), formatStats(stats),
+        info.srcSize / 1024, dstSize / 1024);
+  }
+  info.encFunc = nullptr;
+  info.cpsFunc = nullptr;
+}
+
+static void test_chains(ImageInfo& info,
+                        const std::vector<CodecChain>& chains) {
+  if (verbose) fmt::println("test chain");
+  for (const CodecChain& chain : chains) {
+    test_chain(info, chain);
+  }
+  if (verbose) fmt::println("");
+}
+
+// 率失真-速度扫描的一个配置, 编码器受 DCT 方式影响时按 flag 拆成两个
+struct ParetoConfig {
+  std::string name;
+  CodecChain chain;
+  int flag;
+};
+
+// 各帧的累加值, 输出时除以帧数
+struct ParetoPoint {
+  int frames = 0;
+  double srcSize = 0;
+  double dstSize = 0;
+  double encTime = 0;  // 编码 + 压缩, ms
+  double decTime = 0;  // 解压 + 解码, ms
+  double psnr = 0;     // 无损按 kLosslessPsnr 计
+  double ssim = 0;
+  double msSsim = 0;
+  bool lossless = true;
+  bool failed = false;
+};
+
+static const double kLosslessPsnr = 100.0;
+static std::string paretoMetric = "psnr";  // 前沿使用的质量指标
+
+// 默认的扫描网格: jpeg 的质量、色度采样和二级压缩, 以及 yuv 和无损压缩作为参照
+static std::vector<CodecChain> paretoGrid() {
+  std::vector<std::string> items;
+  for (const char* encoder : {"jpeg", "jpeg422", "jpeg444", "jpeggray"}) {
+    for (int quality : {50, 70, 80, 85, 90, 95, 100}) {
+      for (const char* compressor : {"", "+lz4:1", "+zstd:1", "+zstd:3"}) {
+        items.emplace_back(fmt::format("{}:{}{}", encoder, quality,
+                                       compressor));
+      }
+    }
+  }
+  for (const char* encoder : {"yuv420", "yuv444"}) {
+    for (const char* compressor : {"+lz4:1", "+zstd:3"}) {
+      items.emplace_back(fmt::format("{}{}", encoder, compressor));
+    }
+  }
+  for (const char* compressor :
+       {"lz4:1", "lz4:8", "lz4hc:9", "zstd:1", "zstd:3", "zstd:9"}) {
+    items.emplace_back(compressor);
+  }
+
+  std::vector<CodecChain> chains;
+  for (const std::string& item : items) {
+    CodecChain chain;
+    std::string error;
+    if (parseChain(item, chain, error)) {
+      chains.emplace_back(chain);
+    }
+  }
+  return chains;
+}
+
+static std::vector<ParetoConfig> paretoConfigs(
+    const std::vector<CodecChain>& chains) {
+  std::vector<ParetoConfig> configs;
+  for (const CodecChain& chain : chains) {
+    if (chain.encoder != nullptr && chain.encoder->dct) {
+      configs.push_back({chain.name + " fastdct", chain, TJFLAG_FASTDCT});
+      configs.push_back(
+          {chain.name + " accuratedct", chain, TJFLAG_ACCURATEDCT});
+    } else {
+      configs.push_back({chain.name, chain, 0});
+    }
+  }
+  return configs;
+}
+
+// 每个配置先编解码一次计算质量, 再分别测试编码和解码时间
+static void test_pareto(ImageInfo& info,
+                        const std::vector<ParetoConfig>& configs,
+                        std::vector<ParetoPoint>& points) {
+  const unsigned char* src = (const unsigned char*)info.srcData;
+  image_encode::FrameBuffer out = bufferPool.Acquire(info.srcSize);
+  char* dst = (char*)out.data();
+  int flag = info.flag;
+
+  if (verbose) fmt::println("test pareto");
+  for (size_t i = 0; i < configs.size(); i++) {
+    const ParetoConfig& config = configs[i];
+    const CodecChain& chain = config.chain;
+    ParetoPoint& point = points[i];
+    info.encFunc = chain.encoder != nullptr ? chain.encoder->encFunc : nullptr;
+    info.cpsFunc =
+        chain.compressor != nullptr ? chain.compressor->cpsFunc : nullptr;
+    info.quality = chain.quality;
+    info.level = chain.level;
+    info.flag = config.flag;
+    auto encode = [&info] {
+      if (info.encFunc != nullptr) info.encFunc(&info);
+      if (info.cpsFunc == nullptr) return info.encSize;
+      info.cpsFunc(&info);
+      return info.cpsSize;
+    };
+
+    // 只有压缩器时输出整个文件, 逐字节比较
+    int dstSize = encode();
+    int outSize = decode_chain(info, chain, dst, info.srcSize);
+    image_encode::QualityMetrics metrics = {};
+    if (outSize < 0 ||
+        (chain.encoder == nullptr &&
+         (outSize != info.srcSize || memcmp(dst, src, outSize) != 0)) ||
+        qualityMeter.Compare(src, 0, out.data(), 0, info.width, info.height,
+                             &metrics) != 0) {
+      fmt::println(stderr, "Pareto round trip failed: {}", config.name);
+      point.failed = true;
+      continue;
+    }
+    bool lossless = std::isinf(metrics.psnr_bgr);
+    double psnr = lossless ? kLosslessPsnr : metrics.psnr_bgr;
+    double quality = paretoMetric == "ssim"      ? metrics.ssim
+                     : paretoMetric == "ms-ssim" ? metrics.ms_ssim
+                                                 : psnr;
+    BenchContext extra = {{"psnr", fmt::format("{:.3f}", psnr)},
+                          {"ssim", fmt::format("{:.5f}", metrics.ssim)},
+                          {"msSsim", fmt::format("{:.5f}", metrics.ms_ssim)},
+                          {"quality", fmt::format("{:.5f}", quality)}};
+
+    BenchStats enc = runBench(info, "pareto encode", config.name,
+                              info.srcSize, encode, extra);
+    BenchStats dec = runBench(
+        info, "pareto decode", config.name, info.srcSize,
+        [&] {
+          ankerl::nanobench::doNotOptimizeAway(
+              decode_chain(info, chain, dst, info.srcSize));
+          return dstSize;
+        },
+        extra);
+
+    point.frames++;
+    point.srcSize += info.srcSize;
+    point.dstSize += dstSize;
+    point.encTime += enc.median;
+    point.decTime += dec.median;
+    point.psnr += psnr;
+    point.ssim += metrics.ssim;
+    point.msSsim += metrics.ms_ssim;
+    point.lossless = point.lossless && lossless;
+    if (!verbose) continue;
+    fmt::println(
+        "    {:<36} {:>5} kb  enc: {:>6.2f} ms  dec: {:>6.2f} ms  psnr: "
+        "{:>6.2f}  ssim: {:.4f}  ms-ssim: {:.4f}",
+        config.name, dstSize / 1024, enc.median, dec.median, psnr,
+        metrics.ssim, metrics.ms_ssim);
+  }
+  info.encFunc = nullptr;
+  info.cpsFunc = nullptr;
+  info.flag = flag;
+  if (verbose) fmt::println("");
+}
+
+// 输出大小和编解码时间越小越好, 质量越大越好, 返回不被其他配置支配的配置
+static std::vector<size_t> paretoFront(
+    const std::vector<ParetoPoint>& points) {
+  struct Score {
+    double size;
+    double time;
+    double quality;
+  };
+  std::vector<Score> scores(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    const ParetoPoint& point = points[i];
+    if (point.failed || point.frames == 0) continue;
+    double quality = paretoMetric == "ssim"      ? point.ssim
+                     : paretoMetric == "ms-ssim" ? point.msSsim
+                                                 : point.psnr;
+    scores[i] = {point.dstSize / point.frames,
+                 (point.encTime + point.decTime) / point.frames,
+                 quality / point.frames};
+  }
+
+  std::vector<size_t> front;
+  for (size_t i = 0; i < points.size(); i++) {
+    if (points[i].failed || points[i].frames == 0) continue;
+    const Score& a = scores[i];
+    bool dominated = false;
+    for (size_t j = 0; j < points.size() && !dominated; j++) {
+      if (j == i || points[j].failed || points[j].frames == 0) continue;
+      const Score& b = scores[j];
+      dominated = b.size <= a.size && b.time <= a.time &&
+                  b.quality >= a.quality &&
+                  (b.size < a.size || b.time < a.time ||
+                   b.quality > a.quality);
+    }
+    if (!dominated) front.emplace_back(i);
+  }
+  std::sort(front.begin(), front.end(), [&scores](size_t a, size_t b) {
+    return scores[a].size < scores[b].size;
+  });
+  return front;
+}
+
+// 前沿写入 <prefix>.json, 前沿配置的测试结果用 nanobench 渲染为 <prefix>.html
+static bool writePareto(const std::string& prefix,
+                        const std::vector<ParetoConfig>& configs,
+                        const std::vector<ParetoPoint>& points) {
+  std::vector<size_t> front = paretoFront(points);
+
+  fmt::println("pareto front ({} of {} configs, metric {})", front.size(),
+               configs.size(), paretoMetric);
+  std::string items;
+  for (size_t k = 0; k < front.size(); k++) {
+    const ParetoPoint& point = points[front[k]];
+    double frames = point.frames;
+    double ratio = 100.0 * (1 - point.dstSize / point.srcSize);
+    fmt::println(
+        "    {:<36} ratio: {:>6.3f}  enc: {:>6.2f} ms  dec: {:>6.2f} ms  "
+        "psnr: {:>6.2f}  ssim: {:.4f}  ms-ssim: {:.4f}",
+        configs[front[k]].name, ratio, point.encTime / frames,
+        point.decTime / frames, point.psnr / frames, point.ssim / frames,
+        point.msSsim / frames);
+    items += fmt::format(
+        R"(        {{
+            "name": "{}",
+            "frames": {},
+            "dstSize": {:.1f},
+            "ratio": {:.3f},
+            "encode": {:.4f},
+            "decode": {:.4f},
+            "psnr": {:.3f},
+            "ssim": {:.5f},
+            "msSsim": {:.5f},
+            "lossless": {}
+        }}{}
+)",
+        configs[front[k]].name, point.frames, point.dstSize / frames, ratio,
+        point.encTime / frames, point.decTime / frames, point.psnr / frames,
+        point.ssim / frames, point.msSsim / frames,
+        point.lossless ? "true" : "false", k + 1 < front.size() ? "," : "");
+  }
   fmt::println("");
+
+  std::string path = prefix + ".json";
+  std::ofstream json(path, std::ofstream::binary);
+  if (!json.is_open()) {
+    fmt::println(stderr, "File can not open: {}", path);
+    return false;
+  }
+  json << fmt::format(
+      "{{\n    \"metric\": \"{}\",\n    \"configs\": {},\n"
+      "    \"pareto\": [\n{}    ]\n}}\n",
+      paretoMetric, configs.size(), items);
+
+  std::vector<ankerl::nanobench::Result> results;
+  for (const auto& result : benchResults) {
+    const std::string& name = result.config().mBenchmarkName;
+    for (size_t i : front) {
+      if (configs[i].name == name &&
+          result.config().mBenchmarkTitle.rfind("pareto", 0) == 0) {
+        results.emplace_back(result);
+        break;
+      }
+    }
+  }
+  path = prefix + ".html";
+  std::ofstream html(path, std::ofstream::binary);
+  if (!html.is_open()) {
+    fmt::println(stderr, "File can not open: {}", path);
+    return false;
+  }
+  ankerl::nanobench::render(kParetoHtmlTemplate, results, html);
+  return true;
+}
+
+// 完整的编码/压缩测试矩阵
+static void test_matrix(ImageInfo& info) {
+  test_lz4(info);
+  test_lz4_sequence(info);
+  test_lz4_hc(info);
+  test_zstd(info);
+  test_zstd_sequence(info);
+  test_jpeg(info);
+  test_jpeg_yuv(info);
+  test_delta(info);
+  test_convert(info);
+}
+
+// 遍历目录中所有 index_width_height.ext 格式的帧, 每帧执行 test
+static int test_corpus(const std::string& dir,
+                       const std::function<void(ImageInfo&)>& test) {
+  struct Frame {
+    int index;
+    int width;
+    int height;
+    std::string name;
+    std::string path;
+  };
+
+  std::vector<Frame> frames;
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+    const std::filesystem::path path = entry.path();
+    if (!std::filesystem::is_regular_file(path)) {
+      continue;
+    }
+    Frame frame;
+    frame.name = path.filename().string();
+    frame.path = path.string();
+    if (!parseFrameName(frame.name, frame.index, frame.width, frame.height)) {
+      fmt::println(stderr, "Invalid file name: {}", frame.name);
+      continue;
+    }
+    frames.emplace_back(frame);
+  }
+  std::sort(frames.begin(), frames.end(),
+            [](const Frame& a, const Frame& b) { return a.index < b.index; });
+  if (frames.empty()) {
+    fmt::println(stderr, "No frames found in: {}", dir);
+    return 1;
+  }
+
+  // 按顺序映射, 当前帧测试时预读下一帧, 不把整个目录读入内存
+  std::vector<std::string> paths;
+  for (const Frame& frame : frames) {
+    paths.emplace_back(frame.path);
+  }
+  image_encode::FrameSource source(std::move(paths));
+  for (size_t i = 0; i < frames.size(); i++) {
+    const Frame& frame = frames[i];
+    if (source.Open(i) != 0) {
+      fmt::println(stderr, "{}", source.error());
+      continue;
+    }
+    int imgSize = source.size();
+    if (imgSize < frame.width * frame.height * 4) {
+      fmt::println(stderr, "Frame too small: {}", frame.name);
+      continue;
+    }
+    if (!reserveBuffers(frame.width, frame.height, imgSize)) {
+      return 1;
+    }
+
+    fmt::println("[{}/{}] {} ({}x{})", i + 1, frames.size(), frame.name,
+                 frame.width, frame.height);
+    benchFrame = frame.name;
+    ImageInfo info(frame.index, frame.width, frame.height, 100, imgSize,
+                   (const char*)source.data(), (const char*)encBuf.data(),
+                   (const char*)cpsBuf.data(), 1, TJFLAG_FASTDCT);
+    test(info);
+  }
+
+  return 0;
 }
 
 static void test_xarray(ImageInfo& info) {
@@ -331,60 +2601,156 @@ static void test_xarray(ImageInfo& info) {
                                   xt::range(cx, xt::placeholders::_)});
   fmt::println("    split time: {}", (getCurrentTime() - time1) / 1000.0);
 }
+REGISTER_TEST(xarray, "xtensor views of the frame");
 
 int main(int argc, char* argv[]) {
-#ifdef _WIN32
-  _chdir(getCurrentDirectory().c_str());
-#else
-  chdir(getCurrentDirectory().c_str());
-#endif
+  cmdline::parser p;
+  p.add<std::string>("corpus", 'c',
+                     "corpus directory, files named index_width_height.ext",
+                     false, "");
+  p.add<std::string>("json", 'j', "write results to json file", false, "");
+  p.add<std::string>("csv", 's', "write results to csv file", false, "");
+  p.add<int>("warmup", 'w', "warmup runs per case", false, benchWarmup,
+             cmdline::range(0, 1000));
+  p.add<int>("epochs", 'e', "epochs per case, 0 for 31 (image) or 5 (corpus)",
+             false, 0, cmdline::range(0, 10000));
+  p.add<std::string>("chain", 'x',
+                     "codec chains separated by ',', e.g. yuv420+zstd:3,jpeg",
+                     false, "");
+  p.add<std::string>("test", 't',
+                     "tests separated by ',', run when no chain is given",
+                     false, "lz4");
+  p.add("list", 'l', "list registered codecs and tests");
+  p.add<std::string>("pareto", 'p',
+                     "sweep codec chains (-x or the default grid), write "
+                     "the pareto front to <prefix>.json and <prefix>.html",
+                     false, "");
+  p.add<std::string>(
+      "metric", 'm', "quality metric of the pareto front", false, "psnr",
+      cmdline::oneof<std::string>("psnr", "ssim", "ms-ssim"));
+  p.footer("[<image> <width> <height>]");
+  p.parse_check(argc, argv);
+
+  if (p.exist("list")) {
+    printCodecs();
+    printTests();
+    return 0;
+  }
+  std::vector<CodecChain> chains;
+  if (!parseChains(p.get<std::string>("chain"), chains)) {
+    return 1;
+  }
+  std::vector<const BenchTest*> tests;
+  if (!parseTests(p.get<std::string>("test"), tests)) {
+    return 1;
+  }
+
+  // 切换工作目录前先转换为绝对路径
+  auto absolute = [](const std::string& path) {
+    return path.empty() ? path : std::filesystem::absolute(path).string();
+  };
+  const std::string corpus = absolute(p.get<std::string>("corpus"));
+  const std::string json = absolute(p.get<std::string>("json"));
+  const std::string csv = absolute(p.get<std::string>("csv"));
+  const std::string pareto = absolute(p.get<std::string>("pareto"));
+  paretoMetric = p.get<std::string>("metric");
+  std::vector<ParetoConfig> configs;
+  if (!pareto.empty()) {
+    configs = paretoConfigs(chains.empty() ? paretoGrid() : chains);
+  }
+  std::vector<ParetoPoint> points(configs.size());
+  const std::vector<std::string>& args = p.rest();
+  benchWarmup = p.get<int>("warmup");
+  benchEpochs = p.get<int>("epochs");
+  if (benchEpochs == 0) {
+    benchEpochs = corpus.empty() ? 31 : 5;
+  }
 
   int width = 1920;
   int height = 1080;
   std::string path = "1920.bgra";
-  if (argc > 1) {
-    path = argv[1];
-    if (argc < 4) {
+  if (!args.empty()) {
+    path = absolute(args[0]);
+    if (args.size() < 3) {
       fmt::println(stderr, "Usage: {} <image> [width] [height]", argv[0]);
       return 1;
     }
-  }
-  if (argc > 2) {
-    width = std::stoi(argv[2]);
-  }
-  if (argc > 3) {
-    height = std::stoi(argv[3]);
+    width = std::stoi(args[1]);
+    height = std::stoi(args[2]);
   }
 
-  // 申请缓存
-  encBuf.resize(width * height * 4);
-  cpsBuf.resize(width * height * 4);
+#ifdef _WIN32
+  _chdir(getCurrentDirectory().c_str());
+#else
+  chdir(getCurrentDirectory().c_str());
+#endif
 
-  // 读取图片内容
-  std::ifstream file(path, std::ifstream::binary);
-  if (!file.is_open()) {
-    std::cerr << "File can not open:" << path << std::endl;
+  if (!codecContexts.valid()) {
+    fmt::println(stderr, "Codec context init failed: {}", tjGetErrorStr());
     return 1;
   }
-  std::stringstream img;
-  img << file.rdbuf();
-  file.close();
-  const std::string image = img.str();
-  int imgSize = image.size();
-  const char* imgData = image.c_str();
-  fmt::println("Input Image size: {}, Width: {}, Height: {}", imgSize, width,
-               height);
 
-  ImageInfo info(0, width, height, 100, imgSize, imgData, encBuf.c_str(),
-                 cpsBuf.c_str(), 1, TJFLAG_FASTDCT);
+  if (!corpus.empty()) {
+    verbose = false;
+    int ret = test_corpus(corpus, [&](ImageInfo& info) {
+      if (!configs.empty()) {
+        test_pareto(info, configs, points);
+      } else if (chains.empty()) {
+        test_matrix(info);
+      } else {
+        test_chains(info, chains);
+      }
+    });
+    if (ret != 0) {
+      return ret;
+    }
+    printSummary();
+  } else {
+    // 只读映射图片内容, 编码器直接读取映射的页
+    image_encode::MappedFile image;
+    if (image.Open(path, image_encode::kMapWillNeed) != 0) {
+      fmt::println(stderr, "{}", image.error());
+      return 1;
+    }
+    if (image.size() < (size_t)width * height * 4) {
+      fmt::println(stderr, "Frame too small: {}", path);
+      return 1;
+    }
+    int imgSize = image.size();
+
+    // 申请缓存
+    if (!reserveBuffers(width, height, imgSize)) {
+      return 1;
+    }
+    const char* imgData = (const char*)image.data();
+    fmt::println("Input Image size: {}, Width: {}, Height: {}", imgSize, width,
+                 height);
 
-  // 测试压缩
-  test_lz4(info);
-  // test_lz4_hc(info);
-  // test_zstd(info);
-  // test_jpeg(info);
-  // test_jpeg_yuv(info);
-  // test_xarray(info);
+    benchFrame = std::filesystem::path(path).filename().string();
+    ImageInfo info(0, width, height, 100, imgSize, imgData,
+                   (const char*)encBuf.data(), (const char*)cpsBuf.data(), 1,
+                   TJFLAG_FASTDCT);
+
+    if (!configs.empty()) {
+      test_pareto(info, configs, points);
+    } else if (!chains.empty()) {
+      test_chains(info, chains);
+    } else {
+      for (const BenchTest* test : tests) {
+        test->func(info);
+      }
+    }
+  }
+
+  if (!pareto.empty() && !writePareto(pareto, configs, points)) {
+    return 1;
+  }
+  if (!json.empty() && !writeResults(json, kJsonTemplate)) {
+    return 1;
+  }
+  if (!csv.empty() && !writeResults(csv, kCsvTemplate)) {
+    return 1;
+  }
 
   return 0;
 }
\ No newline at end of file
@@ -5,7 +5,6 @@
 #include <numeric>
 #include <ostream>
 #include <regex>
-#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
@@ -16,6 +15,8 @@
 #include "lz4.h"
 #include "lz4frame.h"
 #include "lz4hc.h"
+#include "mapped_file.hpp"
+#include "pixel_convert.hpp"
 #include "qoi/qoi.h"
 #include "thread_pool.hpp"
 
@@ -70,18 +71,14 @@ static int64_t getCurrentTime() {
 int main(int argc, char* argv[]) {
   // 读取图片内容
   const std::string path =
-      "/Users/irony/Workspace/QtTest/TestImageEncode/images/raws/3840/0_3840_2160.rgb";
+      "/Users/irony/Workspace/QtTest/TestImageEncode/images/raws/3840/0_3840_2160.bgra";
   //   const std::string
-  //   path="G:/Workspace/TestImageEncode/images/raws/3840/0_3840_2160.rgb";
-  std::ifstream file(path, std::ifstream::binary);
-  if (!file.is_open()) {
-    std::cerr << "File can not open:" << path << std::endl;
+  //   path="G:/Workspace/TestImageEncode/images/raws/3840/0_3840_2160.bgra";
+  image_encode::MappedFile data;
+  if (data.Open(path, image_encode::kMapWillNeed) != 0) {
+    std::cerr << data.error() << std::endl;
     return -1;
   }
-  std::stringstream img;
-  img << file.rdbuf();
-  file.close();
-  const std::string data = img.str();
   int srcSize = data.size();
 
   int64_t start = getCurrentTime();
@@ -92,7 +89,15 @@ int main(int argc, char* argv[]) {
   desc.channels = 3;
   desc.colorspace = QOI_SRGB;
 
-  void* encoded = qoi_encode(data.data(), &desc, &outSize);
+  // 采集的 BGRA 转换为 qoi 需要的 RGB
+  std::vector<unsigned char> rgb((size_t)desc.width * desc.height * 3);
+  image_encode::BgraToRgb(data.data(), desc.width, desc.width * 4,
+                          desc.height, rgb.data());
+  std::cout << "Convert: " << (getCurrentTime() - start) / 1000.0 << "ms ("
+            << image_encode::PixelIsaName(image_encode::BestPixelIsa())
+            << ")" << std::endl;
+
+  void* encoded = qoi_encode(rgb.data(), &desc, &outSize);
 
   int64_t end = getCurrentTime();
   std::cout << "Time: " << (end - start) / 1000.0 << "ms" << std::endl;
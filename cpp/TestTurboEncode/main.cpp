@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <numeric>
 #include <ostream>
 #include <regex>
@@ -11,9 +14,13 @@
 #include <vector>
 
 #include "cmdline.h"
+#include "codec_context.hpp"
+#include "frame_buffer.hpp"
+#include "frame_pipeline.hpp"
 #include "lz4.h"
 #include "lz4frame.h"
 #include "lz4hc.h"
+#include "mapped_file.hpp"
 #include "thread_pool.hpp"
 #include "turbojpeg.h"
 
@@ -29,13 +36,13 @@ struct FileInfo {
   std::string ext;
   std::string input;
   std::string output;
-  std::string data;
+  std::size_t size;  // 文件大小, 内容在编码时才映射
   std::string result;
 
   FileInfo(int index, int width, int height, int quality, int flag,
            const std::string& name, const std::string& ext,
            const std::string& input, const std::string& output,
-           const std::string& data)
+           std::size_t size)
       : index(index),
         width(width),
         height(height),
@@ -47,7 +54,7 @@ struct FileInfo {
         ext(ext),
         input(input),
         output(output),
-        data(data),
+        size(size),
         result("") {}
 
   void print() {
@@ -55,7 +62,7 @@ struct FileInfo {
               << ", Height: " << height << ", Quality: " << quality
               << ", Flag: " << flag << ", Name: " << name
               << ", Input: " << input << ", Output: " << output
-              << ", Size:" << data.size() << std::endl;
+              << ", Size:" << size << std::endl;
   }
 };
 
@@ -65,67 +72,83 @@ static int64_t getCurrentTime() {
       .count();
 }
 
-void encode(tjhandle handle, FileInfo* info) {
-  bool isThread = (handle == nullptr);
-  if (!handle) {
-    handle = tjInitCompress();
+static std::string formatResult(const FileInfo* info, size_t srcSize,
+                                size_t outSize, int cpsSize) {
+  return "encode time: " + std::to_string(info->etime) +
+         "ms\tcompress time: " + std::to_string(info->ctime) +
+         "ms\tencode size: " + std::to_string(outSize / 1024.0) +
+         "kb\tcompress size: " + std::to_string(cpsSize / 1024.0) +
+         "kb\tencode ratio: " + std::to_string(outSize * 1.0 / srcSize * 1.0) +
+         "\tcompress ratio: " + std::to_string(cpsSize * 1.0 / srcSize * 1.0) +
+         "\t" + info->name + "\n";
+}
+
+void encode(image_encode::CodecContextPool* contexts,
+            image_encode::FrameBufferPool* buffers, FileInfo* info) {
+  // 每个线程复用自己的上下文
+  image_encode::CodecContext& context = contexts->Get();
+  tjhandle handle = context.tj();
+
+  // 按最大输出大小申请, 编码结果原地写入, 压缩直接读取同一块缓冲区
+  int subsamp = TJSAMP_420;
+  bool isJpeg = info->ext.find(".jpg") != std::string::npos;
+  image_encode::FrameBuffer outBuf = buffers->Acquire(
+      isJpeg ? image_encode::JpegBufSize(info->width, info->height, subsamp)
+             : image_encode::YuvBufSize(info->width, info->height, subsamp));
+  image_encode::FrameBuffer cpsBuf =
+      buffers->Acquire(image_encode::Lz4Bound(outBuf.capacity()));
+  if (!outBuf.data() || !cpsBuf.data()) {
+    std::cerr << "Out of memory: " << info->name << std::endl;
+    return;
   }
-  if (!handle) {
-    std::cerr << "tjInitCompress failed" << std::endl;
+  // 只读映射输入文件, 编码器直接读取映射的页, 编码结束后解除映射
+  image_encode::MappedFile file;
+  if (file.Open(info->input,
+                image_encode::kMapSequential | image_encode::kMapWillNeed) !=
+      0) {
+    std::cerr << file.error() << std::endl;
     return;
   }
-
-  std::string outBuf;
-  std::string cpsBuf;
-  outBuf.resize(info->width * info->height * 4);
-  cpsBuf.resize(info->width * info->height * 4);
-  int subsamp = TJSAMP_420;
-  int srcSize = info->data.size();
-  unsigned char* srcData = (unsigned char*)info->data.c_str();
-  unsigned char* outData = (unsigned char*)outBuf.c_str();
-  unsigned char* cpsData = (unsigned char*)cpsBuf.c_str();
-  unsigned long outSize = tjBufSizeYUV(info->width, info->height, subsamp);
+  if (file.size() < (size_t)info->width * info->height * 4) {
+    std::cerr << "Frame too small: " << info->name << std::endl;
+    return;
+  }
+  int srcSize = file.size();
+  unsigned char* srcData = (unsigned char*)file.data();
+  unsigned char* outData = outBuf.data();
+  unsigned char* cpsData = cpsBuf.data();
 
   // 编码文件
   int64_t start = getCurrentTime();
   int ret = -1;
 
-  if (info->ext.find(".jpg") != std::string::npos) {
-    ret = tjCompress2(handle, srcData, info->width, 0, info->height, TJPF_BGRA,
-                      &outData, &outSize, subsamp, info->quality, info->flag);
+  if (isJpeg) {
+    ret = context.CompressJpeg(srcData, info->width, 0, info->height,
+                               TJPF_BGRA, subsamp, info->quality, info->flag,
+                               &outBuf);
   } else {
     ret = tjEncodeYUV2(handle, srcData, info->width, 0, info->height, TJPF_BGRA,
                        outData, subsamp, info->flag);
+    outBuf.set_size(
+        image_encode::YuvBufSize(info->width, info->height, subsamp));
   }
   if (ret != 0) {
-    if (isThread && handle) {
-      tjDestroy(handle);
-    }
-    std::cerr << "Compress failed: " << tjGetErrorStr() << std::endl;
+    std::cerr << "Compress failed: " << tjGetErrorStr2(handle) << std::endl;
     return;
   }
   int64_t end = getCurrentTime();
   info->etime = (end - start) / 1000.0;
 
   // 压缩图片
-  int cpsSize = LZ4_compress_default((char*)outData, (char*)cpsData, outSize,
-                                     LZ4_compressBound(outSize));
+  size_t outSize = outBuf.size();
+  int cpsSize = context.CompressLz4((char*)outData, (char*)cpsData, outSize,
+                                    cpsBuf.capacity());
   if (cpsSize <= 0) {
     std::cerr << "LZ4 Compress failed" << std::endl;
   }
   info->ctime = (getCurrentTime() - end) / 1000.0;
 
-  info->result =
-      "encode time: " + std::to_string(info->etime) +
-      "ms\tcompress time: " + std::to_string(info->ctime) +
-      "ms\tencode size: " + std::to_string(outSize / 1024.0) +
-      "kb\tcompress size: " + std::to_string(cpsSize / 1024.0) +
-      "kb\tencode ratio: " + std::to_string(outSize * 1.0 / srcSize * 1.0) +
-      "\tcompress ratio: " + std::to_string(cpsSize * 1.0 / srcSize * 1.0) +
-      "\t" + info->name + "\n";
-  if (isThread && handle) {
-    tjDestroy(handle);
-  }
+  info->result = formatResult(info, srcSize, outSize, cpsSize);
 
   if (info->output.empty()) {
     return;
@@ -140,6 +163,275 @@ void encode(tjhandle handle, FileInfo* info) {
   outFile.close();
 }
 
+// 流水线中的一帧, 各阶段依次填充, 离开流水线时缓冲区归还给池
+struct PipelineFrame {
+  FileInfo* info = nullptr;
+  image_encode::MappedFile file;
+  image_encode::FrameBuffer yuv;
+  image_encode::FrameBuffer out;
+  image_encode::FrameBuffer cps;
+  int cpsSize = 0;
+};
+
+constexpr int kYuvAlign = 4;
+constexpr int kSubsamp = TJSAMP_420;
+
+// 颜色转换和色度下采样, 输出 yuv 后解除输入文件的映射
+static int convertFrame(image_encode::CodecContext& context,
+                        image_encode::FrameBufferPool* buffers,
+                        PipelineFrame* frame) {
+  FileInfo* info = frame->info;
+  int64_t start = getCurrentTime();
+  frame->yuv = buffers->Acquire(image_encode::YuvBufSize(
+      info->width, info->height, kSubsamp, kYuvAlign));
+  if (!frame->yuv.data() ||
+      context.EncodeYuv(frame->file.data(), info->width, 0, info->height,
+                        TJPF_BGRA, kSubsamp, kYuvAlign, &frame->yuv) != 0) {
+    std::cerr << "Convert failed: " << tjGetErrorStr2(context.tj())
+              << std::endl;
+    return -1;
+  }
+  info->etime = (getCurrentTime() - start) / 1000.0;
+  frame->file.Close();
+  return 0;
+}
+
+// 没有单独的转换阶段时直接从 BGRA 编码, 比先转换为 yuv 少一次内存读写
+static int encodeFrame(image_encode::CodecContext& context,
+                       image_encode::FrameBufferPool* buffers,
+                       PipelineFrame* frame) {
+  FileInfo* info = frame->info;
+  if (info->ext.find(".jpg") == std::string::npos) {
+    if (!frame->yuv.data() && convertFrame(context, buffers, frame) != 0) {
+      return -1;
+    }
+    // yuv 输出不需要再编码
+    frame->out = std::move(frame->yuv);
+    return 0;
+  }
+  int64_t start = getCurrentTime();
+  frame->out = buffers->Acquire(
+      image_encode::JpegBufSize(info->width, info->height, kSubsamp));
+  int ret = -1;
+  if (frame->out.data() && frame->yuv.data()) {
+    ret = context.CompressJpegFromYuv(frame->yuv.data(), info->width,
+                                      kYuvAlign, info->height, kSubsamp,
+                                      info->quality, info->flag, &frame->out);
+  } else if (frame->out.data()) {
+    ret = context.CompressJpeg(frame->file.data(), info->width, 0,
+                               info->height, TJPF_BGRA, kSubsamp,
+                               info->quality, info->flag, &frame->out);
+  }
+  if (ret != 0) {
+    std::cerr << "Compress failed: " << tjGetErrorStr2(context.tj())
+              << std::endl;
+    return -1;
+  }
+  info->etime += (getCurrentTime() - start) / 1000.0;
+  frame->yuv = image_encode::FrameBuffer();
+  frame->file.Close();
+  return 0;
+}
+
+// 映射文件并逐页读取一次, 缺页和磁盘读取发生在这一步而不是转换时
+static int64_t loadFrame(PipelineFrame* frame) {
+  FileInfo* info = frame->info;
+  if (frame->file.Open(info->input, image_encode::kMapSequential |
+                                        image_encode::kMapWillNeed) != 0) {
+    std::cerr << frame->file.error() << std::endl;
+    return -1;
+  }
+  size_t size = frame->file.size();
+  if (size < (size_t)info->width * info->height * 4) {
+    std::cerr << "Frame too small: " << info->name << std::endl;
+    return -1;
+  }
+  const unsigned char* data = frame->file.data();
+  volatile unsigned char touch = 0;
+  for (size_t i = 0; i < size; i += 4096) {
+    touch = data[i];
+  }
+  (void)touch;
+  return size;
+}
+
+static int64_t compressFrame(image_encode::CodecContext& context,
+                             image_encode::FrameBufferPool* buffers,
+                             PipelineFrame* frame) {
+  FileInfo* info = frame->info;
+  int64_t start = getCurrentTime();
+  size_t outSize = frame->out.size();
+  frame->cps = buffers->Acquire(image_encode::Lz4Bound(outSize));
+  frame->cpsSize =
+      frame->cps.data()
+          ? context.CompressLz4((char*)frame->out.data(),
+                                (char*)frame->cps.data(), outSize,
+                                frame->cps.capacity())
+          : 0;
+  if (frame->cpsSize <= 0) {
+    std::cerr << "LZ4 Compress failed" << std::endl;
+  }
+  info->ctime = (getCurrentTime() - start) / 1000.0;
+  return outSize;
+}
+
+static int64_t writeFrame(PipelineFrame* frame) {
+  FileInfo* info = frame->info;
+  size_t outSize = frame->out.size();
+  info->result = formatResult(info, info->size, outSize, frame->cpsSize);
+  if (info->output.empty()) {
+    return outSize;
+  }
+  std::ofstream outFile(info->output, std::ofstream::binary);
+  if (!outFile.is_open()) {
+    std::cerr << "File can not open:" << info->output << std::endl;
+    return -1;
+  }
+  outFile.write((char*)frame->out.data(), outSize);
+  return outSize;
+}
+
+// 读取、颜色转换、编码、压缩、写入各自使用一组线程, 阶段之间由有界队列连接,
+// 写文件阻塞时不占用编码线程. threads 为各阶段的线程数,
+// 转换阶段为 0 时在编码阶段直接从 BGRA 编码
+static int encodePipeline(const std::vector<FileInfo*>& files,
+                          const std::vector<unsigned int>& threads,
+                          unsigned int depth,
+                          image_encode::FrameBufferPool* buffers) {
+  // 每个阶段的每个线程独占一个上下文
+  std::vector<std::vector<std::unique_ptr<image_encode::CodecContext>>>
+      contexts(threads.size());
+  for (size_t k = 0; k < threads.size(); k++) {
+    for (unsigned int w = 0; w < threads[k]; w++) {
+      contexts[k].emplace_back(new image_encode::CodecContext());
+      if (!contexts[k].back()->valid()) {
+        std::cerr << "Codec context init failed" << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  image_encode::FramePipeline<PipelineFrame> pipeline(depth);
+  pipeline.AddStage("load", threads[0],
+                    [](PipelineFrame* frame, size_t) -> int64_t {
+    return loadFrame(frame);
+  });
+  if (threads[1] > 0) {
+    pipeline.AddStage("convert", threads[1],
+                      [&](PipelineFrame* frame, size_t worker) -> int64_t {
+      int64_t bytes = frame->file.size();
+      return convertFrame(*contexts[1][worker], buffers, frame) == 0 ? bytes
+                                                                      : -1;
+    });
+  }
+  pipeline.AddStage("encode", threads[2],
+                    [&](PipelineFrame* frame, size_t worker) -> int64_t {
+    int64_t bytes = frame->yuv.data() ? frame->yuv.size() : frame->file.size();
+    return encodeFrame(*contexts[2][worker], buffers, frame) == 0 ? bytes : -1;
+  });
+  pipeline.AddStage("compress", threads[3],
+                    [&](PipelineFrame* frame, size_t worker) -> int64_t {
+    return compressFrame(*contexts[3][worker], buffers, frame);
+  });
+  pipeline.AddStage("write", threads[4],
+                    [](PipelineFrame* frame, size_t) -> int64_t {
+    return writeFrame(frame);
+  });
+
+  size_t next = 0;
+  int ret = pipeline.Run([&](PipelineFrame* frame) {
+    if (next == files.size()) {
+      return false;
+    }
+    frame->info = files[next++];
+    return true;
+  });
+
+  // 利用率为阶段函数的执行时间占该阶段线程总时间的比例,
+  // wait 为等待上游的时间, block 为下游队列满被阻塞的时间
+  double elapsed = pipeline.elapsed_ms();
+  std::streamsize precision = std::cout.precision();
+  std::cout << std::fixed << std::setprecision(2);
+  for (const image_encode::StageStats& stats : pipeline.stats()) {
+    std::cout << "Stage " << std::left << std::setw(8) << stats.name
+              << std::right << " threads: " << stats.threads
+              << "\tframes: " << stats.frames
+              << "\tfps: " << stats.frames * 1000.0 / elapsed
+              << "\tMB/s: " << stats.bytes / 1024.0 / 1024.0 * 1000.0 / elapsed
+              << "\tbusy: " << stats.busy_ms * 100.0 / stats.threads / elapsed
+              << "%\twait: " << stats.wait_ms / stats.threads
+              << "ms\tblock: " << stats.block_ms / stats.threads << "ms"
+              << std::endl;
+  }
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout.precision(precision);
+  return ret == 0 ? 0 : 1;
+}
+
+// 每帧的读取、编码、压缩、写入是任务图中的一条链, 节点在前驱完成后才调度,
+// 工作线程不会阻塞等待. 读取和写入各自按帧的顺序执行, 第 k 帧在第 k - depth
+// 帧写完后才读取, 同时处理的帧不超过 depth, 后一帧的读取和编码与前一帧重叠
+static int encodeGraph(const std::vector<FileInfo*>& files,
+                       unsigned int threads, unsigned int depth,
+                       image_encode::FrameBufferPool* buffers) {
+  thread_pool::ThreadPool pool(threads);
+  image_encode::CodecContextPool contexts(pool);
+  if (!contexts.valid()) {
+    std::cerr << "Codec context init failed" << std::endl;
+    return 1;
+  }
+
+  // 同一帧的节点依次执行, 失败标记不需要同步
+  std::vector<PipelineFrame> frames(files.size());
+  std::vector<char> failed(files.size(), 0);
+  std::vector<size_t> loads;
+  std::vector<size_t> writes;
+  thread_pool::TaskGraph graph(&pool);
+  for (size_t k = 0; k < files.size(); k++) {
+    PipelineFrame* frame = &frames[k];
+    char* fail = &failed[k];
+    frame->info = files[k];
+    size_t load = graph.Emplace([frame, fail] {
+      *fail = loadFrame(frame) < 0;
+    });
+    size_t encode = graph.Emplace([&contexts, buffers, frame, fail] {
+      *fail = *fail || encodeFrame(contexts.Get(), buffers, frame) != 0;
+    });
+    size_t compress = graph.Emplace([&contexts, buffers, frame, fail] {
+      *fail = *fail || compressFrame(contexts.Get(), buffers, frame) < 0;
+    });
+    size_t write = graph.Emplace([frame, fail] {
+      *fail = *fail || writeFrame(frame) < 0;
+      // 尽早释放帧持有的缓冲区和映射
+      FileInfo* info = frame->info;
+      *frame = PipelineFrame();
+      frame->info = info;
+    });
+    graph.Precede(load, encode);
+    graph.Precede(encode, compress);
+    graph.Precede(compress, write);
+    if (k > 0) {
+      graph.Precede(loads.back(), load);
+      graph.Precede(writes.back(), write);
+    }
+    if (k >= depth) {
+      graph.Precede(writes[k - depth], load);
+    }
+    loads.push_back(load);
+    writes.push_back(write);
+  }
+  if (!graph.Run()) {
+    std::cerr << "Frame graph has a cycle" << std::endl;
+    return 1;
+  }
+
+  size_t failures = std::count(failed.begin(), failed.end(), 1);
+  if (failures > 0) {
+    std::cerr << failures << " frames failed" << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
+
 int main(int argc, char* argv[]) {
   cmdline::parser p;
   p.add<unsigned int>(
@@ -156,6 +448,18 @@ int main(int argc, char* argv[]) {
                      cmdline::oneof(std::string(".jpg"), std::string(".yuv")));
   p.add<std::string>("input", 'i', "input directory", true, "");
   p.add<std::string>("output", 'o', "output directory", false, "");
+  p.add<std::string>(
+      "mode", 'm', "one task per file, staged pipeline or task graph", false,
+      "pipeline", cmdline::oneof<std::string>("task", "pipeline", "graph"));
+  p.add<std::string>(
+      "stages", 's',
+      "pipeline threads of load,convert,encode,compress,write, "
+      "default 1,<threads>/4,<threads>,1,1, convert 0 encodes from bgra",
+      false, "");
+  p.add<unsigned int>("depth", 'd',
+                      "pipeline queue depth per stage, frames in flight "
+                      "in graph mode",
+                      false, 4, cmdline::range(1, 256));
   p.parse_check(argc, argv);
 
   const unsigned int threads = p.get<unsigned int>("threads");
@@ -164,8 +468,32 @@ int main(int argc, char* argv[]) {
   const std::string ext = p.get<std::string>("ext");
   const std::string input = p.get<std::string>("input");
   const std::string output = p.get<std::string>("output");
+  const std::string mode = p.get<std::string>("mode");
+  const unsigned int depth = p.get<unsigned int>("depth");
+
+  // yuv 转换约占 jpeg 编码时间的四分之一, 线程少时不单独转换
+  std::vector<unsigned int> stages = {1, threads / 4, threads, 1, 1};
+  if (!p.get<std::string>("stages").empty()) {
+    std::stringstream stream(p.get<std::string>("stages"));
+    std::string item;
+    stages.clear();
+    while (std::getline(stream, item, ',')) {
+      stages.push_back(std::max(std::atoi(item.c_str()), 0));
+    }
+    if (stages.size() != 5) {
+      std::cerr << "Stages must have 5 thread counts" << std::endl;
+      return 1;
+    }
+    // 只有转换阶段可以省略
+    for (size_t k = 0; k < stages.size(); k++) {
+      if (k != 1) {
+        stages[k] = std::max(stages[k], 1u);
+      }
+    }
+  }
 
   std::cout << "Threads: " << threads << std::endl;
+  std::cout << "Mode: " << mode << std::endl;
   std::cout << "Quality: " << quality << std::endl;
   std::cout << "Flag: " << flag << std::endl;
   std::cout << "Extension: " << ext << std::endl;
@@ -182,13 +510,7 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  tjhandle handle = tjInitCompress();
-  if (!handle) {
-    std::cerr << "tjInitCompress failed" << std::endl;
-    return 1;
-  }
-
-  // 读取所有文件存入数组
+  // 只记录文件信息, 内容在编码时按需映射, 不把整个目录读入内存
   std::vector<FileInfo*> files;
   for (const auto& entry : std::filesystem::directory_iterator(input)) {
     const std::filesystem::path path = entry.path();
@@ -203,43 +525,47 @@ int main(int argc, char* argv[]) {
         std::cerr << "Invalid file name: " << name << std::endl;
         continue;
       }
-      // 读取图片内容
-      std::ifstream file(path.string(), std::ifstream::binary);
-      if (!file.is_open()) {
-        std::cerr << "File can not open:" << path.string() << std::endl;
-        continue;
-      }
-      std::stringstream img;
-      img << file.rdbuf();
-      file.close();
-
       FileInfo* info = new FileInfo(
           std::stoi(names[0]), std::stoi(names[1]), std::stoi(names[2]),
           quality, flag, path.filename().string(), ext, path.string(),
           (output.empty() ? "" : output + "/" + path.filename().string() + ext),
-          img.str());
+          std::filesystem::file_size(path));
       info->print();
       files.emplace_back(info);
     }
   }
 
-  thread_pool::ThreadPool pool(threads);
-  std::vector<std::future<void>> results;
-
-  // 遍历目录进行编码和输出
-  for (FileInfo* info : files) {
+  image_encode::FrameBufferPool buffers;
+  int64_t start = getCurrentTime();
+  if (mode == "pipeline") {
+    if (encodePipeline(files, stages, depth, &buffers) != 0) {
+      std::cerr << "Pipeline failed" << std::endl;
+    }
+  } else if (mode == "graph") {
+    if (encodeGraph(files, threads, depth, &buffers) != 0) {
+      std::cerr << "Graph failed" << std::endl;
+    }
+  } else {
+    thread_pool::ThreadPool pool(threads);
+    image_encode::CodecContextPool contexts(pool);
+    if (!contexts.valid()) {
+      std::cerr << "Codec context init failed" << std::endl;
+      return 1;
+    }
+    // 遍历目录进行编码和输出, 调用线程也参与, 全部完成后返回
+    auto encodeFiles = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        encode(&contexts, &buffers, files[i]);
+      }
+    };
     if (threads == 1) {
-      encode(handle, info);
+      encodeFiles(0, files.size());
     } else {
-      results.emplace_back(pool.Submit(encode, nullptr, info));
+      pool.ParallelFor(0, files.size(), 1, encodeFiles);
     }
+    std::cout << "Waiting for all threads to finish" << std::endl;
   }
-
-  // 等待所有线程结束
-  for (auto& result : results) {
-    result.wait();
-  }
-  std::cout << "Waiting for all threads to finish" << std::endl;
+  double wall = (getCurrentTime() - start) / 1000.0;
 
   // 输出结果
   for (const FileInfo* info : files) {
@@ -265,9 +591,10 @@ int main(int argc, char* argv[]) {
   std::cout << "Average encode time: " << ev << "ms" << std::endl;
   std::cout << "Average decode time: " << cv << "ms" << std::endl;
   std::cout << "Average total time: " << tv << "ms" << std::endl;
+  std::cout << "Wall time: " << wall << "ms, "
+            << files.size() * 1000.0 / wall << " fps" << std::endl;
 
   // 释放资源
-  tjDestroy(handle);
   for (FileInfo* info : files) {
     delete info;
   }
@@ -0,0 +1,245 @@
+// 分块压缩容器: 按固定大小切块, 在线程池上并行压缩/解压, 块之间互不依赖
+//
+// 输出格式 (小端): ChunkedHeader, 偏移索引 uint64_t[chunks + 1], 各块数据.
+// 第 i 块的数据位于 [offsets[i], offsets[i + 1]), 相对于数据区开始,
+// 解压后位于原始数据的 i * chunk_size, 可以只取出其中一块单独解压.
+
+#ifndef IMAGE_ENCODE_CHUNKED_CODEC_HPP_
+#define IMAGE_ENCODE_CHUNKED_CODEC_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "codec_context.hpp"
+#include "frame_buffer.hpp"
+#include "lz4.h"
+#include "thread_pool.hpp"
+#include "zstd.h"
+
+namespace image_encode {
+
+enum class ChunkCodec : uint32_t { kLz4 = 0, kLz4Hc = 1, kZstd = 2 };
+
+constexpr uint32_t kChunkedMagic = 0x4B4E4843;  // "CHNK"
+
+struct ChunkedHeader {
+  uint32_t magic;
+  uint32_t codec;
+  uint32_t chunk_size;
+  uint32_t chunks;
+  uint64_t size;  // 原始数据大小
+};
+
+// 解析后的索引, 指向输入数据, 不拷贝
+struct ChunkedIndex {
+  ChunkCodec codec;
+  std::size_t chunk_size;
+  std::size_t chunks;
+  std::size_t size;
+  const unsigned char* data;  // 数据区开始
+  std::vector<uint64_t> offsets;
+
+  std::size_t raw_size(std::size_t i) const {
+    return std::min(chunk_size, size - i * chunk_size);
+  }
+};
+
+inline std::size_t ChunkBound(ChunkCodec codec, std::size_t size) {
+  return codec == ChunkCodec::kZstd ? ZstdBound(size) : Lz4Bound(size);
+}
+
+inline std::size_t ChunkedBound(ChunkCodec codec, std::size_t size,
+                                std::size_t chunk_size) {
+  std::size_t chunks = (size + chunk_size - 1) / chunk_size;
+  return sizeof(ChunkedHeader) + (chunks + 1) * sizeof(uint64_t) +
+         chunks * ChunkBound(codec, chunk_size);
+}
+
+// 成功返回 0
+inline int ParseChunked(const unsigned char* src, std::size_t size,
+                        ChunkedIndex* index) {
+  ChunkedHeader header;
+  if (size < sizeof(header)) {
+    return -1;
+  }
+  std::memcpy(&header, src, sizeof(header));
+  if (header.magic != kChunkedMagic || header.chunk_size == 0 ||
+      header.codec > static_cast<uint32_t>(ChunkCodec::kZstd)) {
+    return -1;
+  }
+  std::size_t chunks = header.chunks;
+  std::size_t begin = sizeof(header) + (chunks + 1) * sizeof(uint64_t);
+  if (chunks != (header.size + header.chunk_size - 1) / header.chunk_size ||
+      size < begin) {
+    return -1;
+  }
+  index->codec = static_cast<ChunkCodec>(header.codec);
+  index->chunk_size = header.chunk_size;
+  index->chunks = chunks;
+  index->size = header.size;
+  index->data = src + begin;
+  index->offsets.resize(chunks + 1);
+  std::memcpy(index->offsets.data(), src + sizeof(header),
+              (chunks + 1) * sizeof(uint64_t));
+  for (std::size_t i = 0; i < chunks; i++) {
+    if (index->offsets[i] > index->offsets[i + 1]) {
+      return -1;
+    }
+  }
+  return index->offsets[chunks] <= size - begin ? 0 : -1;
+}
+
+// 解压第 i 块到 dst, dst 的容量至少为 index.raw_size(i), 成功返回 0
+inline int DecompressChunk(CodecContext* context, const ChunkedIndex& index,
+                           std::size_t i, unsigned char* dst) {
+  const unsigned char* src = index.data + index.offsets[i];
+  std::size_t src_size = index.offsets[i + 1] - index.offsets[i];
+  std::size_t raw_size = index.raw_size(i);
+  if (index.codec == ChunkCodec::kZstd) {
+    std::size_t ret =
+        context->DecompressZstd(dst, raw_size, src, src_size);
+    return !ZSTD_isError(ret) && ret == raw_size ? 0 : -1;
+  }
+  int ret = LZ4_decompress_safe(reinterpret_cast<const char*>(src),
+                                reinterpret_cast<char*>(dst),
+                                static_cast<int>(src_size),
+                                static_cast<int>(raw_size));
+  return ret == static_cast<int>(raw_size) ? 0 : -1;
+}
+
+class ChunkedCodec {
+ public:
+  ChunkedCodec(thread_pool::ThreadPool* pool, CodecContextPool* contexts)
+      : pool_(pool), contexts_(contexts) {}
+
+  ChunkedCodec(const ChunkedCodec&) = delete;
+  ChunkedCodec& operator=(const ChunkedCodec&) = delete;
+
+  // 每块先写入 out 中按最大大小划分的位置, 全部完成后再向前紧凑排列
+  int Compress(const unsigned char* src, std::size_t size, ChunkCodec codec,
+               int level, std::size_t chunk_size, FrameBuffer* out) {
+    if (chunk_size == 0 || chunk_size > 0xFFFFFFFFu) {
+      error_ = "invalid chunk size";
+      return -1;
+    }
+    std::size_t chunks = (size + chunk_size - 1) / chunk_size;
+    std::size_t slot = ChunkBound(codec, chunk_size);
+    if (!out->Reserve(ChunkedBound(codec, size, chunk_size))) {
+      error_ = "out of memory";
+      return -1;
+    }
+    std::size_t begin = sizeof(ChunkedHeader) + (chunks + 1) * sizeof(uint64_t);
+    unsigned char* data = out->data() + begin;
+    std::vector<std::size_t> lengths(chunks);
+    pool_->ParallelFor(0, chunks, 1, [&](std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; i++) {
+        std::size_t in_size = std::min(chunk_size, size - i * chunk_size);
+        lengths[i] = CompressChunk(&contexts_->Get(), codec, level,
+                                   src + i * chunk_size, in_size,
+                                   data + i * slot, slot);
+      }
+    });
+
+    std::vector<uint64_t> offsets(chunks + 1, 0);
+    bool ok = true;
+    for (std::size_t i = 0; i < chunks; i++) {
+      ok = ok && lengths[i] > 0;
+      offsets[i + 1] = offsets[i] + lengths[i];
+    }
+    if (!ok) {
+      error_ = "chunk compress failed";
+      return -1;
+    }
+    // 目标位置不会超过源位置, 按顺序移动不会覆盖未移动的块
+    for (std::size_t i = 1; i < chunks; i++) {
+      std::memmove(data + offsets[i], data + i * slot,
+                   offsets[i + 1] - offsets[i]);
+    }
+
+    ChunkedHeader header = {kChunkedMagic, static_cast<uint32_t>(codec),
+                            static_cast<uint32_t>(chunk_size),
+                            static_cast<uint32_t>(chunks),
+                            static_cast<uint64_t>(size)};
+    std::memcpy(out->data(), &header, sizeof(header));
+    std::memcpy(out->data() + sizeof(header), offsets.data(),
+                offsets.size() * sizeof(uint64_t));
+    out->set_size(begin + offsets[chunks]);
+    return 0;
+  }
+
+  // 并行解压所有块, out 的容量不足时重新申请
+  int Decompress(const unsigned char* src, std::size_t size,
+                 FrameBuffer* out) {
+    ChunkedIndex index;
+    if (ParseChunked(src, size, &index) != 0) {
+      error_ = "invalid chunked header";
+      return -1;
+    }
+    if (out->capacity() < index.size && !out->Reserve(index.size)) {
+      error_ = "out of memory";
+      return -1;
+    }
+    std::atomic<bool> ok(true);
+    unsigned char* dst = out->data();
+    auto decompress = [&](std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; i++) {
+        if (DecompressChunk(&contexts_->Get(), index, i,
+                            dst + i * index.chunk_size) != 0) {
+          ok = false;
+        }
+      }
+    };
+    pool_->ParallelFor(0, index.chunks, 1, decompress);
+    if (!ok) {
+      error_ = "chunk decompress failed";
+      return -1;
+    }
+    out->set_size(index.size);
+    return 0;
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+ private:
+  // 返回压缩后大小, 失败返回 0
+  static std::size_t CompressChunk(CodecContext* context, ChunkCodec codec,
+                                   int level, const unsigned char* src,
+                                   std::size_t size, unsigned char* dst,
+                                   std::size_t capacity) {
+    const char* in = reinterpret_cast<const char*>(src);
+    char* out = reinterpret_cast<char*>(dst);
+    int length = static_cast<int>(size);
+    int cap = static_cast<int>(capacity);
+    switch (codec) {
+      case ChunkCodec::kLz4: {
+        int ret = context->CompressLz4(in, out, length, cap, level);
+        return ret > 0 ? ret : 0;
+      }
+      case ChunkCodec::kLz4Hc: {
+        int ret = context->CompressLz4Hc(in, out, length, cap, level);
+        return ret > 0 ? ret : 0;
+      }
+      case ChunkCodec::kZstd: {
+        std::size_t ret =
+            context->CompressZstd(dst, capacity, src, size, level);
+        return ZSTD_isError(ret) ? 0 : ret;
+      }
+    }
+    return 0;
+  }
+
+  thread_pool::ThreadPool* pool_;
+  CodecContextPool* contexts_;
+  std::string error_;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_CHUNKED_CODEC_HPP_
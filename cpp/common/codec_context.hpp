@@ -0,0 +1,256 @@
+// 每个工作线程独占的编解码上下文, 避免每帧创建和销毁 turbojpeg/zstd/lz4 状态
+
+#ifndef IMAGE_ENCODE_CODEC_CONTEXT_HPP_
+#define IMAGE_ENCODE_CODEC_CONTEXT_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <thread>  // NOLINT
+#include <unordered_map>
+#include <vector>
+
+#include "frame_buffer.hpp"
+#define LZ4_STATIC_LINKING_ONLY
+#include "lz4.h"
+#define LZ4_HC_STATIC_LINKING_ONLY
+#include "lz4hc.h"
+#include "thread_pool.hpp"
+#include "turbojpeg.h"
+#include "zstd.h"
+
+namespace image_encode {
+
+class CodecContext {
+ public:
+  CodecContext()
+      : tj_(tjInitCompress()),
+        tjd_(tjInitDecompress()),
+        zstd_cctx_(ZSTD_createCCtx()),
+        zstd_dctx_(ZSTD_createDCtx()),
+        lz4_(LZ4_createStream()),
+        lz4hc_(LZ4_createStreamHC()) {}
+
+  CodecContext(const CodecContext&) = delete;
+  CodecContext& operator=(const CodecContext&) = delete;
+
+  ~CodecContext() {
+    if (tj_) {
+      tjDestroy(tj_);
+    }
+    if (tjd_) {
+      tjDestroy(tjd_);
+    }
+    ZSTD_freeCCtx(zstd_cctx_);
+    ZSTD_freeDCtx(zstd_dctx_);
+    LZ4_freeStream(lz4_);
+    LZ4_freeStreamHC(lz4hc_);
+  }
+
+  bool valid() const {
+    return tj_ && tjd_ && zstd_cctx_ && zstd_dctx_ && lz4_ && lz4hc_;
+  }
+
+  tjhandle tj() const {
+    return tj_;
+  }
+
+  tjhandle tjd() const {
+    return tjd_;
+  }
+
+  ZSTD_CCtx* zstd_cctx() const {
+    return zstd_cctx_;
+  }
+
+  ZSTD_DCtx* zstd_dctx() const {
+    return zstd_dctx_;
+  }
+
+  LZ4_stream_t* lz4() const {
+    return lz4_;
+  }
+
+  // 复用哈希表状态, 只做快速重置
+  int CompressLz4(const char* src, char* dst, int src_size, int dst_capacity,
+                  int acceleration = 1) {
+    return LZ4_compress_fast_extState_fastReset(lz4_, src, dst, src_size,
+                                                dst_capacity, acceleration);
+  }
+
+  // hc 状态约 256KB, 每次调用都申请的开销比压缩小块数据还大
+  int CompressLz4Hc(const char* src, char* dst, int src_size,
+                    int dst_capacity, int level) {
+    return LZ4_compress_HC_extStateHC_fastReset(lz4hc_, src, dst, src_size,
+                                                dst_capacity, level);
+  }
+
+  // 直接写入预分配的 out, 设置 TJPARAM_NOREALLOC 禁止 turbojpeg 重新分配,
+  // out 的容量至少为 JpegBufSize(width, height, subsamp)
+  int CompressJpeg(const unsigned char* src, int width, int pitch, int height,
+                   int pixel_format, int subsamp, int quality, int flags,
+                   FrameBuffer* out) {
+    size_t dst_size = 0;
+    int ret = CompressJpeg(src, width, pitch, height, pixel_format, subsamp,
+                           quality, flags, out->data(), out->capacity(),
+                           &dst_size);
+    out->set_size(ret == 0 ? dst_size : 0);
+    return ret;
+  }
+
+  int CompressJpeg(const unsigned char* src, int width, int pitch, int height,
+                   int pixel_format, int subsamp, int quality, int flags,
+                   unsigned char* dst, size_t dst_capacity, size_t* dst_size) {
+    *dst_size = dst_capacity;
+    SetJpegParams(subsamp, quality, flags);
+    return tj3Compress8(tj_, src, width, pitch, height, pixel_format, &dst,
+                        dst_size);
+  }
+
+  // 只做颜色转换和色度下采样, 输出平面 yuv, 每行按 align 字节对齐,
+  // out 的容量至少为 YuvBufSize(width, height, subsamp, align)
+  int EncodeYuv(const unsigned char* src, int width, int pitch, int height,
+                int pixel_format, int subsamp, int align, FrameBuffer* out) {
+    tj3Set(tj_, TJPARAM_SUBSAMP, subsamp);
+    int ret = tj3EncodeYUV8(tj_, src, width, pitch, height, pixel_format,
+                            out->data(), align);
+    out->set_size(ret == 0 ? YuvBufSize(width, height, subsamp, align) : 0);
+    return ret;
+  }
+
+  // 从 EncodeYuv() 的输出压缩, 跳过颜色转换, 同一份 yuv 可以压缩成多个质量,
+  // out 的容量至少为 JpegBufSize(width, height, subsamp)
+  int CompressJpegFromYuv(const unsigned char* yuv, int width, int align,
+                          int height, int subsamp, int quality, int flags,
+                          FrameBuffer* out) {
+    unsigned char* dst = out->data();
+    size_t dst_size = out->capacity();
+    SetJpegParams(subsamp, quality, flags);
+    int ret = tj3CompressFromYUV8(tj_, yuv, width, align, height, &dst,
+                                  &dst_size);
+    out->set_size(ret == 0 ? dst_size : 0);
+    return ret;
+  }
+
+  // 解压到调用方的缓冲区, dst 至少为 pitch * 图像高度, pitch 为 0 时紧密排列,
+  // flags 支持 TJFLAG_FASTUPSAMPLE / TJFLAG_FASTDCT / TJFLAG_STOPONWARNING
+  int DecompressJpeg(const unsigned char* src, size_t size, unsigned char* dst,
+                     int pitch, int pixel_format, int flags) {
+    SetDecodeParams(flags);
+    if (tj3DecompressHeader(tjd_, src, size) != 0) {
+      return -1;
+    }
+    return tj3Decompress8(tjd_, src, size, dst, pitch, pixel_format);
+  }
+
+  // EncodeYuv() 的逆过程, 色度上采样和颜色转换
+  int DecodeYuv(const unsigned char* yuv, int align, int subsamp,
+                unsigned char* dst, int width, int pitch, int height,
+                int pixel_format, int flags) {
+    SetDecodeParams(flags);
+    tj3Set(tjd_, TJPARAM_SUBSAMP, subsamp);
+    return tj3DecodeYUV8(tjd_, yuv, align, dst, width, pitch, height,
+                         pixel_format);
+  }
+
+  size_t CompressZstd(void* dst, size_t dst_capacity, const void* src,
+                      size_t src_size, int level) {
+    return ZSTD_compressCCtx(zstd_cctx_, dst, dst_capacity, src, src_size,
+                             level);
+  }
+
+  // workers 为 0 时在当前线程压缩, 否则由 zstd 内部线程按 job_size 分段并行,
+  // job_size 为 0 时由 zstd 按窗口大小决定 (单帧可能只有一段)
+  size_t CompressZstdParallel(void* dst, size_t dst_capacity, const void* src,
+                              size_t src_size, int level, int workers,
+                              size_t job_size = 0) {
+    ZSTD_CCtx_reset(zstd_cctx_, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(zstd_cctx_, ZSTD_c_compressionLevel, level);
+    size_t ret = ZSTD_CCtx_setParameter(zstd_cctx_, ZSTD_c_nbWorkers, workers);
+    if (ZSTD_isError(ret)) {
+      return ret;
+    }
+    if (workers > 0) {
+      ZSTD_CCtx_setParameter(zstd_cctx_, ZSTD_c_jobSize,
+                             static_cast<int>(job_size));
+    }
+    return ZSTD_compress2(zstd_cctx_, dst, dst_capacity, src, src_size);
+  }
+
+  size_t DecompressZstd(void* dst, size_t dst_capacity, const void* src,
+                        size_t src_size) {
+    return ZSTD_decompressDCtx(zstd_dctx_, dst, dst_capacity, src, src_size);
+  }
+
+ private:
+  void SetJpegParams(int subsamp, int quality, int flags) {
+    tj3Set(tj_, TJPARAM_NOREALLOC, 1);
+    tj3Set(tj_, TJPARAM_QUALITY, quality);
+    tj3Set(tj_, TJPARAM_SUBSAMP, subsamp);
+    tj3Set(tj_, TJPARAM_FASTDCT, (flags & TJFLAG_FASTDCT) ? 1 : 0);
+    tj3Set(tj_, TJPARAM_PROGRESSIVE, (flags & TJFLAG_PROGRESSIVE) ? 1 : 0);
+    tj3Set(tj_, TJPARAM_STOPONWARNING, (flags & TJFLAG_STOPONWARNING) ? 1 : 0);
+  }
+
+  void SetDecodeParams(int flags) {
+    tj3Set(tjd_, TJPARAM_FASTUPSAMPLE, (flags & TJFLAG_FASTUPSAMPLE) ? 1 : 0);
+    tj3Set(tjd_, TJPARAM_FASTDCT, (flags & TJFLAG_FASTDCT) ? 1 : 0);
+    tj3Set(tjd_, TJPARAM_STOPONWARNING,
+           (flags & TJFLAG_STOPONWARNING) ? 1 : 0);
+  }
+
+  tjhandle tj_;
+  tjhandle tjd_;  // 解压和 yuv 解码
+  ZSTD_CCtx* zstd_cctx_;
+  ZSTD_DCtx* zstd_dctx_;
+  LZ4_stream_t* lz4_;
+  LZ4_streamHC_t* lz4hc_;
+};
+
+// 按线程池的 thread_map() 为每个工作线程分配一个上下文,
+// 不属于线程池的调用线程共用最后一个上下文, 同一时刻只能有一个这样的线程
+class CodecContextPool {
+ public:
+  CodecContextPool() : contexts_(1) {
+    contexts_[0].reset(new CodecContext());
+  }
+
+  explicit CodecContextPool(const thread_pool::ThreadPool& pool)
+      : thread_map_(pool.thread_map()), contexts_(pool.num_threads() + 1) {
+    for (auto& it : contexts_) {
+      it.reset(new CodecContext());
+    }
+  }
+
+  CodecContextPool(const CodecContextPool&) = delete;
+  CodecContextPool& operator=(const CodecContextPool&) = delete;
+
+  std::size_t size() const {
+    return contexts_.size();
+  }
+
+  bool valid() const {
+    for (const auto& it : contexts_) {
+      if (!it->valid()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // 当前线程的上下文
+  CodecContext& Get() {
+    auto it = thread_map_.find(std::this_thread::get_id());
+    if (it == thread_map_.end()) {
+      return *contexts_.back();
+    }
+    return *contexts_[it->second];
+  }
+
+ private:
+  std::unordered_map<std::thread::id, std::size_t> thread_map_;
+  std::vector<std::unique_ptr<CodecContext>> contexts_;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_CODEC_CONTEXT_HPP_
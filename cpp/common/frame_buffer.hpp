@@ -0,0 +1,291 @@
+// 64 字节对齐、不做零初始化的帧缓冲区和可复用的缓冲区池,
+// 以及编码/压缩输出的最大大小
+
+#ifndef IMAGE_ENCODE_FRAME_BUFFER_HPP_
+#define IMAGE_ENCODE_FRAME_BUFFER_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>  // NOLINT
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lz4.h"
+#include "turbojpeg.h"
+#include "zstd.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace image_encode {
+
+constexpr std::size_t kFrameAlignment = 64;
+
+inline void* AlignedAlloc(std::size_t size,
+                          std::size_t alignment = kFrameAlignment) {
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, alignment, size) != 0) {
+    return nullptr;
+  }
+  return ptr;
+#endif
+}
+
+inline void AlignedFree(void* ptr) {
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+// tjCompress2/tj3Compress8 输出的最大大小
+inline std::size_t JpegBufSize(int width, int height, int subsamp) {
+  return tj3JPEGBufSize(width, height, subsamp);
+}
+
+// tjEncodeYUV2 按 4 字节对齐每行
+inline std::size_t YuvBufSize(int width, int height, int subsamp,
+                              int align = 4) {
+  return tj3YUVBufSize(width, align, height, subsamp);
+}
+
+inline std::size_t Lz4Bound(std::size_t size) {
+  return LZ4_compressBound(static_cast<int>(size));
+}
+
+inline std::size_t ZstdBound(std::size_t size) {
+  return ZSTD_compressBound(size);
+}
+
+// 同时满足 lz4 和 zstd 的压缩输出大小
+inline std::size_t CompressBound(std::size_t size) {
+  return std::max(Lz4Bound(size), ZstdBound(size));
+}
+
+class FrameBufferPool;
+
+// 由 FrameBufferPool 申请的缓冲区在析构时归还给池
+class FrameBuffer {
+ public:
+  FrameBuffer() : data_(nullptr), capacity_(0), size_(0), pool_(nullptr) {}
+
+  explicit FrameBuffer(std::size_t capacity, FrameBufferPool* pool = nullptr)
+      : FrameBuffer() {
+    pool_ = pool;
+    Reserve(capacity);
+  }
+
+  FrameBuffer(const FrameBuffer&) = delete;
+  FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+  FrameBuffer(FrameBuffer&& other) noexcept
+      : data_(other.data_),
+        capacity_(other.capacity_),
+        size_(other.size_),
+        pool_(other.pool_) {
+    other.data_ = nullptr;
+    other.capacity_ = 0;
+    other.size_ = 0;
+  }
+
+  FrameBuffer& operator=(FrameBuffer&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(size_, other.size_);
+    std::swap(pool_, other.pool_);
+    return *this;
+  }
+
+  ~FrameBuffer() {
+    Free();
+  }
+
+  // 容量不足时重新申请, 不保留原有内容
+  bool Reserve(std::size_t capacity);
+
+  unsigned char* data() const {
+    return data_;
+  }
+
+  std::size_t capacity() const {
+    return capacity_;
+  }
+
+  // 有效数据大小
+  std::size_t size() const {
+    return size_;
+  }
+
+  void set_size(std::size_t size) {
+    size_ = std::min(size, capacity_);
+  }
+
+ private:
+  void Free();
+
+  unsigned char* data_;
+  std::size_t capacity_;
+  std::size_t size_;
+  FrameBufferPool* pool_;
+};
+
+constexpr std::size_t kHugePageSize = 2 << 20;
+
+// 按页映射内存, 大于等于 2MB 时优先使用 MAP_HUGETLB,
+// 失败则退回普通映射并按 2MB 对齐以便透明大页生效
+inline void* AllocatePages(std::size_t size) {
+#if defined(__linux__)
+  if (size % kHugePageSize == 0) {
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      return ptr;
+    }
+    size_t mapped = size + kHugePageSize;
+    ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+      return nullptr;
+    }
+    uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    if (aligned > begin) {
+      munmap(ptr, aligned - begin);
+    }
+    if (begin + mapped > aligned + size) {
+      munmap(reinterpret_cast<void*>(aligned + size),
+             begin + mapped - aligned - size);
+    }
+    madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+    return reinterpret_cast<void*>(aligned);
+  }
+  void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+#else
+  return AlignedAlloc(size);
+#endif
+}
+
+inline void FreePages(void* ptr, std::size_t size) {
+#if defined(__linux__)
+  if (ptr) {
+    munmap(ptr, size);
+  }
+#else
+  (void)size;
+  AlignedFree(ptr);
+#endif
+}
+
+// 按大小分级缓存已释放的缓冲区, 同一大小的帧反复申请时不再缺页和清零
+class FrameBufferPool {
+ public:
+  FrameBufferPool() = default;
+
+  FrameBufferPool(const FrameBufferPool&) = delete;
+  FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+  // 池中的缓冲区必须在池析构之前全部归还
+  ~FrameBufferPool() {
+    Trim();
+  }
+
+  FrameBuffer Acquire(std::size_t size) {
+    return FrameBuffer(size, this);
+  }
+
+  // 释放所有缓存的缓冲区
+  void Trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& it : free_lists_) {
+      for (void* ptr : it.second) {
+        FreePages(ptr, it.first);
+      }
+    }
+    free_lists_.clear();
+    cached_bytes_ = 0;
+  }
+
+  std::size_t cached_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+  }
+
+  // 小于 2MB 按 64KB 取整, 否则按 2MB 取整
+  static std::size_t SizeClass(std::size_t size) {
+    std::size_t granularity = size < kHugePageSize ? (64 << 10) : kHugePageSize;
+    return (std::max<std::size_t>(size, 1) + granularity - 1) /
+           granularity * granularity;
+  }
+
+ private:
+  friend class FrameBuffer;
+
+  void* Allocate(std::size_t size_class) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = free_lists_.find(size_class);
+      if (it != free_lists_.end() && !it->second.empty()) {
+        void* ptr = it->second.back();
+        it->second.pop_back();
+        cached_bytes_ -= size_class;
+        return ptr;
+      }
+    }
+    return AllocatePages(size_class);
+  }
+
+  void Release(void* ptr, std::size_t size_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_lists_[size_class].push_back(ptr);
+    cached_bytes_ += size_class;
+  }
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::size_t, std::vector<void*>> free_lists_;
+  std::size_t cached_bytes_ = 0;
+};
+
+inline bool FrameBuffer::Reserve(std::size_t capacity) {
+  if (capacity <= capacity_) {
+    return true;
+  }
+  Free();
+  if (pool_) {
+    std::size_t size_class = FrameBufferPool::SizeClass(capacity);
+    data_ = static_cast<unsigned char*>(pool_->Allocate(size_class));
+    capacity = size_class;
+  } else {
+    data_ = static_cast<unsigned char*>(AlignedAlloc(capacity));
+  }
+  capacity_ = data_ ? capacity : 0;
+  return data_ != nullptr;
+}
+
+inline void FrameBuffer::Free() {
+  if (data_) {
+    if (pool_) {
+      pool_->Release(data_, capacity_);
+    } else {
+      AlignedFree(data_);
+    }
+  }
+  data_ = nullptr;
+  capacity_ = 0;
+  size_ = 0;
+}
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_FRAME_BUFFER_HPP_
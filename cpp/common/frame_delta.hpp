@@ -0,0 +1,381 @@
+// 与上一帧按固定大小的块比较, 只编码发生变化的块, 输出带坐标的块更新列表
+//
+// 块可以用 jpeg, lz4 或 qoi 编码, qoi 的实现由包含方定义 QOI_IMPLEMENTATION
+// 提供, 找不到 qoi.h 时没有 QoiTileEncoder().
+
+#ifndef IMAGE_ENCODE_FRAME_DELTA_HPP_
+#define IMAGE_ENCODE_FRAME_DELTA_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "codec_context.hpp"
+#include "frame_buffer.hpp"
+#include "lz4.h"
+#include "turbojpeg.h"
+#include "xsimd/xsimd.hpp"
+
+#if __has_include("qoi/qoi.h")
+#include "qoi/qoi.h"
+#define IMAGE_ENCODE_HAVE_QOI 1
+#endif
+
+namespace image_encode {
+
+// 两段内存是否相同, 整行异或后再判断, 避免每个向量一次分支
+inline bool RowsEqual(const unsigned char* a, const unsigned char* b,
+                      std::size_t n) {
+  using batch = xsimd::batch<uint8_t>;
+  constexpr std::size_t step = batch::size;
+  batch diff(static_cast<uint8_t>(0));
+  std::size_t i = 0;
+  for (; i + step <= n; i += step) {
+    diff |= batch::load_unaligned(a + i) ^ batch::load_unaligned(b + i);
+  }
+  if (xsimd::any(diff != batch(static_cast<uint8_t>(0)))) {
+    return false;
+  }
+  return std::memcmp(a + i, b + i, n - i) == 0;
+}
+
+struct TileRect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+struct TileUpdate {
+  TileRect rect;
+  std::size_t offset;  // 在 payload 中的偏移
+  std::size_t size;
+};
+
+struct DeltaFrame {
+  std::vector<TileUpdate> tiles;
+  FrameBuffer payload;  // 所有块的编码数据, 按 tiles 的顺序连续存放
+};
+
+// bound 返回一个块编码后的最大大小, encode 把块写入 dst, 成功返回 0.
+// decode 把 encode 的输出解码回 width x height 的块, 按 pitch 写入 dst,
+// 成功返回 0
+struct TileEncoder {
+  std::function<std::size_t(int width, int height)> bound;
+  std::function<int(const unsigned char* src, int width, int pitch,
+                    int height, unsigned char* dst, std::size_t capacity,
+                    std::size_t* size)>
+      encode;
+  std::function<int(const unsigned char* src, std::size_t size, int width,
+                    int pitch, int height, unsigned char* dst)>
+      decode;
+};
+
+inline TileEncoder JpegTileEncoder(CodecContext* context, int quality,
+                                   int subsamp = TJSAMP_420,
+                                   int flags = TJFLAG_FASTDCT,
+                                   int pixel_format = TJPF_BGRA) {
+  TileEncoder encoder;
+  encoder.bound = [subsamp](int width, int height) {
+    return JpegBufSize(width, height, subsamp);
+  };
+  encoder.encode = [=](const unsigned char* src, int width, int pitch,
+                       int height, unsigned char* dst, std::size_t capacity,
+                       std::size_t* size) {
+    return context->CompressJpeg(src, width, pitch, height, pixel_format,
+                                 subsamp, quality, flags, dst, capacity, size);
+  };
+  encoder.decode = [=](const unsigned char* src, std::size_t size, int width,
+                       int pitch, int height, unsigned char* dst) {
+    // 尺寸与块不一致时会写到块之外
+    tjhandle tjd = context->tjd();
+    if (tj3DecompressHeader(tjd, src, size) != 0 ||
+        tj3Get(tjd, TJPARAM_JPEGWIDTH) != width ||
+        tj3Get(tjd, TJPARAM_JPEGHEIGHT) != height) {
+      return -1;
+    }
+    return context->DecompressJpeg(src, size, dst, pitch, pixel_format, 0);
+  };
+  return encoder;
+}
+
+// 把块的各行拷贝到 scratch 中紧密排列, 供需要连续输入的编码使用
+inline bool PackTile(const unsigned char* src, int width, int pitch,
+                     int height, int pixel_size, FrameBuffer* scratch) {
+  std::size_t row = static_cast<std::size_t>(width) * pixel_size;
+  if (!scratch->Reserve(row * height)) {
+    return false;
+  }
+  for (int y = 0; y < height; y++) {
+    std::memcpy(scratch->data() + row * y,
+                src + static_cast<std::size_t>(y) * pitch, row);
+  }
+  scratch->set_size(row * height);
+  return true;
+}
+
+// PackTile() 的逆过程, 把紧密排列的块按 pitch 写入 dst
+inline void UnpackTile(const unsigned char* src, int width, int pitch,
+                       int height, int pixel_size, unsigned char* dst) {
+  std::size_t row = static_cast<std::size_t>(width) * pixel_size;
+  for (int y = 0; y < height; y++) {
+    std::memcpy(dst + static_cast<std::size_t>(y) * pitch, src + row * y, row);
+  }
+}
+
+inline TileEncoder Lz4TileEncoder(CodecContext* context, int acceleration = 1,
+                                  int pixel_size = 4) {
+  auto scratch = std::make_shared<FrameBuffer>();
+  TileEncoder encoder;
+  encoder.bound = [pixel_size](int width, int height) {
+    return Lz4Bound(static_cast<std::size_t>(width) * height * pixel_size);
+  };
+  encoder.encode = [=](const unsigned char* src, int width, int pitch,
+                       int height, unsigned char* dst, std::size_t capacity,
+                       std::size_t* size) {
+    if (!PackTile(src, width, pitch, height, pixel_size, scratch.get())) {
+      return -1;
+    }
+    int ret = context->CompressLz4((const char*)scratch->data(), (char*)dst,
+                                   static_cast<int>(scratch->size()),
+                                   static_cast<int>(capacity), acceleration);
+    *size = ret > 0 ? ret : 0;
+    return ret > 0 ? 0 : -1;
+  };
+  encoder.decode = [=](const unsigned char* src, std::size_t size, int width,
+                       int pitch, int height, unsigned char* dst) {
+    std::size_t length = static_cast<std::size_t>(width) * height * pixel_size;
+    if (!scratch->Reserve(length)) {
+      return -1;
+    }
+    int ret = LZ4_decompress_safe((const char*)src, (char*)scratch->data(),
+                                  static_cast<int>(size),
+                                  static_cast<int>(length));
+    if (ret != static_cast<int>(length)) {
+      return -1;
+    }
+    UnpackTile(scratch->data(), width, pitch, height, pixel_size, dst);
+    return 0;
+  };
+  return encoder;
+}
+
+#ifdef IMAGE_ENCODE_HAVE_QOI
+// qoi 把 BGRA 当作 RGBA 无损编码, 解码时原样取回
+inline TileEncoder QoiTileEncoder() {
+  auto scratch = std::make_shared<FrameBuffer>();
+  TileEncoder encoder;
+  encoder.bound = [](int width, int height) {
+    // 每像素最多 5 字节, 加上 14 字节的头和 8 字节的结束标记
+    return static_cast<std::size_t>(width) * height * 5 + 22;
+  };
+  encoder.encode = [=](const unsigned char* src, int width, int pitch,
+                       int height, unsigned char* dst, std::size_t capacity,
+                       std::size_t* size) {
+    if (!PackTile(src, width, pitch, height, 4, scratch.get())) {
+      return -1;
+    }
+    qoi_desc desc = {static_cast<unsigned>(width),
+                     static_cast<unsigned>(height), 4, QOI_SRGB};
+    int length = 0;
+    void* encoded = qoi_encode(scratch->data(), &desc, &length);
+    bool ok = encoded != nullptr &&
+              static_cast<std::size_t>(length) <= capacity;
+    if (ok) {
+      std::memcpy(dst, encoded, length);
+    }
+    free(encoded);
+    *size = ok ? length : 0;
+    return ok ? 0 : -1;
+  };
+  encoder.decode = [](const unsigned char* src, std::size_t size, int width,
+                      int pitch, int height, unsigned char* dst) {
+    qoi_desc desc;
+    void* decoded = qoi_decode(src, static_cast<int>(size), &desc, 4);
+    bool ok = decoded != nullptr &&
+              desc.width == static_cast<unsigned>(width) &&
+              desc.height == static_cast<unsigned>(height);
+    if (ok) {
+      UnpackTile(static_cast<const unsigned char*>(decoded), width, pitch,
+                 height, 4, dst);
+    }
+    free(decoded);
+    return ok ? 0 : -1;
+  };
+  return encoder;
+}
+#endif
+
+class FrameDelta {
+ public:
+  explicit FrameDelta(int tile_size = 64, int pixel_size = 4)
+      : tile_size_(tile_size),
+        pixel_size_(pixel_size),
+        width_(0),
+        height_(0) {}
+
+  FrameDelta(const FrameDelta&) = delete;
+  FrameDelta& operator=(const FrameDelta&) = delete;
+
+  int tile_size() const {
+    return tile_size_;
+  }
+
+  bool has_previous() const {
+    return prev_.size() > 0;
+  }
+
+  // 与上一帧比较, 返回变化的块. 没有上一帧或尺寸变化时所有块都视为变化
+  std::vector<TileRect> Diff(const unsigned char* frame, int width, int pitch,
+                             int height) const {
+    if (pitch == 0) {
+      pitch = width * pixel_size_;
+    }
+    bool full = !has_previous() || width != width_ || height != height_;
+    std::size_t prev_pitch = static_cast<std::size_t>(width_) * pixel_size_;
+    std::vector<TileRect> tiles;
+    for (int y = 0; y < height; y += tile_size_) {
+      int h = std::min(tile_size_, height - y);
+      for (int x = 0; x < width; x += tile_size_) {
+        int w = std::min(tile_size_, width - x);
+        bool dirty = full;
+        std::size_t row = static_cast<std::size_t>(w) * pixel_size_;
+        for (int r = 0; !dirty && r < h; r++) {
+          const unsigned char* cur = frame +
+                                     static_cast<std::size_t>(y + r) * pitch +
+                                     static_cast<std::size_t>(x) * pixel_size_;
+          const unsigned char* old = prev_.data() + (y + r) * prev_pitch +
+                                     static_cast<std::size_t>(x) * pixel_size_;
+          dirty = !RowsEqual(cur, old, row);
+        }
+        if (dirty) {
+          tiles.push_back(TileRect{x, y, w, h});
+        }
+      }
+    }
+    return tiles;
+  }
+
+  // 用 encoder 编码 tiles 中的块, 直接写入 out->payload
+  int Encode(const unsigned char* frame, int width, int pitch,
+             const std::vector<TileRect>& tiles, const TileEncoder& encoder,
+             DeltaFrame* out) const {
+    if (pitch == 0) {
+      pitch = width * pixel_size_;
+    }
+    std::size_t bound = 0;
+    for (const TileRect& tile : tiles) {
+      bound += encoder.bound(tile.width, tile.height);
+    }
+    out->tiles.clear();
+    if (!out->payload.Reserve(std::max<std::size_t>(bound, 1))) {
+      return -1;
+    }
+    std::size_t offset = 0;
+    for (const TileRect& tile : tiles) {
+      const unsigned char* src = frame +
+                                 static_cast<std::size_t>(tile.y) * pitch +
+                                 static_cast<std::size_t>(tile.x) * pixel_size_;
+      std::size_t size = 0;
+      int ret = encoder.encode(src, tile.width, pitch, tile.height,
+                               out->payload.data() + offset,
+                               out->payload.capacity() - offset, &size);
+      if (ret != 0) {
+        return ret;
+      }
+      out->tiles.push_back(TileUpdate{tile, offset, size});
+      offset += size;
+    }
+    out->payload.set_size(offset);
+    return 0;
+  }
+
+  // 用 encoder 把 delta 中的块解码到 frame 的对应位置, frame 应为上一帧的
+  // 副本, 应用后与编码时的帧一致 (有损编码除外). 成功返回 0
+  int Apply(const DeltaFrame& delta, const TileEncoder& encoder,
+            unsigned char* frame, int width, int pitch, int height) const {
+    if (pitch == 0) {
+      pitch = width * pixel_size_;
+    }
+    for (const TileUpdate& tile : delta.tiles) {
+      const TileRect& rect = tile.rect;
+      if (rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0 ||
+          rect.x + rect.width > width || rect.y + rect.height > height ||
+          tile.offset + tile.size > delta.payload.size()) {
+        return -1;
+      }
+      unsigned char* dst = frame + static_cast<std::size_t>(rect.y) * pitch +
+                           static_cast<std::size_t>(rect.x) * pixel_size_;
+      if (encoder.decode(delta.payload.data() + tile.offset, tile.size,
+                         rect.width, pitch, rect.height, dst) != 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  // 把上一帧拷贝到 dst, 没有上一帧或尺寸不同时返回 false
+  bool CopyPrevious(unsigned char* dst, int width, int pitch,
+                    int height) const {
+    if (!has_previous() || width != width_ || height != height_) {
+      return false;
+    }
+    if (pitch == 0) {
+      pitch = width * pixel_size_;
+    }
+    UnpackTile(prev_.data(), width, pitch, height, pixel_size_, dst);
+    return true;
+  }
+
+  // 保存为下一次比较的上一帧, 尺寸不变时只拷贝变化的块
+  bool Commit(const unsigned char* frame, int width, int pitch, int height,
+              const std::vector<TileRect>& tiles) {
+    if (pitch == 0) {
+      pitch = width * pixel_size_;
+    }
+    std::size_t row = static_cast<std::size_t>(width) * pixel_size_;
+    if (!has_previous() || width != width_ || height != height_) {
+      if (!prev_.Reserve(row * height)) {
+        return false;
+      }
+      for (int y = 0; y < height; y++) {
+        std::memcpy(prev_.data() + row * y,
+                    frame + static_cast<std::size_t>(y) * pitch, row);
+      }
+      prev_.set_size(row * height);
+      width_ = width;
+      height_ = height;
+      return true;
+    }
+    for (const TileRect& tile : tiles) {
+      std::size_t offset = static_cast<std::size_t>(tile.x) * pixel_size_;
+      std::size_t length = static_cast<std::size_t>(tile.width) * pixel_size_;
+      for (int y = tile.y; y < tile.y + tile.height; y++) {
+        std::memcpy(prev_.data() + row * y + offset,
+                    frame + static_cast<std::size_t>(y) * pitch + offset,
+                    length);
+      }
+    }
+    return true;
+  }
+
+  void Reset() {
+    prev_.set_size(0);
+  }
+
+ private:
+  int tile_size_;
+  int pixel_size_;
+  int width_;
+  int height_;
+  FrameBuffer prev_;  // 上一帧, 按 width_ * pixel_size_ 紧密排列
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_FRAME_DELTA_HPP_
@@ -0,0 +1,253 @@
+// 分阶段的帧流水线: 每个阶段 (读取, 像素转换, 编码, 压缩, 写入...) 有自己的
+// 专用线程, 相邻阶段之间由有界环形队列连接, 下游满时上游阻塞 (背压).
+// 不同帧在各阶段重叠执行, 一个阶段的 I/O 等待不会占用其他阶段的线程.
+//
+// 阶段内有多个线程时帧的完成顺序不保证与输入顺序相同.
+// 阶段函数会阻塞在队列上, 不能放到 thread_pool::ThreadPool 中执行.
+
+#ifndef IMAGE_ENCODE_FRAME_PIPELINE_HPP_
+#define IMAGE_ENCODE_FRAME_PIPELINE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+namespace image_encode {
+
+// 多生产者多消费者的有界环形队列, 每项是一整帧, 加锁的开销相对可以忽略
+template <class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(std::size_t capacity)
+      : items_(std::max<std::size_t>(capacity, 1)) {}
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // 队列满时阻塞, 已关闭时返回 false
+  bool Push(T&& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return count_ < items_.size() || closed_; });
+    if (closed_) {
+      return false;
+    }
+    items_[(head_ + count_) % items_.size()] = std::move(item);
+    count_++;
+    lock.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // 队列空时阻塞, 已关闭且取完时返回 false
+  bool Pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return count_ > 0 || closed_; });
+    if (count_ == 0) {
+      return false;
+    }
+    *item = std::move(items_[head_]);
+    head_ = (head_ + 1) % items_.size();
+    count_--;
+    lock.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // 之后 Push() 失败, Pop() 取完剩余项后失败
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  std::size_t capacity() const {
+    return items_.size();
+  }
+
+ private:
+  std::vector<T> items_;
+  std::size_t head_ = 0;
+  std::size_t count_ = 0;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+// 时间为该阶段所有线程之和, 除以 threads 和总时间得到利用率
+struct StageStats {
+  std::string name;
+  std::size_t threads = 0;
+  std::size_t frames = 0;    // 成功处理的帧数
+  std::size_t failures = 0;  // 失败后丢弃的帧数
+  uint64_t bytes = 0;        // 阶段函数返回的字节数之和
+  double busy_ms = 0;        // 执行阶段函数
+  double wait_ms = 0;        // 上游队列空, 等待输入
+  double block_ms = 0;       // 下游队列满, 等待输出 (背压)
+};
+
+template <class T>
+class FramePipeline {
+ public:
+  // 处理一帧, 返回处理的字节数, 小于 0 表示失败, 该帧不再进入后续阶段.
+  // worker 为线程在阶段内的序号, 可以用来索引每个线程独占的上下文
+  using Stage = std::function<int64_t(T* frame, std::size_t worker)>;
+  // 填充下一帧, 没有更多帧时返回 false, 在调用 Run() 的线程执行
+  using Source = std::function<bool(T* frame)>;
+
+  // depth 为每个阶段输入队列的容量
+  explicit FramePipeline(std::size_t depth = 4) : depth_(depth) {}
+
+  FramePipeline(const FramePipeline&) = delete;
+  FramePipeline& operator=(const FramePipeline&) = delete;
+
+  void AddStage(const std::string& name, std::size_t threads, Stage stage) {
+    stages_.push_back({std::move(stage), std::max<std::size_t>(threads, 1)});
+    stats_.emplace_back();
+    stats_.back().name = name;
+    stats_.back().threads = stages_.back().threads;
+  }
+
+  // 运行到 source 结束且所有帧离开最后一个阶段, 全部成功返回 0
+  int Run(const Source& source) {
+    if (stages_.empty()) {
+      return -1;
+    }
+    std::size_t count = stages_.size();
+    queues_.clear();
+    for (std::size_t k = 0; k < count; k++) {
+      queues_.emplace_back(new BoundedQueue<T>(depth_));
+      StageStats& stats = stats_[k];
+      stats = {stats.name, stats.threads};
+    }
+    active_.reset(new std::atomic<std::size_t>[count]);
+    for (std::size_t k = 0; k < count; k++) {
+      active_[k] = stages_[k].threads;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t k = 0; k < count; k++) {
+      for (std::size_t w = 0; w < stages_[k].threads; w++) {
+        threads.emplace_back([this, k, w] { Work(k, w); });
+      }
+    }
+    while (true) {
+      T frame;
+      if (!source(&frame) || !queues_[0]->Push(std::move(frame))) {
+        break;
+      }
+    }
+    queues_[0]->Close();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    elapsed_ms_ = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+    for (const StageStats& stats : stats_) {
+      if (stats.failures > 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  // 最近一次 Run() 各阶段的统计, 按添加的顺序
+  const std::vector<StageStats>& stats() const {
+    return stats_;
+  }
+
+  // 最近一次 Run() 从开始到最后一帧离开流水线的时间
+  double elapsed_ms() const {
+    return elapsed_ms_;
+  }
+
+  // 最近一次 Run() 通过所有阶段的帧数
+  std::size_t frames() const {
+    return stats_.empty() ? 0 : stats_.back().frames;
+  }
+
+ private:
+  struct StageEntry {
+    Stage stage;
+    std::size_t threads;
+  };
+
+  void Work(std::size_t k, std::size_t worker) {
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) {
+      return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    bool last = k + 1 == stages_.size();
+    StageStats local;
+    T frame;
+    while (true) {
+      Clock::time_point begin = Clock::now();
+      if (!queues_[k]->Pop(&frame)) {
+        local.wait_ms += ms(begin, Clock::now());
+        break;
+      }
+      Clock::time_point popped = Clock::now();
+      int64_t bytes = stages_[k].stage(&frame, worker);
+      Clock::time_point done = Clock::now();
+      local.wait_ms += ms(begin, popped);
+      local.busy_ms += ms(popped, done);
+      if (bytes < 0) {
+        local.failures++;
+        frame = T();
+        continue;
+      }
+      local.frames++;
+      local.bytes += static_cast<uint64_t>(bytes);
+      if (last) {
+        // 尽早释放帧持有的缓冲区和映射
+        frame = T();
+        continue;
+      }
+      queues_[k + 1]->Push(std::move(frame));
+      local.block_ms += ms(done, Clock::now());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      StageStats& stats = stats_[k];
+      stats.frames += local.frames;
+      stats.failures += local.failures;
+      stats.bytes += local.bytes;
+      stats.busy_ms += local.busy_ms;
+      stats.wait_ms += local.wait_ms;
+      stats.block_ms += local.block_ms;
+    }
+    // 阶段的最后一个线程退出时关闭下游队列
+    if (--active_[k] == 0 && !last) {
+      queues_[k + 1]->Close();
+    }
+  }
+
+  std::size_t depth_;
+  std::vector<StageEntry> stages_;
+  std::vector<StageStats> stats_;
+  std::vector<std::unique_ptr<BoundedQueue<T>>> queues_;
+  std::unique_ptr<std::atomic<std::size_t>[]> active_;
+  std::mutex mutex_;
+  double elapsed_ms_ = 0;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_FRAME_PIPELINE_HPP_
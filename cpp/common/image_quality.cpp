@@ -0,0 +1,203 @@
+// 图像质量指标的运行时分发和按行分段的并行计算, 标量实现用默认编译选项
+
+#include "image_quality.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "image_quality_kernels.hpp"
+
+namespace image_encode {
+
+namespace {
+
+const QualityKernels kScalarKernels = {
+    quality_detail::BgraRow, quality_detail::BlockRow,
+    quality_detail::ScalarWindowRow, quality_detail::DownsampleRow};
+
+// MS-SSIM 各级的权重 (Wang, Simoncelli, Bovik 2003)
+constexpr double kScaleWeights[] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+
+struct WindowSums {
+  double ssim;
+  double cs;
+};
+
+// 把 [0, rows) 按线程数分段执行 fn(begin, end), 结果按段的顺序返回
+template <class T, class Fn>
+std::vector<T> ForBands(thread_pool::ThreadPool* pool, std::size_t rows,
+                        const Fn& fn) {
+  std::size_t bands = pool ? std::min(rows, pool->num_threads()) : 1;
+  std::vector<T> results(std::max<std::size_t>(bands, 1));
+  if (bands <= 1) {
+    results[0] = fn(0, rows);
+    return results;
+  }
+  pool->ParallelFor(0, bands, 1, [&](std::size_t first, std::size_t last) {
+    for (std::size_t i = first; i < last; ++i) {
+      results[i] = fn(rows * i / bands, rows * (i + 1) / bands);
+    }
+  });
+  return results;
+}
+
+double Psnr(double sse, double count) {
+  if (sse == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 10.0 * std::log10(255.0 * 255.0 * count / sse);
+}
+
+}  // namespace
+
+const QualityKernels* GetQualityKernels(PixelIsa isa) {
+  static const xsimd::detail::supported_arch cpu =
+      xsimd::available_architectures();
+  switch (isa) {
+    case PixelIsa::kScalar:
+      return &kScalarKernels;
+    case PixelIsa::kSse41:
+      return cpu.sse4_1 ? quality_detail::Sse41Kernels() : nullptr;
+    case PixelIsa::kAvx2:
+      return cpu.avx2 ? quality_detail::Avx2Kernels() : nullptr;
+    case PixelIsa::kAvx512:
+      return cpu.avx512cd && cpu.avx512dq && cpu.avx512bw
+                 ? quality_detail::Avx512Kernels()
+                 : nullptr;
+  }
+  return nullptr;
+}
+
+QualityMeter::QualityMeter(thread_pool::ThreadPool* pool, PixelIsa isa)
+    : pool_(pool), isa_(isa), kernels_(GetQualityKernels(isa)) {}
+
+int QualityMeter::Compare(const unsigned char* ref, int ref_pitch,
+                          const unsigned char* dist, int dist_pitch,
+                          int width, int height, QualityMetrics* out) {
+  // 至少需要一个 8x8 窗口
+  if (kernels_ == nullptr || width < 8 || height < 8) {
+    return -1;
+  }
+  std::size_t w = width;
+  std::size_t h = height;
+  std::size_t ref_step = ref_pitch ? ref_pitch : w * 4;
+  std::size_t dist_step = dist_pitch ? dist_pitch : w * 4;
+  if (!luma_[0][0].Reserve(w * h) || !luma_[0][1].Reserve(w * h)) {
+    return -1;
+  }
+  const QualityKernels* kernels = kernels_;
+
+  // 第 0 级: 每通道平方误差, 同时得到两帧的亮度
+  unsigned char* la = luma_[0][0].data();
+  unsigned char* lb = luma_[0][1].data();
+  using Sse = std::array<uint64_t, 3>;
+  std::vector<Sse> parts = ForBands<Sse>(
+      pool_, h, [&](std::size_t begin, std::size_t end) {
+        Sse sse = {0, 0, 0};
+        for (std::size_t y = begin; y < end; ++y) {
+          kernels->bgra_row(ref + y * ref_step, dist + y * dist_step, w,
+                            la + y * w, lb + y * w, sse.data());
+        }
+        return sse;
+      });
+  Sse sse = {0, 0, 0};
+  for (const Sse& part : parts) {
+    for (std::size_t c = 0; c < 3; ++c) {
+      sse[c] += part[c];
+    }
+  }
+  double pixels = static_cast<double>(w) * h;
+  for (std::size_t c = 0; c < 3; ++c) {
+    out->psnr[c] = Psnr(static_cast<double>(sse[c]), pixels);
+  }
+  out->psnr_bgr =
+      Psnr(static_cast<double>(sse[0] + sse[1] + sse[2]), pixels * 3);
+
+  // 逐级计算窗口的 ssim 和 cs 均值, 再下采样到下一级
+  double ssim[kScales];
+  double cs[kScales];
+  int scales = 0;
+  for (int s = 0; s < kScales; ++s) {
+    const unsigned char* a = luma_[s][0].data();
+    const unsigned char* b = luma_[s][1].data();
+    std::size_t blocks = w / 4;
+    std::size_t windows = blocks - 1;
+    std::size_t window_rows = h / 4 - 1;
+    std::vector<WindowSums> sums = ForBands<WindowSums>(
+        pool_, window_rows, [&](std::size_t begin, std::size_t end) {
+          // 每段滚动保存上下两行块统计, 相邻段的边界行各算一次
+          std::vector<int32_t> stats(blocks * 4 * 2);
+          std::vector<float> row_ssim(windows);
+          std::vector<float> row_cs(windows);
+          int32_t* top = stats.data();
+          int32_t* bottom = stats.data() + blocks * 4;
+          kernels->block_row(a + begin * 4 * w, b + begin * 4 * w, w, blocks,
+                             top, blocks);
+          WindowSums total = {0, 0};
+          for (std::size_t y = begin; y < end; ++y) {
+            kernels->block_row(a + (y + 1) * 4 * w, b + (y + 1) * 4 * w, w,
+                               blocks, bottom, blocks);
+            kernels->window_row(top, bottom, blocks, windows,
+                                row_ssim.data(), row_cs.data());
+            for (std::size_t i = 0; i < windows; ++i) {
+              total.ssim += row_ssim[i];
+              total.cs += row_cs[i];
+            }
+            std::swap(top, bottom);
+          }
+          return total;
+        });
+    WindowSums total = {0, 0};
+    for (const WindowSums& part : sums) {
+      total.ssim += part.ssim;
+      total.cs += part.cs;
+    }
+    double count = static_cast<double>(windows) * window_rows;
+    ssim[s] = total.ssim / count;
+    cs[s] = total.cs / count;
+    scales++;
+
+    std::size_t next_w = w / 2;
+    std::size_t next_h = h / 2;
+    if (s + 1 == kScales || next_w < 8 || next_h < 8) {
+      break;
+    }
+    unsigned char* na = nullptr;
+    unsigned char* nb = nullptr;
+    if (!luma_[s + 1][0].Reserve(next_w * next_h) ||
+        !luma_[s + 1][1].Reserve(next_w * next_h)) {
+      return -1;
+    }
+    na = luma_[s + 1][0].data();
+    nb = luma_[s + 1][1].data();
+    ForBands<int>(pool_, next_h, [&](std::size_t begin, std::size_t end) {
+      for (std::size_t y = begin; y < end; ++y) {
+        kernels->downsample_row(a + y * 2 * w, w, next_w, na + y * next_w);
+        kernels->downsample_row(b + y * 2 * w, w, next_w, nb + y * next_w);
+      }
+      return 0;
+    });
+    w = next_w;
+    h = next_h;
+  }
+
+  // 最后一级用完整的 ssim, 之前各级只用 cs, cs 为负时按 0 处理
+  double weight_sum = 0;
+  for (int s = 0; s < scales; ++s) {
+    weight_sum += kScaleWeights[s];
+  }
+  double ms_ssim = 1;
+  for (int s = 0; s < scales; ++s) {
+    double value = s + 1 == scales ? ssim[s] : cs[s];
+    ms_ssim *= std::pow(std::max(value, 0.0), kScaleWeights[s] / weight_sum);
+  }
+  out->ssim = ssim[0];
+  out->ms_ssim = ms_ssim;
+  return 0;
+}
+
+}  // namespace image_encode
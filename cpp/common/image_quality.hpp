@@ -0,0 +1,82 @@
+// 图像质量指标: 每通道 PSNR, 亮度 SSIM 和 MS-SSIM, 比较原始 BGRA 帧和解码输出
+//
+// SSIM 使用 8x8 方窗 (与 x264 相同, 由 4x4 块统计拼成, 步长 4),
+// 而不是 11x11 高斯窗, 数值略有差别但单调性一致.
+// MS-SSIM 每一级 2x2 平均下采样, 共 5 级, 图像太小时减少级数并重新归一化权重.
+
+#ifndef IMAGE_ENCODE_IMAGE_QUALITY_HPP_
+#define IMAGE_ENCODE_IMAGE_QUALITY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "frame_buffer.hpp"
+#include "pixel_convert.hpp"
+#include "thread_pool.hpp"
+
+namespace image_encode {
+
+// 各指令集编译的内核, 与 PixelKernels 使用相同的运行时选择
+struct QualityKernels {
+  // 一行 BGRA 每通道平方误差 (b, g, r) 累加到 sse, 同时输出两帧的亮度
+  void (*bgra_row)(const unsigned char* a, const unsigned char* b,
+                   std::size_t n, unsigned char* luma_a,
+                   unsigned char* luma_b, uint64_t* sse);
+  // 4 行亮度的 4x4 块统计, 结果为 4 个平面 s1, s2, ss, s12, 平面间隔 stride
+  void (*block_row)(const unsigned char* a, const unsigned char* b,
+                    std::ptrdiff_t pitch, std::size_t blocks, int32_t* sums,
+                    std::size_t stride);
+  // 上下两行块统计拼成 8x8 窗口, 输出每个窗口的 ssim 和对比度结构项 cs
+  void (*window_row)(const int32_t* top, const int32_t* bottom,
+                     std::size_t stride, std::size_t windows, float* ssim,
+                     float* cs);
+  // 两行 2x2 平均下采样为一行
+  void (*downsample_row)(const unsigned char* src, std::ptrdiff_t pitch,
+                         std::size_t width, unsigned char* dst);
+};
+
+// 编译进来且当前 CPU 支持时返回对应实现, 否则返回 nullptr
+const QualityKernels* GetQualityKernels(PixelIsa isa);
+
+struct QualityMetrics {
+  double psnr[3];   // b, g, r, 完全相同时为无穷大
+  double psnr_bgr;  // 三个通道合并
+  double ssim;      // 亮度 SSIM
+  double ms_ssim;   // 亮度 MS-SSIM
+};
+
+// pool 为空时在调用线程计算, 否则按行分段在线程池上并行.
+// 中间的亮度金字塔保存在对象内, 同一对象不能同时在多个线程使用
+class QualityMeter {
+ public:
+  explicit QualityMeter(thread_pool::ThreadPool* pool = nullptr,
+                        PixelIsa isa = BestPixelIsa());
+
+  QualityMeter(const QualityMeter&) = delete;
+  QualityMeter& operator=(const QualityMeter&) = delete;
+
+  // pitch 为 0 时按 width * 4 紧密排列, 成功返回 0
+  int Compare(const unsigned char* ref, int ref_pitch,
+              const unsigned char* dist, int dist_pitch, int width,
+              int height, QualityMetrics* out);
+
+  PixelIsa isa() const {
+    return isa_;
+  }
+
+  bool valid() const {
+    return kernels_ != nullptr;
+  }
+
+ private:
+  static constexpr int kScales = 5;
+
+  thread_pool::ThreadPool* pool_;
+  PixelIsa isa_;
+  const QualityKernels* kernels_;
+  FrameBuffer luma_[kScales][2];  // 每一级两帧的亮度
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_IMAGE_QUALITY_HPP_
@@ -0,0 +1,17 @@
+// avx2 图像质量指标, 编译选项见 CMakeLists.txt
+
+#include "image_quality_kernels.hpp"
+
+namespace image_encode {
+namespace quality_detail {
+
+const QualityKernels* Avx2Kernels() {
+#if XSIMD_WITH_AVX2
+  return MakeKernels<xsimd::avx2>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace quality_detail
+}  // namespace image_encode
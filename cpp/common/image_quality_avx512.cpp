@@ -0,0 +1,17 @@
+// avx512bw 图像质量指标, 编译选项见 CMakeLists.txt
+
+#include "image_quality_kernels.hpp"
+
+namespace image_encode {
+namespace quality_detail {
+
+const QualityKernels* Avx512Kernels() {
+#if XSIMD_WITH_AVX512BW
+  return MakeKernels<xsimd::avx512bw>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace quality_detail
+}  // namespace image_encode
@@ -0,0 +1,195 @@
+// 图像质量指标内核, 只由 image_quality*.cpp 包含, 每个文件用各自的指令集编译
+//
+// 整数统计的循环写成编译器可以自动向量化的形式, 随文件的编译选项生成对应指令;
+// 窗口的 ssim 公式有除法和整数乘法, 用 xsimd 显式向量化.
+
+#ifndef IMAGE_ENCODE_IMAGE_QUALITY_KERNELS_HPP_
+#define IMAGE_ENCODE_IMAGE_QUALITY_KERNELS_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "image_quality.hpp"
+#include "xsimd/xsimd.hpp"
+
+namespace image_encode {
+namespace quality_detail {
+// 各文件的指令集不同, 内联函数不能跨文件合并, 否则可能用到 cpu 不支持的指令
+namespace {
+
+// 8x8 窗口 (64 像素) 的常数, 公式中的均值和方差都乘了 64^2
+constexpr float kC1 = 0.01f * 0.01f * 255 * 255 * 64 * 64;
+constexpr float kC2 = 0.03f * 0.03f * 255 * 255 * 64 * 64;
+
+// 每段的平方误差不超过 255^2 * 16384, 可以用 32 位累加
+constexpr std::size_t kSseChunk = 16384;
+
+// 块统计每次处理的列数, 列统计放在栈上
+constexpr std::size_t kBlockChunk = 64;
+
+inline void BgraRow(const unsigned char* a, const unsigned char* b,
+                    std::size_t n, unsigned char* luma_a,
+                    unsigned char* luma_b, uint64_t* sse) {
+  for (std::size_t begin = 0; begin < n; begin += kSseChunk) {
+    std::size_t end = std::min(n, begin + kSseChunk);
+    uint32_t sb = 0;
+    uint32_t sg = 0;
+    uint32_t sr = 0;
+    // 按 32 位整像素读取再移位拆分通道, 避免逐字节的交错访问
+    for (std::size_t i = begin; i < end; ++i) {
+      uint32_t pa;
+      uint32_t pb;
+      std::memcpy(&pa, a + i * 4, sizeof(pa));
+      std::memcpy(&pb, b + i * 4, sizeof(pb));
+      int32_t ba = pa & 0xFF;
+      int32_t ga = (pa >> 8) & 0xFF;
+      int32_t ra = (pa >> 16) & 0xFF;
+      int32_t bb = pb & 0xFF;
+      int32_t gb = (pb >> 8) & 0xFF;
+      int32_t rb = (pb >> 16) & 0xFF;
+      sb += (ba - bb) * (ba - bb);
+      sg += (ga - gb) * (ga - gb);
+      sr += (ra - rb) * (ra - rb);
+      // BT.601 全范围亮度
+      luma_a[i] =
+          static_cast<unsigned char>((29 * ba + 150 * ga + 77 * ra + 128) >> 8);
+      luma_b[i] =
+          static_cast<unsigned char>((29 * bb + 150 * gb + 77 * rb + 128) >> 8);
+    }
+    sse[0] += sb;
+    sse[1] += sg;
+    sse[2] += sr;
+  }
+}
+
+inline void BlockRow(const unsigned char* a, const unsigned char* b,
+                     std::ptrdiff_t pitch, std::size_t blocks, int32_t* sums,
+                     std::size_t stride) {
+  int32_t* s1 = sums;
+  int32_t* s2 = sums + stride;
+  int32_t* ss = sums + stride * 2;
+  int32_t* s12 = sums + stride * 3;
+  // 先按列累加 4 行 (连续访问), 再每 4 列合成一个块
+  int32_t c1[kBlockChunk];
+  int32_t c2[kBlockChunk];
+  int32_t css[kBlockChunk];
+  int32_t c12[kBlockChunk];
+  for (std::size_t begin = 0; begin < blocks; begin += kBlockChunk / 4) {
+    std::size_t count = std::min(kBlockChunk / 4, blocks - begin);
+    std::size_t columns = count * 4;
+    const unsigned char* pa = a + begin * 4;
+    const unsigned char* pb = b + begin * 4;
+    for (std::size_t x = 0; x < columns; ++x) {
+      c1[x] = 0;
+      c2[x] = 0;
+      css[x] = 0;
+      c12[x] = 0;
+    }
+    for (int y = 0; y < 4; ++y) {
+      for (std::size_t x = 0; x < columns; ++x) {
+        int32_t va = pa[y * pitch + x];
+        int32_t vb = pb[y * pitch + x];
+        c1[x] += va;
+        c2[x] += vb;
+        css[x] += va * va + vb * vb;
+        c12[x] += va * vb;
+      }
+    }
+    for (std::size_t x = 0; x < count; ++x) {
+      std::size_t k = x * 4;
+      s1[begin + x] = c1[k] + c1[k + 1] + c1[k + 2] + c1[k + 3];
+      s2[begin + x] = c2[k] + c2[k + 1] + c2[k + 2] + c2[k + 3];
+      ss[begin + x] = css[k] + css[k + 1] + css[k + 2] + css[k + 3];
+      s12[begin + x] = c12[k] + c12[k + 1] + c12[k + 2] + c12[k + 3];
+    }
+  }
+}
+
+inline void DownsampleRow(const unsigned char* src, std::ptrdiff_t pitch,
+                          std::size_t width, unsigned char* dst) {
+  const unsigned char* next = src + pitch;
+  for (std::size_t x = 0; x < width; ++x) {
+    dst[x] = static_cast<unsigned char>(
+        (src[x * 2] + src[x * 2 + 1] + next[x * 2] + next[x * 2 + 1] + 2) >>
+        2);
+  }
+}
+
+// 窗口内 64 像素的统计都不超过 2^31: ss * 64 <= 64 * 2 * 255^2 * 64
+inline void ScalarWindows(const int32_t* top, const int32_t* bottom,
+                          std::size_t stride, std::size_t begin,
+                          std::size_t end, float* ssim, float* cs) {
+  for (std::size_t i = begin; i < end; ++i) {
+    int32_t s[4];
+    for (std::size_t k = 0; k < 4; ++k) {
+      const int32_t* t = top + k * stride + i;
+      const int32_t* b = bottom + k * stride + i;
+      s[k] = t[0] + t[1] + b[0] + b[1];
+    }
+    int32_t vars = s[2] * 64 - s[0] * s[0] - s[1] * s[1];
+    int32_t covar = s[3] * 64 - s[0] * s[1];
+    float f1 = static_cast<float>(s[0]);
+    float f2 = static_cast<float>(s[1]);
+    float l = (2 * f1 * f2 + kC1) / (f1 * f1 + f2 * f2 + kC1);
+    float c = (2 * static_cast<float>(covar) + kC2) /
+              (static_cast<float>(vars) + kC2);
+    ssim[i] = l * c;
+    cs[i] = c;
+  }
+}
+
+inline void ScalarWindowRow(const int32_t* top, const int32_t* bottom,
+                            std::size_t stride, std::size_t windows,
+                            float* ssim, float* cs) {
+  ScalarWindows(top, bottom, stride, 0, windows, ssim, cs);
+}
+
+template <class A>
+void WindowRow(const int32_t* top, const int32_t* bottom, std::size_t stride,
+               std::size_t windows, float* ssim, float* cs) {
+  using i32 = xsimd::batch<int32_t, A>;
+  using f32 = xsimd::batch<float, A>;
+  constexpr std::size_t step = i32::size;
+  const f32 c1(kC1);
+  const f32 c2(kC2);
+  auto load = [&](std::size_t plane, std::size_t i) {
+    const int32_t* t = top + plane * stride + i;
+    const int32_t* b = bottom + plane * stride + i;
+    return i32::load_unaligned(t) + i32::load_unaligned(t + 1) +
+           i32::load_unaligned(b) + i32::load_unaligned(b + 1);
+  };
+  std::size_t i = 0;
+  for (; i + step <= windows; i += step) {
+    i32 s1 = load(0, i);
+    i32 s2 = load(1, i);
+    i32 vars = load(2, i) * 64 - s1 * s1 - s2 * s2;
+    i32 covar = load(3, i) * 64 - s1 * s2;
+    f32 f1 = xsimd::to_float(s1);
+    f32 f2 = xsimd::to_float(s2);
+    f32 l = (f1 * f2 * 2 + c1) / (f1 * f1 + f2 * f2 + c1);
+    f32 c = (xsimd::to_float(covar) * 2 + c2) / (xsimd::to_float(vars) + c2);
+    (l * c).store_unaligned(ssim + i);
+    c.store_unaligned(cs + i);
+  }
+  ScalarWindows(top, bottom, stride, i, windows, ssim, cs);
+}
+
+template <class A>
+const QualityKernels* MakeKernels() {
+  static const QualityKernels kernels = {BgraRow, BlockRow, WindowRow<A>,
+                                         DownsampleRow};
+  return &kernels;
+}
+
+}  // namespace
+
+const QualityKernels* Sse41Kernels();
+const QualityKernels* Avx2Kernels();
+const QualityKernels* Avx512Kernels();
+
+}  // namespace quality_detail
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_IMAGE_QUALITY_KERNELS_HPP_
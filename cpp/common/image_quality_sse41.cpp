@@ -0,0 +1,17 @@
+// sse4_1 图像质量指标, 编译选项见 CMakeLists.txt
+
+#include "image_quality_kernels.hpp"
+
+namespace image_encode {
+namespace quality_detail {
+
+const QualityKernels* Sse41Kernels() {
+#if XSIMD_WITH_SSE4_1
+  return MakeKernels<xsimd::sse4_1>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace quality_detail
+}  // namespace image_encode
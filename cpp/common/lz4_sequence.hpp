@@ -0,0 +1,237 @@
+// 帧间 lz4 压缩: 每帧按固定大小分块, 每块以上一帧同位置的块作为字典
+//
+// lz4 的匹配距离最多 64KB, 整帧作为字典时只有最后 64KB 有效, 因此按块对应.
+// 上一帧的块在 Commit() 时用 LZ4_loadDict() 预处理, 压缩时通过
+// LZ4_attach_dictionary() 只读引用, 同一帧可以重复压缩而不改变字典.
+//
+// 输出格式 (小端): Lz4SequenceHeader, 每块压缩后大小 uint32_t[blocks], 各块数据
+
+#ifndef IMAGE_ENCODE_LZ4_SEQUENCE_HPP_
+#define IMAGE_ENCODE_LZ4_SEQUENCE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "frame_buffer.hpp"
+#define LZ4_STATIC_LINKING_ONLY
+#include "lz4.h"
+
+namespace image_encode {
+
+// 同位置匹配的距离等于块大小, 必须小于 64KB
+constexpr std::size_t kLz4SequenceBlockSize = 32 * 1024;
+
+struct Lz4SequenceHeader {
+  uint32_t frame_size;
+  uint32_t block_size;
+  uint32_t keyframe;  // 1 表示不参考上一帧
+};
+
+inline std::size_t Lz4SequenceBound(
+    std::size_t frame_size, std::size_t block_size = kLz4SequenceBlockSize) {
+  std::size_t blocks = (frame_size + block_size - 1) / block_size;
+  return sizeof(Lz4SequenceHeader) + blocks * sizeof(uint32_t) +
+         blocks * Lz4Bound(block_size);
+}
+
+class Lz4SequenceEncoder {
+ public:
+  explicit Lz4SequenceEncoder(int keyframe_interval = 60, int acceleration = 1,
+                              std::size_t block_size = kLz4SequenceBlockSize)
+      : keyframe_interval_(keyframe_interval),
+        acceleration_(acceleration),
+        block_size_(block_size),
+        frame_size_(0),
+        frames_(0),
+        force_keyframe_(true),
+        work_(LZ4_createStream()) {}
+
+  Lz4SequenceEncoder(const Lz4SequenceEncoder&) = delete;
+  Lz4SequenceEncoder& operator=(const Lz4SequenceEncoder&) = delete;
+
+  ~Lz4SequenceEncoder() {
+    for (LZ4_stream_t* dict : dicts_) {
+      LZ4_freeStream(dict);
+    }
+    LZ4_freeStream(work_);
+  }
+
+  // 下一帧输出关键帧, 用于接收端丢帧后重新同步
+  void RequestKeyframe() {
+    force_keyframe_ = true;
+  }
+
+  bool NextIsKeyframe(std::size_t size) const {
+    return force_keyframe_ || size != frame_size_ ||
+           (keyframe_interval_ > 0 && frames_ % keyframe_interval_ == 0);
+  }
+
+  // 压缩一帧写入 out, 不改变参考帧, 成功返回 0
+  int Encode(const unsigned char* frame, std::size_t size, FrameBuffer* out) {
+    std::size_t blocks = (size + block_size_ - 1) / block_size_;
+    if (!out->Reserve(Lz4SequenceBound(size, block_size_))) {
+      return -1;
+    }
+    bool keyframe = NextIsKeyframe(size);
+    Lz4SequenceHeader header = {static_cast<uint32_t>(size),
+                                static_cast<uint32_t>(block_size_),
+                                keyframe ? 1u : 0u};
+    unsigned char* dst = out->data();
+    std::memcpy(dst, &header, sizeof(header));
+    unsigned char* sizes = dst + sizeof(header);
+    std::size_t offset = sizeof(header) + blocks * sizeof(uint32_t);
+    for (std::size_t i = 0; i < blocks; i++) {
+      std::size_t begin = i * block_size_;
+      int length = static_cast<int>(std::min(block_size_, size - begin));
+      LZ4_resetStream_fast(work_);
+      if (!keyframe) {
+        LZ4_attach_dictionary(work_, dicts_[i]);
+      }
+      int ret = LZ4_compress_fast_continue(
+          work_, reinterpret_cast<const char*>(frame + begin),
+          reinterpret_cast<char*>(dst + offset), length,
+          static_cast<int>(out->capacity() - offset), acceleration_);
+      if (ret <= 0) {
+        out->set_size(0);
+        return -1;
+      }
+      uint32_t block = static_cast<uint32_t>(ret);
+      std::memcpy(sizes + i * sizeof(uint32_t), &block, sizeof(block));
+      offset += ret;
+    }
+    out->set_size(offset);
+    return 0;
+  }
+
+  // 把 frame 作为下一帧的参考, 和 Encode() 传入的帧相同
+  bool Commit(const unsigned char* frame, std::size_t size) {
+    bool full = size != frame_size_;
+    if (full) {
+      if (!prev_.Reserve(size)) {
+        return false;
+      }
+      std::size_t blocks = (size + block_size_ - 1) / block_size_;
+      while (dicts_.size() < blocks) {
+        dicts_.push_back(LZ4_createStream());
+      }
+      prev_.set_size(size);
+      frame_size_ = size;
+    }
+    // 没有变化的块保留原来的字典, 静止画面只需要比较不需要重建哈希表
+    for (std::size_t i = 0; i * block_size_ < size; i++) {
+      std::size_t begin = i * block_size_;
+      std::size_t length = std::min(block_size_, size - begin);
+      unsigned char* dict = prev_.data() + begin;
+      if (!full && std::memcmp(dict, frame + begin, length) == 0) {
+        continue;
+      }
+      std::memcpy(dict, frame + begin, length);
+      LZ4_loadDict(dicts_[i], reinterpret_cast<const char*>(dict),
+                   static_cast<int>(length));
+    }
+    frames_++;
+    force_keyframe_ = false;
+    return true;
+  }
+
+  void Reset() {
+    frame_size_ = 0;
+    frames_ = 0;
+    force_keyframe_ = true;
+  }
+
+ private:
+  int keyframe_interval_;  // 0 表示只有第一帧是关键帧
+  int acceleration_;
+  std::size_t block_size_;
+  std::size_t frame_size_;  // 参考帧大小, 0 表示没有参考帧
+  uint64_t frames_;         // 已提交的帧数
+  bool force_keyframe_;
+  LZ4_stream_t* work_;
+  std::vector<LZ4_stream_t*> dicts_;  // 参考帧每块的字典
+  FrameBuffer prev_;                  // 参考帧, 字典引用其中的数据
+};
+
+class Lz4SequenceDecoder {
+ public:
+  Lz4SequenceDecoder() : current_(0), frame_size_(0) {}
+
+  Lz4SequenceDecoder(const Lz4SequenceDecoder&) = delete;
+  Lz4SequenceDecoder& operator=(const Lz4SequenceDecoder&) = delete;
+
+  // 解码一帧, 成功返回 0. 非关键帧缺少参考帧时返回 -1, 需要请求关键帧
+  int Decode(const unsigned char* src, std::size_t size) {
+    Lz4SequenceHeader header;
+    if (size < sizeof(header)) {
+      return -1;
+    }
+    std::memcpy(&header, src, sizeof(header));
+    std::size_t frame_size = header.frame_size;
+    std::size_t block_size = header.block_size;
+    if (block_size == 0) {
+      return -1;
+    }
+    std::size_t blocks = (frame_size + block_size - 1) / block_size;
+    bool keyframe = header.keyframe != 0;
+    if (!keyframe && frame_size != frame_size_) {
+      return -1;
+    }
+    std::size_t offset = sizeof(header) + blocks * sizeof(uint32_t);
+    if (size < offset) {
+      return -1;
+    }
+    FrameBuffer& out = history_[current_ ^ 1];
+    const FrameBuffer& prev = history_[current_];
+    if (!out.Reserve(frame_size)) {
+      return -1;
+    }
+    for (std::size_t i = 0; i < blocks; i++) {
+      uint32_t block = 0;
+      std::memcpy(&block, src + sizeof(header) + i * sizeof(uint32_t),
+                  sizeof(block));
+      std::size_t begin = i * block_size;
+      int length = static_cast<int>(std::min(block_size, frame_size - begin));
+      if (block > size - offset) {
+        return -1;
+      }
+      const char* in = reinterpret_cast<const char*>(src + offset);
+      char* dst = reinterpret_cast<char*>(out.data() + begin);
+      int ret = keyframe
+                    ? LZ4_decompress_safe(in, dst, static_cast<int>(block),
+                                          length)
+                    : LZ4_decompress_safe_usingDict(
+                          in, dst, static_cast<int>(block), length,
+                          reinterpret_cast<const char*>(prev.data()) + begin,
+                          length);
+      if (ret != length) {
+        return -1;
+      }
+      offset += block;
+    }
+    out.set_size(frame_size);
+    current_ ^= 1;
+    frame_size_ = frame_size;
+    return 0;
+  }
+
+  // 最近一次解码的帧, 在下一次 Decode() 之前有效
+  const unsigned char* frame() const {
+    return history_[current_].data();
+  }
+
+  std::size_t frame_size() const {
+    return frame_size_;
+  }
+
+ private:
+  int current_;
+  std::size_t frame_size_;
+  FrameBuffer history_[2];  // 交替写入, 另一个作为参考帧
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_LZ4_SEQUENCE_HPP_
@@ -0,0 +1,255 @@
+// 只读映射的帧文件, 以及按顺序读取一组帧文件并预读下一帧的帧源
+//
+// 映射的页由页缓存提供, 不再拷贝到堆上; 解除映射后这些干净的页可以被系统回收,
+// 所以按顺序处理比内存大的数据集时常驻内存只有当前帧和预读的下一帧.
+
+#ifndef IMAGE_ENCODE_MAPPED_FILE_HPP_
+#define IMAGE_ENCODE_MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace image_encode {
+
+// 映射后的访问方式, 对应 madvise 的 MADV_SEQUENTIAL 和 MADV_WILLNEED
+enum MapAdvice {
+  kMapNormal = 0,
+  kMapSequential = 1,  // 顺序读取, 加大预读并尽早回收读过的页
+  kMapWillNeed = 2,    // 立即开始异步读取整个文件
+};
+
+// 只读映射整个文件, 数据在对象析构或 Close() 前有效.
+// windows 上不支持访问方式, 依赖系统自己的预读
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept
+      : data_(other.data_),
+        size_(other.size_),
+        path_(std::move(other.path_)),
+        error_(std::move(other.error_)) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(path_, other.path_);
+    std::swap(error_, other.error_);
+    return *this;
+  }
+
+  ~MappedFile() {
+    Close();
+  }
+
+  // advice 为 MapAdvice 的组合, 空文件映射成功但 data() 为空, 成功返回 0
+  int Open(const std::string& path, int advice = kMapSequential) {
+    Close();
+    path_ = path;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              (advice & kMapSequential)
+                                  ? FILE_FLAG_SEQUENTIAL_SCAN
+                                  : FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      error_ = "file can not open: " + path;
+      return -1;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+      CloseHandle(file);
+      error_ = "file size unknown: " + path;
+      return -1;
+    }
+    size_ = static_cast<std::size_t>(size.QuadPart);
+    if (size_ > 0) {
+      HANDLE mapping =
+          CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping != nullptr) {
+        data_ = static_cast<const unsigned char*>(
+            MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      error_ = "file can not open: " + path;
+      return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      error_ = "file size unknown: " + path;
+      return -1;
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ > 0) {
+      void* ptr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+      data_ = ptr == MAP_FAILED ? nullptr
+                                : static_cast<const unsigned char*>(ptr);
+    }
+    // 映射建立后文件描述符不再需要
+    close(fd);
+#endif
+    if (size_ > 0 && data_ == nullptr) {
+      size_ = 0;
+      error_ = "file can not map: " + path;
+      return -1;
+    }
+    Advise(advice);
+    return 0;
+  }
+
+  void Close() {
+    if (data_ != nullptr) {
+#ifdef _WIN32
+      UnmapViewOfFile(data_);
+#else
+      munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  // 修改整个映射的访问方式, 只是提示, 失败时忽略
+  void Advise(int advice) const {
+#ifndef _WIN32
+    if (data_ == nullptr) {
+      return;
+    }
+    void* ptr = const_cast<unsigned char*>(data_);
+    if (advice & kMapSequential) {
+      madvise(ptr, size_, MADV_SEQUENTIAL);
+    }
+    if (advice & kMapWillNeed) {
+      madvise(ptr, size_, MADV_WILLNEED);
+    }
+#else
+    (void)advice;
+#endif
+  }
+
+  // 按页只读访问, 起始地址按页对齐
+  const unsigned char* data() const {
+    return data_;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+
+  bool is_open() const {
+    return data_ != nullptr;
+  }
+
+  const std::string& path() const {
+    return path_;
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+ private:
+  const unsigned char* data_ = nullptr;
+  std::size_t size_ = 0;
+  std::string path_;
+  std::string error_;
+};
+
+// 按给定顺序映射一组文件, 打开第 i 个时解除上一个的映射并预读第 i + 1 个,
+// 顺序访问时同时映射的只有两个文件. 只能在一个线程使用
+class FrameSource {
+ public:
+  explicit FrameSource(std::vector<std::string> paths)
+      : paths_(std::move(paths)) {}
+
+  FrameSource(const FrameSource&) = delete;
+  FrameSource& operator=(const FrameSource&) = delete;
+
+  // 映射第 index 个文件, 下一个文件已经预读时直接使用, 成功返回 0
+  int Open(std::size_t index) {
+    if (index >= paths_.size()) {
+      error_ = "frame index out of range";
+      return -1;
+    }
+    if (index == index_ + 1 && next_.path() == paths_[index] &&
+        next_.is_open()) {
+      current_ = std::move(next_);
+      current_.Advise(kMapSequential);
+      next_.Close();
+    } else {
+      next_.Close();
+      if (current_.Open(paths_[index], kMapSequential | kMapWillNeed) != 0) {
+        error_ = current_.error();
+        index_ = index;
+        return -1;
+      }
+    }
+    index_ = index;
+    // 预读失败不影响当前帧, 打开下一帧时再报告
+    if (index + 1 < paths_.size()) {
+      next_.Open(paths_[index + 1], kMapWillNeed);
+    }
+    return 0;
+  }
+
+  // 解除所有映射
+  void Close() {
+    current_.Close();
+    next_.Close();
+  }
+
+  std::size_t count() const {
+    return paths_.size();
+  }
+
+  const unsigned char* data() const {
+    return current_.data();
+  }
+
+  std::size_t size() const {
+    return current_.size();
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+ private:
+  std::vector<std::string> paths_;
+  std::size_t index_ = SIZE_MAX;
+  MappedFile current_;
+  MappedFile next_;
+  std::string error_;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_MAPPED_FILE_HPP_
@@ -0,0 +1,94 @@
+// 同一帧输出多个质量的 JPEG: 颜色转换和色度下采样只做一次得到平面 yuv,
+// 各质量在线程池上并行从 yuv 压缩, 只重复 DCT、量化和熵编码
+
+#ifndef IMAGE_ENCODE_MULTI_QUALITY_JPEG_HPP_
+#define IMAGE_ENCODE_MULTI_QUALITY_JPEG_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "codec_context.hpp"
+#include "frame_buffer.hpp"
+#include "thread_pool.hpp"
+#include "turbojpeg.h"
+
+namespace image_encode {
+
+class MultiQualityJpegEncoder {
+ public:
+  MultiQualityJpegEncoder(thread_pool::ThreadPool* pool,
+                          CodecContextPool* contexts, FrameBufferPool* buffers)
+      : pool_(pool), contexts_(contexts), buffers_(buffers) {}
+
+  MultiQualityJpegEncoder(const MultiQualityJpegEncoder&) = delete;
+  MultiQualityJpegEncoder& operator=(const MultiQualityJpegEncoder&) = delete;
+
+  // outs 按 qualities 的顺序输出, 容量不足的缓冲区从池中重新申请,
+  // 成功返回 0, 失败返回 -1 并设置 error()
+  int Encode(const unsigned char* src, int width, int pitch, int height,
+             int pixel_format, int subsamp, int flags,
+             const std::vector<int>& qualities,
+             std::vector<FrameBuffer>* outs) {
+    // 颜色转换在调用线程执行, 之后所有质量共享同一份只读的 yuv
+    std::size_t yuv_size = YuvBufSize(width, height, subsamp, kAlign);
+    if (!yuv_.Reserve(yuv_size)) {
+      error_ = "out of memory";
+      return -1;
+    }
+    CodecContext& context = contexts_->Get();
+    if (context.EncodeYuv(src, width, pitch, height, pixel_format, subsamp,
+                          kAlign, &yuv_) != 0) {
+      error_ = tj3GetErrorStr(context.tj());
+      return -1;
+    }
+
+    std::size_t bound = JpegBufSize(width, height, subsamp);
+    outs->resize(qualities.size());
+    for (FrameBuffer& out : *outs) {
+      if (out.capacity() < bound) {
+        out = buffers_->Acquire(bound);
+      }
+    }
+    const unsigned char* yuv = yuv_.data();
+    std::atomic<bool> ok(true);
+    pool_->ParallelFor(
+        0, qualities.size(), 1, [&](std::size_t first, std::size_t last) {
+          for (std::size_t i = first; i < last; i++) {
+            if (contexts_->Get().CompressJpegFromYuv(
+                    yuv, width, kAlign, height, subsamp, qualities[i], flags,
+                    &(*outs)[i]) != 0) {
+              ok = false;
+            }
+          }
+        });
+    if (!ok) {
+      error_ = "quality encode failed";
+      return -1;
+    }
+    return 0;
+  }
+
+  // 最近一次 Encode() 的平面 yuv
+  const FrameBuffer& yuv() const {
+    return yuv_;
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+ private:
+  static constexpr int kAlign = 4;
+
+  thread_pool::ThreadPool* pool_;
+  CodecContextPool* contexts_;
+  FrameBufferPool* buffers_;
+  FrameBuffer yuv_;
+  std::string error_;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_MULTI_QUALITY_JPEG_HPP_
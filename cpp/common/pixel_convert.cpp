@@ -0,0 +1,134 @@
+// 像素格式转换的运行时分发, 标量实现用默认编译选项
+
+#include "pixel_convert.hpp"
+
+#include "pixel_convert_kernels.hpp"
+
+namespace image_encode {
+
+namespace {
+
+const PixelKernels kScalarKernels = {
+    pixel_detail::ScalarToBgr, pixel_detail::ScalarToRgb,
+    pixel_detail::ScalarToRgba, pixel_detail::ScalarToPlanar};
+
+// pitch 等于行宽时整帧当作一行处理
+template <class Kernel>
+void ConvertRows(Kernel kernel, const unsigned char* src, int width,
+                 int pitch, int height, unsigned char* dst, int dst_pitch) {
+  if (pitch == width * 4) {
+    kernel(src, dst, static_cast<std::size_t>(width) * height);
+    return;
+  }
+  for (int y = 0; y < height; ++y) {
+    kernel(src + static_cast<std::size_t>(y) * pitch,
+           dst + static_cast<std::size_t>(y) * dst_pitch, width);
+  }
+}
+
+const PixelConverter& DefaultConverter() {
+  static const PixelConverter converter;
+  return converter;
+}
+
+}  // namespace
+
+const PixelKernels* GetPixelKernels(PixelIsa isa) {
+  static const xsimd::detail::supported_arch cpu =
+      xsimd::available_architectures();
+  switch (isa) {
+    case PixelIsa::kScalar:
+      return &kScalarKernels;
+    case PixelIsa::kSse41:
+      return cpu.sse4_1 ? pixel_detail::Sse41Kernels() : nullptr;
+    case PixelIsa::kAvx2:
+      return cpu.avx2 ? pixel_detail::Avx2Kernels() : nullptr;
+    case PixelIsa::kAvx512:
+      return cpu.avx512cd && cpu.avx512dq && cpu.avx512bw
+                 ? pixel_detail::Avx512Kernels()
+                 : nullptr;
+  }
+  return nullptr;
+}
+
+PixelIsa BestPixelIsa() {
+  for (PixelIsa isa :
+       {PixelIsa::kAvx512, PixelIsa::kAvx2, PixelIsa::kSse41}) {
+    if (GetPixelKernels(isa) != nullptr) {
+      return isa;
+    }
+  }
+  return PixelIsa::kScalar;
+}
+
+const char* PixelIsaName(PixelIsa isa) {
+  switch (isa) {
+    case PixelIsa::kScalar:
+      return "scalar";
+    case PixelIsa::kSse41:
+      return "sse4.1";
+    case PixelIsa::kAvx2:
+      return "avx2";
+    case PixelIsa::kAvx512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+PixelConverter::PixelConverter(PixelIsa isa)
+    : isa_(isa), kernels_(GetPixelKernels(isa)) {}
+
+void PixelConverter::ToBgr(const unsigned char* src, int width, int pitch,
+                           int height, unsigned char* dst) const {
+  ConvertRows(kernels_->bgra_to_bgr, src, width, pitch, height, dst,
+              width * 3);
+}
+
+void PixelConverter::ToRgb(const unsigned char* src, int width, int pitch,
+                           int height, unsigned char* dst) const {
+  ConvertRows(kernels_->bgra_to_rgb, src, width, pitch, height, dst,
+              width * 3);
+}
+
+void PixelConverter::ToRgba(const unsigned char* src, int width, int pitch,
+                            int height, unsigned char* dst) const {
+  ConvertRows(kernels_->bgra_to_rgba, src, width, pitch, height, dst,
+              width * 4);
+}
+
+void PixelConverter::ToPlanar(const unsigned char* src, int width, int pitch,
+                              int height, unsigned char* b, unsigned char* g,
+                              unsigned char* r) const {
+  if (pitch == width * 4) {
+    kernels_->bgra_to_planar(src, b, g, r,
+                             static_cast<std::size_t>(width) * height);
+    return;
+  }
+  for (int y = 0; y < height; ++y) {
+    std::size_t offset = static_cast<std::size_t>(y) * width;
+    kernels_->bgra_to_planar(src + static_cast<std::size_t>(y) * pitch,
+                             b + offset, g + offset, r + offset, width);
+  }
+}
+
+void BgraToBgr(const unsigned char* src, int width, int pitch, int height,
+               unsigned char* dst) {
+  DefaultConverter().ToBgr(src, width, pitch, height, dst);
+}
+
+void BgraToRgb(const unsigned char* src, int width, int pitch, int height,
+               unsigned char* dst) {
+  DefaultConverter().ToRgb(src, width, pitch, height, dst);
+}
+
+void BgraToRgba(const unsigned char* src, int width, int pitch, int height,
+                unsigned char* dst) {
+  DefaultConverter().ToRgba(src, width, pitch, height, dst);
+}
+
+void BgraToPlanar(const unsigned char* src, int width, int pitch, int height,
+                  unsigned char* b, unsigned char* g, unsigned char* r) {
+  DefaultConverter().ToPlanar(src, width, pitch, height, b, g, r);
+}
+
+}  // namespace image_encode
@@ -0,0 +1,68 @@
+// BGRA 像素格式转换, 各指令集分别编译, 运行时选择当前 CPU 支持的最快实现
+
+#ifndef IMAGE_ENCODE_PIXEL_CONVERT_HPP_
+#define IMAGE_ENCODE_PIXEL_CONVERT_HPP_
+
+#include <cstddef>
+
+namespace image_encode {
+
+enum class PixelIsa { kScalar, kSse41, kAvx2, kAvx512 };
+
+// 一行连续像素的转换函数, n 为像素数
+struct PixelKernels {
+  void (*bgra_to_bgr)(const unsigned char* src, unsigned char* dst,
+                      std::size_t n);
+  void (*bgra_to_rgb)(const unsigned char* src, unsigned char* dst,
+                      std::size_t n);
+  void (*bgra_to_rgba)(const unsigned char* src, unsigned char* dst,
+                       std::size_t n);
+  void (*bgra_to_planar)(const unsigned char* src, unsigned char* b,
+                         unsigned char* g, unsigned char* r, std::size_t n);
+};
+
+// 编译进来且当前 CPU 支持时返回对应实现, 否则返回 nullptr
+const PixelKernels* GetPixelKernels(PixelIsa isa);
+PixelIsa BestPixelIsa();
+const char* PixelIsaName(PixelIsa isa);
+
+// 输出由调用方分配, 紧密排列: bgr/rgb 为 width * 3 每行, 平面为 width 每行
+class PixelConverter {
+ public:
+  explicit PixelConverter(PixelIsa isa = BestPixelIsa());
+
+  void ToBgr(const unsigned char* src, int width, int pitch, int height,
+             unsigned char* dst) const;
+  void ToRgb(const unsigned char* src, int width, int pitch, int height,
+             unsigned char* dst) const;
+  void ToRgba(const unsigned char* src, int width, int pitch, int height,
+              unsigned char* dst) const;
+  void ToPlanar(const unsigned char* src, int width, int pitch, int height,
+                unsigned char* b, unsigned char* g, unsigned char* r) const;
+
+  PixelIsa isa() const {
+    return isa_;
+  }
+
+  bool valid() const {
+    return kernels_ != nullptr;
+  }
+
+ private:
+  PixelIsa isa_;
+  const PixelKernels* kernels_;
+};
+
+// 使用最快实现的便捷函数
+void BgraToBgr(const unsigned char* src, int width, int pitch, int height,
+               unsigned char* dst);
+void BgraToRgb(const unsigned char* src, int width, int pitch, int height,
+               unsigned char* dst);
+void BgraToRgba(const unsigned char* src, int width, int pitch, int height,
+                unsigned char* dst);
+void BgraToPlanar(const unsigned char* src, int width, int pitch, int height,
+                  unsigned char* b, unsigned char* g, unsigned char* r);
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_PIXEL_CONVERT_HPP_
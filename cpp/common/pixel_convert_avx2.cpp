@@ -0,0 +1,17 @@
+// avx2 像素格式转换, 编译选项见 CMakeLists.txt
+
+#include "pixel_convert_kernels.hpp"
+
+namespace image_encode {
+namespace pixel_detail {
+
+const PixelKernels* Avx2Kernels() {
+#if XSIMD_WITH_AVX2
+  return MakeKernels<xsimd::avx2>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace pixel_detail
+}  // namespace image_encode
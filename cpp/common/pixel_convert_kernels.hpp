@@ -0,0 +1,214 @@
+// 像素格式转换内核, 只由 pixel_convert*.cpp 包含, 每个文件用各自的指令集编译
+
+#ifndef IMAGE_ENCODE_PIXEL_CONVERT_KERNELS_HPP_
+#define IMAGE_ENCODE_PIXEL_CONVERT_KERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "pixel_convert.hpp"
+#include "xsimd/xsimd.hpp"
+
+namespace image_encode {
+namespace pixel_detail {
+// 各文件的指令集不同, 内联函数不能跨文件合并, 否则可能用到 cpu 不支持的指令
+namespace {
+
+inline void ScalarToBgr(const unsigned char* src, unsigned char* dst,
+                        std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i, src += 4, dst += 3) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+  }
+}
+
+inline void ScalarToRgb(const unsigned char* src, unsigned char* dst,
+                        std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i, src += 4, dst += 3) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+  }
+}
+
+inline void ScalarToRgba(const unsigned char* src, unsigned char* dst,
+                         std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i, src += 4, dst += 4) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+    dst[3] = src[3];
+  }
+}
+
+inline void ScalarToPlanar(const unsigned char* src, unsigned char* b,
+                           unsigned char* g, unsigned char* r, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i, src += 4) {
+    b[i] = src[0];
+    g[i] = src[1];
+    r[i] = src[2];
+  }
+}
+
+// 字节掩码按 16 字节一组生成, 0x80 表示该字节置零
+struct BgrMask {
+  static constexpr uint8_t get(std::size_t i, std::size_t) {
+    return i % 16 < 12 ? i % 16 / 3 * 4 + i % 16 % 3 : 0x80;
+  }
+};
+
+struct RgbMask {
+  static constexpr uint8_t get(std::size_t i, std::size_t) {
+    return i % 16 < 12 ? i % 16 / 3 * 4 + 2 - i % 16 % 3 : 0x80;
+  }
+};
+
+struct RgbaMask {
+  static constexpr uint8_t get(std::size_t i, std::size_t) {
+    return i % 16 / 4 * 4 + (i % 4 == 3 ? 3 : 2 - i % 4);
+  }
+};
+
+// 每 16 字节变为 bbbb gggg rrrr aaaa
+struct PlanarMask {
+  static constexpr uint8_t get(std::size_t i, std::size_t) {
+    return i % 16 / 4 + i % 4 * 4;
+  }
+};
+
+// 32 位排列: 把每 16 字节中的前 12 字节拼接到一起
+struct PackLanes {
+  static constexpr uint32_t get(std::size_t i, std::size_t n) {
+    return i < n / 4 * 3 ? i / 3 * 4 + i % 3 : 0;
+  }
+};
+
+// 32 位排列: 同一分量拼接到一起, 得到 b... g... r... a...
+struct GatherLanes {
+  static constexpr uint32_t get(std::size_t i, std::size_t n) {
+    return i % (n / 4) * 4 + i / (n / 4);
+  }
+};
+
+// 只在每 16 字节内重排, 对应 pshufb
+template <class A>
+inline xsimd::batch<uint8_t, A> ShuffleBytes(xsimd::batch<uint8_t, A> v,
+                                             xsimd::batch<uint8_t, A> mask) {
+  return xsimd::swizzle(v, mask);
+}
+
+#if XSIMD_WITH_AVX2
+// xsimd 没有 avx2 的字节 swizzle, 通用实现会逐字节处理
+inline xsimd::batch<uint8_t, xsimd::avx2> ShuffleBytes(
+    xsimd::batch<uint8_t, xsimd::avx2> v,
+    xsimd::batch<uint8_t, xsimd::avx2> mask) {
+  return _mm256_shuffle_epi8(v, mask);
+}
+#endif
+
+template <class A, class G>
+inline xsimd::batch<uint8_t, A> PermuteLanes(xsimd::batch<uint8_t, A> v) {
+  using u32 = xsimd::batch<uint32_t, A>;
+  if constexpr (u32::size == 4) {
+    return v;
+  } else {
+    return xsimd::bitwise_cast<uint8_t>(xsimd::swizzle(
+        xsimd::bitwise_cast<uint32_t>(v),
+        xsimd::make_batch_constant<u32, G>()));
+  }
+}
+
+// 每次写入一整个向量但只前进 3/4, 多写的部分由下一次覆盖
+template <class A, class Mask>
+inline std::size_t Pack3(const unsigned char* src, unsigned char* dst,
+                         std::size_t n) {
+  using u8 = xsimd::batch<uint8_t, A>;
+  constexpr std::size_t step = u8::size / 4;
+  const u8 mask = xsimd::make_batch_constant<u8, Mask>();
+  std::size_t i = 0;
+  for (; i * 3 + u8::size <= n * 3; i += step) {
+    u8 v = ShuffleBytes(u8::load_unaligned(src + i * 4), mask);
+    PermuteLanes<A, PackLanes>(v).store_unaligned(dst + i * 3);
+  }
+  return i;
+}
+
+template <class A>
+void ToBgr(const unsigned char* src, unsigned char* dst, std::size_t n) {
+  std::size_t i = Pack3<A, BgrMask>(src, dst, n);
+  ScalarToBgr(src + i * 4, dst + i * 3, n - i);
+}
+
+template <class A>
+void ToRgb(const unsigned char* src, unsigned char* dst, std::size_t n) {
+  std::size_t i = Pack3<A, RgbMask>(src, dst, n);
+  ScalarToRgb(src + i * 4, dst + i * 3, n - i);
+}
+
+template <class A>
+void ToRgba(const unsigned char* src, unsigned char* dst, std::size_t n) {
+  using u8 = xsimd::batch<uint8_t, A>;
+  constexpr std::size_t step = u8::size / 4;
+  const u8 mask = xsimd::make_batch_constant<u8, RgbaMask>();
+  std::size_t i = 0;
+  for (; i + step <= n; i += step) {
+    ShuffleBytes(u8::load_unaligned(src + i * 4), mask)
+        .store_unaligned(dst + i * 4);
+  }
+  ScalarToRgba(src + i * 4, dst + i * 4, n - i);
+}
+
+// 四个向量做 4x4 的 32 位转置, 每个平面写满一整个向量
+template <class A>
+void ToPlanar(const unsigned char* src, unsigned char* b, unsigned char* g,
+              unsigned char* r, std::size_t n) {
+  using u8 = xsimd::batch<uint8_t, A>;
+  using u32 = xsimd::batch<uint32_t, A>;
+  using u64 = xsimd::batch<uint64_t, A>;
+  constexpr std::size_t step = u8::size;
+  const u8 mask = xsimd::make_batch_constant<u8, PlanarMask>();
+  std::size_t i = 0;
+  for (; i + step <= n; i += step) {
+    u32 v[4];
+    for (std::size_t k = 0; k < 4; ++k) {
+      u8 p = u8::load_unaligned(src + (i + k * step / 4) * 4);
+      v[k] = xsimd::bitwise_cast<uint32_t>(
+          PermuteLanes<A, GatherLanes>(ShuffleBytes(p, mask)));
+    }
+    u64 t0 = xsimd::bitwise_cast<uint64_t>(xsimd::zip_lo(v[0], v[1]));
+    u64 t1 = xsimd::bitwise_cast<uint64_t>(xsimd::zip_lo(v[2], v[3]));
+    u64 t2 = xsimd::bitwise_cast<uint64_t>(xsimd::zip_hi(v[0], v[1]));
+    u64 t3 = xsimd::bitwise_cast<uint64_t>(xsimd::zip_hi(v[2], v[3]));
+    // 转置后的顺序与 GatherLanes 互逆, 再排列一次恢复像素顺序
+    PermuteLanes<A, GatherLanes>(
+        xsimd::bitwise_cast<uint8_t>(xsimd::zip_lo(t0, t1)))
+        .store_unaligned(b + i);
+    PermuteLanes<A, GatherLanes>(
+        xsimd::bitwise_cast<uint8_t>(xsimd::zip_hi(t0, t1)))
+        .store_unaligned(g + i);
+    PermuteLanes<A, GatherLanes>(
+        xsimd::bitwise_cast<uint8_t>(xsimd::zip_lo(t2, t3)))
+        .store_unaligned(r + i);
+  }
+  ScalarToPlanar(src + i * 4, b + i, g + i, r + i, n - i);
+}
+
+template <class A>
+const PixelKernels* MakeKernels() {
+  static const PixelKernels kernels = {ToBgr<A>, ToRgb<A>, ToRgba<A>,
+                                       ToPlanar<A>};
+  return &kernels;
+}
+
+}  // namespace
+
+const PixelKernels* Sse41Kernels();
+const PixelKernels* Avx2Kernels();
+const PixelKernels* Avx512Kernels();
+
+}  // namespace pixel_detail
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_PIXEL_CONVERT_KERNELS_HPP_
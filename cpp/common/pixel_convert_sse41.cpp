@@ -0,0 +1,17 @@
+// sse4_1 像素格式转换, 编译选项见 CMakeLists.txt
+
+#include "pixel_convert_kernels.hpp"
+
+namespace image_encode {
+namespace pixel_detail {
+
+const PixelKernels* Sse41Kernels() {
+#if XSIMD_WITH_SSE4_1
+  return MakeKernels<xsimd::sse4_1>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace pixel_detail
+}  // namespace image_encode
@@ -0,0 +1,145 @@
+// 图块分类的运行时分发和颜色计数, 标量实现用默认编译选项
+
+#include "tile_classify.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "tile_classify_kernels.hpp"
+
+namespace image_encode {
+
+namespace {
+
+const TileClassifyKernels kScalarKernels = {tile_detail::ScalarRowStatsAll};
+
+// 开放寻址哈希表, 装载率不超过 1/4
+constexpr uint32_t kColorTableBits = 10;
+constexpr uint32_t kColorTableSize = 1u << kColorTableBits;
+
+// 只在每行开头和游程开始处查表, 超过 kTileMaxColors 后立即返回
+uint32_t CountColors(const unsigned char* src, std::size_t pitch,
+                     std::size_t width, std::size_t height) {
+  uint32_t keys[kColorTableSize];
+  bool used[kColorTableSize];
+  std::memset(used, 0, sizeof(used));
+  uint32_t colors = 0;
+  for (std::size_t y = 0; y < height; ++y) {
+    const unsigned char* row = src + y * pitch;
+    uint32_t left = 0;
+    for (std::size_t x = 0; x < width; ++x) {
+      uint32_t p;
+      std::memcpy(&p, row + x * 4, sizeof(p));
+      if (x > 0 && p == left) {
+        continue;
+      }
+      left = p;
+      uint32_t slot = (p * 0x9E3779B1u) >> (32 - kColorTableBits);
+      while (used[slot] && keys[slot] != p) {
+        slot = (slot + 1) & (kColorTableSize - 1);
+      }
+      if (used[slot]) {
+        continue;
+      }
+      if (++colors > kTileMaxColors) {
+        return colors;
+      }
+      used[slot] = true;
+      keys[slot] = p;
+    }
+  }
+  return colors;
+}
+
+}  // namespace
+
+const char* TileClassName(TileClass tile_class) {
+  switch (tile_class) {
+    case TileClass::kFlat:
+      return "flat";
+    case TileClass::kText:
+      return "text";
+    case TileClass::kDetail:
+      return "detail";
+    case TileClass::kPhoto:
+      return "photo";
+  }
+  return "unknown";
+}
+
+const TileClassifyKernels* GetTileClassifyKernels(PixelIsa isa) {
+  static const xsimd::detail::supported_arch cpu =
+      xsimd::available_architectures();
+  switch (isa) {
+    case PixelIsa::kScalar:
+      return &kScalarKernels;
+    case PixelIsa::kSse41:
+      return cpu.sse4_1 ? tile_detail::Sse41Kernels() : nullptr;
+    case PixelIsa::kAvx2:
+      return cpu.avx2 ? tile_detail::Avx2Kernels() : nullptr;
+    case PixelIsa::kAvx512:
+      return cpu.avx512cd && cpu.avx512dq && cpu.avx512bw
+                 ? tile_detail::Avx512Kernels()
+                 : nullptr;
+  }
+  return nullptr;
+}
+
+TileClassifier::TileClassifier(PixelIsa isa, const TileThresholds& thresholds)
+    : isa_(isa),
+      kernels_(GetTileClassifyKernels(isa)),
+      thresholds_(thresholds) {}
+
+int TileClassifier::Measure(const unsigned char* src, int pitch, int width,
+                            int height, int tile_size, TileStats* out,
+                            bool count_colors) const {
+  if (kernels_ == nullptr || width <= 0 || height <= 0 || tile_size <= 0) {
+    return -1;
+  }
+  std::size_t w = width;
+  std::size_t h = height;
+  std::size_t size = tile_size;
+  std::size_t step = pitch ? pitch : w * 4;
+  std::size_t cols = (w + size - 1) / size;
+  std::vector<uint32_t> runs(cols);
+  std::vector<uint32_t> edges(cols);
+  for (std::size_t top = 0; top < h; top += size) {
+    std::size_t rows = std::min(size, h - top);
+    std::fill(runs.begin(), runs.end(), 0);
+    std::fill(edges.begin(), edges.end(), 0);
+    for (std::size_t y = top; y < top + rows; ++y) {
+      const unsigned char* row = src + y * step;
+      kernels_->row_stats(row, y > 0 ? row - step : row, w, size,
+                          thresholds_.edge_gradient, runs.data(),
+                          edges.data());
+    }
+    for (std::size_t k = 0; k < cols; ++k) {
+      std::size_t columns = std::min(size, w - k * size);
+      TileStats& stats = out[top / size * cols + k];
+      stats = {static_cast<uint32_t>(columns * rows), runs[k], edges[k], 0};
+      // 平坦区域不需要颜色数, 跳过标量的查表
+      if (count_colors && !IsFlat(stats)) {
+        stats.colors = CountColors(src + top * step + k * size * 4, step,
+                                   columns, rows);
+      }
+    }
+  }
+  return 0;
+}
+
+TileClass TileClassifier::Classify(const TileStats& stats) const {
+  if (IsFlat(stats)) {
+    return TileClass::kFlat;
+  }
+  if (stats.colors <= static_cast<uint32_t>(thresholds_.text_colors)) {
+    return TileClass::kText;
+  }
+  if (static_cast<uint64_t>(stats.edges) * 100 >=
+      static_cast<uint64_t>(stats.pixels) * thresholds_.detail_edges) {
+    return TileClass::kDetail;
+  }
+  return TileClass::kPhoto;
+}
+
+}  // namespace image_encode
@@ -0,0 +1,97 @@
+// 按内容对图块分类: 平坦的 UI 区域, 颜色少的文字和图形, 边缘多的细节图像, 照片
+//
+// 每个图块统计游程数 (与左侧像素不同的像素数), 边缘像素数 (亮度与左侧和上方的
+// 梯度之和超过阈值) 和颜色数. 游程和边缘按整行用 SIMD 统计, 一次得到一行中
+// 所有图块的计数; 颜色数只在游程开始处查表, 超过 kTileMaxColors 后不再计数.
+
+#ifndef IMAGE_ENCODE_TILE_CLASSIFY_HPP_
+#define IMAGE_ENCODE_TILE_CLASSIFY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pixel_convert.hpp"
+
+namespace image_encode {
+
+enum class TileClass : uint8_t {
+  kFlat = 0,
+  kText = 1,
+  kDetail = 2,
+  kPhoto = 3,
+};
+
+constexpr int kTileClasses = 4;
+constexpr uint32_t kTileMaxColors = 256;
+
+const char* TileClassName(TileClass tile_class);
+
+struct TileStats {
+  uint32_t pixels;
+  uint32_t runs;    // 左侧像素在相邻图块时也参与比较, 整行的第一个像素算一个
+  uint32_t edges;
+  uint32_t colors;  // 超过 kTileMaxColors 时为 kTileMaxColors + 1, 平坦时为 0
+};
+
+// 各指令集编译的内核, 与 PixelKernels 使用相同的运行时选择
+struct TileClassifyKernels {
+  // 一行 BGRA 按 segment 个像素分段, 第 k 段中与左侧不同的像素数累加到
+  // runs[k], 与左侧和 above 中上方像素的亮度梯度之和超过 threshold 的像素数
+  // 累加到 edges[k]. 第一个像素没有左侧像素, 算一个游程, 只计算垂直梯度
+  void (*row_stats)(const unsigned char* row, const unsigned char* above,
+                    std::size_t n, std::size_t segment, int threshold,
+                    uint32_t* runs, uint32_t* edges);
+};
+
+// 编译进来且当前 CPU 支持时返回对应实现, 否则返回 nullptr
+const TileClassifyKernels* GetTileClassifyKernels(PixelIsa isa);
+
+// 按顺序判断: 平坦 -> 文字 -> 细节 -> 照片
+struct TileThresholds {
+  int flat_run = 32;       // 平均游程长度不小于该值为平坦区域
+  int text_colors = 128;   // 颜色数不超过该值为文字和图形
+  int edge_gradient = 64;  // 亮度梯度之和超过该值为边缘像素
+  int detail_edges = 10;   // 边缘像素的百分比不小于该值为细节图像
+};
+
+// 只读, 可以在多个线程同时使用
+class TileClassifier {
+ public:
+  explicit TileClassifier(PixelIsa isa = BestPixelIsa(),
+                          const TileThresholds& thresholds = TileThresholds());
+
+  // 把 width x height 的区域按 tile_size 切成图块, 按行优先输出每个图块的
+  // 统计, pitch 为 0 时按 width * 4 紧密排列, 成功返回 0.
+  // 区域的第一行没有上方像素, 只统计水平梯度. count_colors 为 false 时
+  // colors 为 0, 由调用者统计后再分类, 避免与调色板编码重复扫描
+  int Measure(const unsigned char* src, int pitch, int width, int height,
+              int tile_size, TileStats* out, bool count_colors = true) const;
+
+  TileClass Classify(const TileStats& stats) const;
+
+  PixelIsa isa() const {
+    return isa_;
+  }
+
+  bool valid() const {
+    return kernels_ != nullptr;
+  }
+
+  const TileThresholds& thresholds() const {
+    return thresholds_;
+  }
+
+ private:
+  bool IsFlat(const TileStats& stats) const {
+    return static_cast<uint64_t>(stats.runs) * thresholds_.flat_run <=
+           stats.pixels;
+  }
+
+  PixelIsa isa_;
+  const TileClassifyKernels* kernels_;
+  TileThresholds thresholds_;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_TILE_CLASSIFY_HPP_
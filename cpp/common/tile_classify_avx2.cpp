@@ -0,0 +1,17 @@
+// avx2 图块分类, 编译选项见 CMakeLists.txt
+
+#include "tile_classify_kernels.hpp"
+
+namespace image_encode {
+namespace tile_detail {
+
+const TileClassifyKernels* Avx2Kernels() {
+#if XSIMD_WITH_AVX2
+  return MakeKernels<xsimd::avx2>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace tile_detail
+}  // namespace image_encode
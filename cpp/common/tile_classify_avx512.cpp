@@ -0,0 +1,17 @@
+// avx512bw 图块分类, 编译选项见 CMakeLists.txt
+
+#include "tile_classify_kernels.hpp"
+
+namespace image_encode {
+namespace tile_detail {
+
+const TileClassifyKernels* Avx512Kernels() {
+#if XSIMD_WITH_AVX512BW
+  return MakeKernels<xsimd::avx512bw>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace tile_detail
+}  // namespace image_encode
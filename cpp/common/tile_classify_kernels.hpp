@@ -0,0 +1,127 @@
+// 图块分类内核, 只由 tile_classify*.cpp 包含, 每个文件用各自的指令集编译
+
+#ifndef IMAGE_ENCODE_TILE_CLASSIFY_KERNELS_HPP_
+#define IMAGE_ENCODE_TILE_CLASSIFY_KERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "tile_classify.hpp"
+#include "xsimd/xsimd.hpp"
+
+namespace image_encode {
+namespace tile_detail {
+// 各文件的指令集不同, 内联函数不能跨文件合并, 否则可能用到 cpu 不支持的指令
+namespace {
+
+// 近似亮度 (b + 2g + r) / 4
+inline int32_t Luma(uint32_t p) {
+  return static_cast<int32_t>(
+      ((p & 0xFF) + ((p >> 7) & 0x1FE) + ((p >> 16) & 0xFF)) >> 2);
+}
+
+inline void ScalarRowStats(const unsigned char* row,
+                           const unsigned char* above, std::size_t begin,
+                           std::size_t end, int threshold, uint32_t* runs,
+                           uint32_t* edges) {
+  uint32_t r = 0;
+  uint32_t e = 0;
+  for (std::size_t i = begin; i < end; ++i) {
+    uint32_t p;
+    uint32_t left;
+    uint32_t up;
+    std::memcpy(&p, row + i * 4, sizeof(p));
+    std::memcpy(&left, row + (i - 1) * 4, sizeof(left));
+    std::memcpy(&up, above + i * 4, sizeof(up));
+    int32_t l = Luma(p);
+    r += p != left;
+    e += std::abs(l - Luma(left)) + std::abs(l - Luma(up)) > threshold;
+  }
+  *runs += r;
+  *edges += e;
+}
+
+// 第一个像素单独处理, 之后每段的左侧像素都在行内
+inline void FirstPixel(const unsigned char* row, const unsigned char* above,
+                       int threshold, uint32_t* runs, uint32_t* edges) {
+  uint32_t p;
+  uint32_t up;
+  std::memcpy(&p, row, sizeof(p));
+  std::memcpy(&up, above, sizeof(up));
+  *runs += 1;
+  *edges += std::abs(Luma(p) - Luma(up)) > threshold;
+}
+
+inline void ScalarRowStatsAll(const unsigned char* row,
+                              const unsigned char* above, std::size_t n,
+                              std::size_t segment, int threshold,
+                              uint32_t* runs, uint32_t* edges) {
+  FirstPixel(row, above, threshold, runs, edges);
+  for (std::size_t k = 0, begin = 0; begin < n; ++k, begin += segment) {
+    std::size_t end = begin + segment < n ? begin + segment : n;
+    ScalarRowStats(row, above, begin > 0 ? begin : 1, end, threshold,
+                   runs + k, edges + k);
+  }
+}
+
+template <class A>
+xsimd::batch<int32_t, A> LumaBatch(const xsimd::batch<uint32_t, A>& p) {
+  xsimd::batch<uint32_t, A> luma =
+      ((p & 0xFF) + ((p >> 7) & 0x1FE) + ((p >> 16) & 0xFF)) >> 2;
+  return xsimd::bitwise_cast<int32_t>(luma);
+}
+
+// 段长为向量宽度的整数倍时只有第一段和最后一段有标量的尾部
+template <class A>
+void RowStats(const unsigned char* row, const unsigned char* above,
+              std::size_t n, std::size_t segment, int threshold,
+              uint32_t* runs, uint32_t* edges) {
+  using u32 = xsimd::batch<uint32_t, A>;
+  using i32 = xsimd::batch<int32_t, A>;
+  constexpr std::size_t step = u32::size;
+  const u32 one(1u);
+  const u32 zero(0u);
+  const i32 limit(threshold);
+  const uint32_t* pixels = reinterpret_cast<const uint32_t*>(row);
+  const uint32_t* ups = reinterpret_cast<const uint32_t*>(above);
+  FirstPixel(row, above, threshold, runs, edges);
+  for (std::size_t k = 0, begin = 0; begin < n; ++k, begin += segment) {
+    std::size_t end = begin + segment < n ? begin + segment : n;
+    u32 r = zero;
+    u32 e = zero;
+    std::size_t i = begin > 0 ? begin : 1;
+    for (; i + step <= end; i += step) {
+      u32 p = u32::load_unaligned(pixels + i);
+      u32 left = u32::load_unaligned(pixels + i - 1);
+      u32 up = u32::load_unaligned(ups + i);
+      i32 l = LumaBatch<A>(p);
+      i32 gradient = xsimd::abs(l - LumaBatch<A>(left)) +
+                     xsimd::abs(l - LumaBatch<A>(up));
+      r += xsimd::select(p != left, one, zero);
+      e += xsimd::select(xsimd::batch_bool_cast<uint32_t>(gradient > limit),
+                         one, zero);
+    }
+    runs[k] += xsimd::reduce_add(r);
+    edges[k] += xsimd::reduce_add(e);
+    ScalarRowStats(row, above, i, end, threshold, runs + k, edges + k);
+  }
+}
+
+template <class A>
+const TileClassifyKernels* MakeKernels() {
+  static const TileClassifyKernels kernels = {RowStats<A>};
+  return &kernels;
+}
+
+}  // namespace
+
+const TileClassifyKernels* Sse41Kernels();
+const TileClassifyKernels* Avx2Kernels();
+const TileClassifyKernels* Avx512Kernels();
+
+}  // namespace tile_detail
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_TILE_CLASSIFY_KERNELS_HPP_
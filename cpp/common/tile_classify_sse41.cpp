@@ -0,0 +1,17 @@
+// sse4_1 图块分类, 编译选项见 CMakeLists.txt
+
+#include "tile_classify_kernels.hpp"
+
+namespace image_encode {
+namespace tile_detail {
+
+const TileClassifyKernels* Sse41Kernels() {
+#if XSIMD_WITH_SSE4_1
+  return MakeKernels<xsimd::sse4_1>();
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace tile_detail
+}  // namespace image_encode
@@ -0,0 +1,577 @@
+// 按内容选择编码的图块帧: 平坦的 UI 用 lz4, 文字和图形用 qoi 无损,
+// 细节图像和照片用各自质量的 jpeg, 图块之间互不依赖, 按图块行并行编码/解码
+//
+// 输出格式 (小端): TileFrameHeader, 清单 TileEntry[tiles], 各图块数据.
+// 图块按行优先排列, 数据位于数据区的 [offset, offset + size).
+// qoi 的实现由包含方定义 QOI_IMPLEMENTATION 提供, 找不到 qoi.h 时改用调色板:
+// uint16_t 颜色数, uint32_t 颜色[颜色数], lz4 压缩的 8 位索引.
+// 颜色超过 256 的图块不能用调色板, 改用 lz4 直接压缩像素.
+
+#ifndef IMAGE_ENCODE_TILE_ROUTER_HPP_
+#define IMAGE_ENCODE_TILE_ROUTER_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "codec_context.hpp"
+#include "frame_buffer.hpp"
+#include "lz4.h"
+#include "thread_pool.hpp"
+#include "tile_classify.hpp"
+#include "turbojpeg.h"
+
+#if __has_include("qoi/qoi.h")
+#include "qoi/qoi.h"
+#define IMAGE_ENCODE_HAVE_QOI 1
+#endif
+
+namespace image_encode {
+
+enum class TileCodec : uint8_t { kLz4 = 0, kQoi = 1, kJpeg = 2, kPalette = 3 };
+
+constexpr uint32_t kTileFrameMagic = 0x454C4954;  // "TILE"
+
+struct TileFrameHeader {
+  uint32_t magic;
+  uint32_t width;
+  uint32_t height;
+  uint32_t tile_size;
+  uint32_t tiles;
+};
+
+struct TileEntry {
+  uint8_t codec;
+  uint8_t tile_class;
+  uint8_t quality;  // 无损为 0
+  uint8_t subsamp;
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct TileRoute {
+  TileCodec codec;
+  int quality;
+};
+
+struct TileRouterOptions {
+  int tile_size = 64;  // jpeg 图块最好是 MCU 的整数倍
+  int subsamp = TJSAMP_420;
+  int flags = TJFLAG_FASTDCT;
+  int lz4_acceleration = 1;
+  // 按 TileClass 的顺序
+  std::array<TileRoute, kTileClasses> routes = {{{TileCodec::kLz4, 0},
+                                                 {TileCodec::kQoi, 0},
+                                                 {TileCodec::kJpeg, 90},
+                                                 {TileCodec::kJpeg, 80}}};
+};
+
+inline bool HaveQoi() {
+#ifdef IMAGE_ENCODE_HAVE_QOI
+  return true;
+#else
+  return false;
+#endif
+}
+
+// 每个图块编码输出的上限, 编码时每块先写入这个大小的位置
+inline std::size_t TileSlotSize(int tile_size) {
+  std::size_t raw = static_cast<std::size_t>(tile_size) * tile_size * 4;
+  // qoi 最坏每像素 5 字节, 加 14 字节头和 8 字节结尾
+  std::size_t qoi = raw / 4 * 5 + 22;
+  return std::max({JpegBufSize(tile_size, tile_size, TJSAMP_444),
+                   Lz4Bound(raw), qoi});
+}
+
+inline std::size_t TileFrameBound(int width, int height, int tile_size = 64) {
+  std::size_t cols = (width + tile_size - 1) / tile_size;
+  std::size_t rows = (height + tile_size - 1) / tile_size;
+  return sizeof(TileFrameHeader) +
+         cols * rows * (sizeof(TileEntry) + TileSlotSize(tile_size));
+}
+
+// 解析后的清单, 指向输入数据, 不拷贝
+struct TileFrameIndex {
+  int width;
+  int height;
+  int tile_size;
+  int cols;
+  int rows;
+  const unsigned char* data;  // 数据区开始
+  std::vector<TileEntry> entries;
+
+  int tile_width(int col) const {
+    return std::min(tile_size, width - col * tile_size);
+  }
+
+  int tile_height(int row) const {
+    return std::min(tile_size, height - row * tile_size);
+  }
+};
+
+// 成功返回 0
+inline int ParseTileFrame(const unsigned char* src, std::size_t size,
+                          TileFrameIndex* index) {
+  TileFrameHeader header;
+  if (size < sizeof(header)) {
+    return -1;
+  }
+  std::memcpy(&header, src, sizeof(header));
+  if (header.magic != kTileFrameMagic || header.tile_size == 0 ||
+      header.width == 0 || header.height == 0 ||
+      header.width > 0xFFFF * header.tile_size ||
+      header.height > 0xFFFF * header.tile_size) {
+    return -1;
+  }
+  index->width = header.width;
+  index->height = header.height;
+  index->tile_size = header.tile_size;
+  index->cols = (header.width + header.tile_size - 1) / header.tile_size;
+  index->rows = (header.height + header.tile_size - 1) / header.tile_size;
+  std::size_t tiles = static_cast<std::size_t>(index->cols) * index->rows;
+  std::size_t begin = sizeof(header) + tiles * sizeof(TileEntry);
+  if (header.tiles != tiles || size < begin) {
+    return -1;
+  }
+  index->data = src + begin;
+  index->entries.resize(tiles);
+  std::memcpy(index->entries.data(), src + sizeof(header),
+              tiles * sizeof(TileEntry));
+  for (const TileEntry& entry : index->entries) {
+    if (entry.codec > static_cast<uint8_t>(TileCodec::kPalette) ||
+        static_cast<std::size_t>(entry.offset) + entry.size > size - begin) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// 颜色不超过 max_colors (最多 256) 时输出调色板和 lz4 压缩的索引,
+// 返回输出大小, 否则返回 0. 与左侧像素相同时直接沿用索引, 只在游程开始处查表
+inline std::size_t EncodePalette(CodecContext* context,
+                                 const unsigned char* tile, std::size_t pitch,
+                                 int width, int height, std::size_t max_colors,
+                                 int acceleration,
+                                 unsigned char* dst, std::size_t capacity,
+                                 std::vector<unsigned char>* scratch) {
+  constexpr uint32_t kBits = 10;
+  constexpr uint32_t kSlots = 1u << kBits;
+  uint32_t keys[kSlots];
+  uint8_t values[kSlots];
+  bool used[kSlots];
+  uint32_t palette[256];
+  std::memset(used, 0, sizeof(used));
+  std::size_t colors = 0;
+  std::size_t head = sizeof(uint16_t);
+  scratch->resize(static_cast<std::size_t>(width) * height);
+  unsigned char* indices = scratch->data();
+  for (int y = 0; y < height; y++) {
+    const unsigned char* row = tile + y * pitch;
+    uint32_t left = 0;
+    uint8_t index = 0;
+    for (int x = 0; x < width; x++) {
+      uint32_t p;
+      std::memcpy(&p, row + x * 4, sizeof(p));
+      if (x == 0 || p != left) {
+        uint32_t slot = (p * 0x9E3779B1u) >> (32 - kBits);
+        while (used[slot] && keys[slot] != p) {
+          slot = (slot + 1) & (kSlots - 1);
+        }
+        if (!used[slot]) {
+          if (colors == max_colors || colors == 256) {
+            return 0;
+          }
+          used[slot] = true;
+          keys[slot] = p;
+          values[slot] = static_cast<uint8_t>(colors);
+          palette[colors++] = p;
+        }
+        index = values[slot];
+        left = p;
+      }
+      *indices++ = index;
+    }
+  }
+  head += colors * sizeof(uint32_t);
+  if (capacity <= head) {
+    return 0;
+  }
+  uint16_t count = static_cast<uint16_t>(colors);
+  std::memcpy(dst, &count, sizeof(count));
+  std::memcpy(dst + sizeof(count), palette, colors * sizeof(uint32_t));
+  int ret = context->CompressLz4(
+      reinterpret_cast<const char*>(scratch->data()),
+      reinterpret_cast<char*>(dst + head), static_cast<int>(scratch->size()),
+      static_cast<int>(capacity - head), acceleration);
+  return ret > 0 ? head + ret : 0;
+}
+
+// 成功返回 0
+inline int DecodePalette(const unsigned char* src, std::size_t size,
+                         int width, int height, unsigned char* dst,
+                         std::size_t pitch,
+                         std::vector<unsigned char>* scratch) {
+  uint16_t colors = 0;
+  if (size < sizeof(colors)) {
+    return -1;
+  }
+  std::memcpy(&colors, src, sizeof(colors));
+  std::size_t head = sizeof(colors) + colors * sizeof(uint32_t);
+  if (colors == 0 || colors > 256 || size < head) {
+    return -1;
+  }
+  uint32_t palette[256];
+  std::memcpy(palette, src + sizeof(colors), colors * sizeof(uint32_t));
+  scratch->resize(static_cast<std::size_t>(width) * height);
+  int ret = LZ4_decompress_safe(reinterpret_cast<const char*>(src + head),
+                                reinterpret_cast<char*>(scratch->data()),
+                                static_cast<int>(size - head),
+                                static_cast<int>(scratch->size()));
+  if (ret != static_cast<int>(scratch->size())) {
+    return -1;
+  }
+  const unsigned char* indices = scratch->data();
+  for (int y = 0; y < height; y++) {
+    unsigned char* row = dst + y * pitch;
+    for (int x = 0; x < width; x++) {
+      uint8_t index = *indices++;
+      if (index >= colors) {
+        return -1;
+      }
+      std::memcpy(row + x * 4, &palette[index], sizeof(uint32_t));
+    }
+  }
+  return 0;
+}
+
+// 解码第 i 个图块到 dst 中对应的位置, pitch 为整帧的行字节数, 成功返回 0
+inline int DecodeTile(CodecContext* context, const TileFrameIndex& index,
+                      std::size_t i, unsigned char* dst, std::size_t pitch,
+                      std::vector<unsigned char>* scratch) {
+  const TileEntry& entry = index.entries[i];
+  int col = static_cast<int>(i % index.cols);
+  int row = static_cast<int>(i / index.cols);
+  int width = index.tile_width(col);
+  int height = index.tile_height(row);
+  std::size_t line = static_cast<std::size_t>(width) * 4;
+  const unsigned char* src = index.data + entry.offset;
+  unsigned char* out = dst + static_cast<std::size_t>(row) * index.tile_size *
+                                 pitch +
+                       static_cast<std::size_t>(col) * index.tile_size * 4;
+
+  // jpeg 和调色板直接按整帧的 pitch 写入
+  if (entry.codec == static_cast<uint8_t>(TileCodec::kJpeg)) {
+    // 尺寸与图块不一致时会写到图块之外, 最后一行或一列会写到帧之外
+    tjhandle tjd = context->tjd();
+    if (tj3DecompressHeader(tjd, src, entry.size) != 0 ||
+        tj3Get(tjd, TJPARAM_JPEGWIDTH) != width ||
+        tj3Get(tjd, TJPARAM_JPEGHEIGHT) != height) {
+      return -1;
+    }
+    return context->DecompressJpeg(src, entry.size, out,
+                                   static_cast<int>(pitch), TJPF_BGRA, 0);
+  }
+  if (entry.codec == static_cast<uint8_t>(TileCodec::kPalette)) {
+    return DecodePalette(src, entry.size, width, height, out, pitch, scratch);
+  }
+
+  const unsigned char* pixels = nullptr;
+  void* decoded = nullptr;
+  if (entry.codec == static_cast<uint8_t>(TileCodec::kLz4)) {
+    scratch->resize(line * height);
+    int ret = LZ4_decompress_safe(reinterpret_cast<const char*>(src),
+                                  reinterpret_cast<char*>(scratch->data()),
+                                  static_cast<int>(entry.size),
+                                  static_cast<int>(scratch->size()));
+    if (ret != static_cast<int>(scratch->size())) {
+      return -1;
+    }
+    pixels = scratch->data();
+  } else {
+#ifdef IMAGE_ENCODE_HAVE_QOI
+    qoi_desc desc;
+    decoded = qoi_decode(src, static_cast<int>(entry.size), &desc, 4);
+    if (decoded == nullptr || desc.width != static_cast<unsigned>(width) ||
+        desc.height != static_cast<unsigned>(height)) {
+      free(decoded);
+      return -1;
+    }
+    pixels = static_cast<const unsigned char*>(decoded);
+#else
+    return -1;
+#endif
+  }
+  for (int y = 0; y < height; y++) {
+    std::memcpy(out + y * pitch, pixels + y * line, line);
+  }
+  free(decoded);
+  return 0;
+}
+
+class TileRouter {
+ public:
+  // pool 为空时在调用线程编码/解码
+  TileRouter(thread_pool::ThreadPool* pool, CodecContextPool* contexts,
+             const TileClassifier* classifier)
+      : pool_(pool), contexts_(contexts), classifier_(classifier) {}
+
+  TileRouter(const TileRouter&) = delete;
+  TileRouter& operator=(const TileRouter&) = delete;
+
+  // 输入为 BGRA, pitch 为 0 时紧密排列. 每块先写入 out 中按 TileSlotSize()
+  // 划分的位置, 全部完成后再向前紧凑排列, 成功返回 0
+  int Encode(const unsigned char* src, int width, int pitch, int height,
+             const TileRouterOptions& options, FrameBuffer* out) {
+    int tile_size = options.tile_size;
+    if (tile_size <= 0 || width <= 0 || height <= 0 ||
+        !classifier_->valid()) {
+      error_ = "invalid tile size or classifier";
+      return -1;
+    }
+    std::size_t step = pitch ? pitch : static_cast<std::size_t>(width) * 4;
+    int cols = (width + tile_size - 1) / tile_size;
+    int rows = (height + tile_size - 1) / tile_size;
+    std::size_t tiles = static_cast<std::size_t>(cols) * rows;
+    std::size_t slot = TileSlotSize(tile_size);
+    if (!out->Reserve(TileFrameBound(width, height, tile_size))) {
+      error_ = "out of memory";
+      return -1;
+    }
+    std::size_t begin = sizeof(TileFrameHeader) + tiles * sizeof(TileEntry);
+    unsigned char* data = out->data() + begin;
+    entries_.resize(tiles);
+    stats_.resize(tiles);
+    palette_text_ = Route(options, TileClass::kText).codec ==
+                    TileCodec::kPalette;
+
+    // 一个图块行整行统计, 比逐个图块统计的向量循环更长
+    bool ok = ForRows(rows, [&](int row) {
+      std::vector<unsigned char> scratch;
+      CodecContext& context = contexts_->Get();
+      int y = row * tile_size;
+      int band = std::min(tile_size, height - y);
+      std::size_t first = static_cast<std::size_t>(row) * cols;
+      if (classifier_->Measure(src + y * step, static_cast<int>(step), width,
+                               band, tile_size, &stats_[first],
+                               !palette_text_) != 0) {
+        return false;
+      }
+      for (int col = 0; col < cols; col++) {
+        std::size_t i = first + col;
+        int x = col * tile_size;
+        const unsigned char* tile = src + y * step + x * 4;
+        if (!EncodeTile(&context, tile, step, std::min(tile_size, width - x),
+                        band, stats_[i], options, data + i * slot, slot,
+                        &entries_[i], &scratch)) {
+          return false;
+        }
+      }
+      return true;
+    });
+    if (!ok) {
+      error_ = "tile encode failed";
+      return -1;
+    }
+
+    // 目标位置不会超过源位置, 按顺序移动不会覆盖未移动的图块
+    class_counts_.fill(0);
+    class_bytes_.fill(0);
+    uint32_t offset = 0;
+    for (std::size_t i = 0; i < tiles; i++) {
+      TileEntry& entry = entries_[i];
+      std::memmove(data + offset, data + i * slot, entry.size);
+      entry.offset = offset;
+      offset += entry.size;
+      class_counts_[entry.tile_class]++;
+      class_bytes_[entry.tile_class] += entry.size;
+    }
+
+    TileFrameHeader header = {kTileFrameMagic, static_cast<uint32_t>(width),
+                              static_cast<uint32_t>(height),
+                              static_cast<uint32_t>(tile_size),
+                              static_cast<uint32_t>(tiles)};
+    std::memcpy(out->data(), &header, sizeof(header));
+    std::memcpy(out->data() + sizeof(header), entries_.data(),
+                tiles * sizeof(TileEntry));
+    out->set_size(begin + offset);
+    return 0;
+  }
+
+  // 输出 BGRA 写入 dst, pitch 为 0 时紧密排列, dst 至少为 pitch * 高度
+  int Decode(const unsigned char* src, std::size_t size, unsigned char* dst,
+             int pitch) {
+    TileFrameIndex index;
+    if (ParseTileFrame(src, size, &index) != 0) {
+      error_ = "invalid tile frame";
+      return -1;
+    }
+    std::size_t step =
+        pitch ? pitch : static_cast<std::size_t>(index.width) * 4;
+    const TileFrameIndex* shared = &index;
+    bool ok = ForRows(index.rows, [&](int row) {
+      std::vector<unsigned char> scratch;
+      CodecContext* context = &contexts_->Get();
+      for (int col = 0; col < shared->cols; col++) {
+        std::size_t i = static_cast<std::size_t>(row) * shared->cols + col;
+        if (DecodeTile(context, *shared, i, dst, step, &scratch) != 0) {
+          return false;
+        }
+      }
+      return true;
+    });
+    if (!ok) {
+      error_ = "tile decode failed";
+      return -1;
+    }
+    return 0;
+  }
+
+  // 最近一次 Encode() 各类图块的数量和编码后的字节数, 按 TileClass 的顺序
+  const std::array<std::size_t, kTileClasses>& class_counts() const {
+    return class_counts_;
+  }
+
+  const std::array<std::size_t, kTileClasses>& class_bytes() const {
+    return class_bytes_;
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+ private:
+  static TileRoute Route(const TileRouterOptions& options,
+                         TileClass tile_class) {
+    TileRoute route = options.routes[static_cast<int>(tile_class)];
+    if (route.codec == TileCodec::kQoi && !HaveQoi()) {
+      route.codec = TileCodec::kPalette;
+    }
+    return route;
+  }
+
+  // 每个图块行一个任务, 全部成功返回 true
+  template <class Fn>
+  bool ForRows(int rows, const Fn& fn) {
+    if (pool_ == nullptr || pool_->num_threads() <= 1) {
+      bool ok = true;
+      for (int row = 0; row < rows; row++) {
+        ok = fn(row) && ok;
+      }
+      return ok;
+    }
+    std::atomic<bool> ok(true);
+    pool_->ParallelFor(0, rows, 1, [&](std::size_t first, std::size_t last) {
+      for (std::size_t row = first; row < last; row++) {
+        if (!fn(static_cast<int>(row))) {
+          ok = false;
+        }
+      }
+    });
+    return ok;
+  }
+
+  // lz4 和 qoi 需要连续的像素, 先把图块的各行拷贝到 scratch,
+  // 调色板的颜色超过 256 时改用 lz4
+  bool EncodeTile(CodecContext* context, const unsigned char* tile,
+                  std::size_t pitch, int width, int height,
+                  const TileStats& stats, const TileRouterOptions& options,
+                  unsigned char* dst, std::size_t capacity, TileEntry* entry,
+                  std::vector<unsigned char>* scratch) {
+    TileClass tile_class = classifier_->Classify(stats);
+    // 文字用调色板时没有统计颜色数, 非平坦图块按文字的颜色上限编码调色板,
+    // 成功即为文字, 否则颜色数超过上限, 重新分类. 文字图块只扫描一遍
+    if (palette_text_ && tile_class == TileClass::kText) {
+      std::size_t size = EncodePalette(
+          context, tile, pitch, width, height,
+          static_cast<std::size_t>(classifier_->thresholds().text_colors),
+          options.lz4_acceleration, dst, capacity, scratch);
+      if (size > 0) {
+        *entry = {static_cast<uint8_t>(TileCodec::kPalette),
+                  static_cast<uint8_t>(tile_class), 0,
+                  static_cast<uint8_t>(options.subsamp), 0,
+                  static_cast<uint32_t>(size)};
+        return true;
+      }
+      TileStats counted = stats;
+      counted.colors = kTileMaxColors + 1;
+      tile_class = classifier_->Classify(counted);
+    }
+    TileRoute route = Route(options, tile_class);
+    *entry = {static_cast<uint8_t>(route.codec),
+              static_cast<uint8_t>(tile_class), 0,
+              static_cast<uint8_t>(options.subsamp), 0, 0};
+
+    if (route.codec == TileCodec::kJpeg) {
+      std::size_t size = 0;
+      entry->quality = static_cast<uint8_t>(route.quality);
+      if (context->CompressJpeg(tile, width, static_cast<int>(pitch), height,
+                                TJPF_BGRA, options.subsamp, route.quality,
+                                options.flags, dst, capacity, &size) != 0) {
+        return false;
+      }
+      entry->size = static_cast<uint32_t>(size);
+      return true;
+    }
+    if (route.codec == TileCodec::kPalette) {
+      std::size_t size =
+          EncodePalette(context, tile, pitch, width, height, kTileMaxColors,
+                        options.lz4_acceleration, dst, capacity, scratch);
+      if (size > 0) {
+        entry->size = static_cast<uint32_t>(size);
+        return true;
+      }
+      entry->codec = static_cast<uint8_t>(TileCodec::kLz4);
+      route.codec = TileCodec::kLz4;
+    }
+
+    std::size_t line = static_cast<std::size_t>(width) * 4;
+    scratch->resize(line * height);
+    for (int y = 0; y < height; y++) {
+      std::memcpy(scratch->data() + y * line, tile + y * pitch, line);
+    }
+    if (route.codec == TileCodec::kLz4) {
+      int ret = context->CompressLz4(
+          reinterpret_cast<const char*>(scratch->data()),
+          reinterpret_cast<char*>(dst), static_cast<int>(scratch->size()),
+          static_cast<int>(capacity), options.lz4_acceleration);
+      entry->size = ret > 0 ? ret : 0;
+      return ret > 0;
+    }
+#ifdef IMAGE_ENCODE_HAVE_QOI
+    // qoi 把 BGRA 当作 RGBA 编码, 解码时原样取回
+    qoi_desc desc = {static_cast<unsigned>(width),
+                     static_cast<unsigned>(height), 4, QOI_SRGB};
+    int size = 0;
+    void* encoded = qoi_encode(scratch->data(), &desc, &size);
+    bool ok = encoded != nullptr && static_cast<std::size_t>(size) <= capacity;
+    if (ok) {
+      std::memcpy(dst, encoded, size);
+      entry->size = size;
+    }
+    free(encoded);
+    return ok;
+#else
+    return false;
+#endif
+  }
+
+  thread_pool::ThreadPool* pool_;
+  CodecContextPool* contexts_;
+  const TileClassifier* classifier_;
+  std::vector<TileEntry> entries_;
+  std::vector<TileStats> stats_;
+  bool palette_text_ = false;
+  std::array<std::size_t, kTileClasses> class_counts_ = {};
+  std::array<std::size_t, kTileClasses> class_bytes_ = {};
+  std::string error_;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_TILE_ROUTER_HPP_
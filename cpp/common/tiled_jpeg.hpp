@@ -0,0 +1,189 @@
+// 按 MCU 行把帧切成水平条带并行编码, 再用重启标记 (RSTn) 拼接成一个标准 JPEG
+//
+// 每个条带单独编码时哈夫曼表和量化表完全相同, DC 预测从 0 开始, 结尾按字节补齐,
+// 与重启间隔的边界一致. 拼接时取第一个条带的头部, 修改 SOF 中的高度,
+// 插入 DRI (间隔 = 每个条带的 MCU 数), 条带之间插入 RST0..RST7.
+
+#ifndef IMAGE_ENCODE_TILED_JPEG_HPP_
+#define IMAGE_ENCODE_TILED_JPEG_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "codec_context.hpp"
+#include "frame_buffer.hpp"
+#include "thread_pool.hpp"
+#include "turbojpeg.h"
+
+namespace image_encode {
+
+class TiledJpegEncoder {
+ public:
+  TiledJpegEncoder(thread_pool::ThreadPool* pool, CodecContextPool* contexts,
+                   FrameBufferPool* buffers)
+      : pool_(pool), contexts_(contexts), buffers_(buffers) {}
+
+  TiledJpegEncoder(const TiledJpegEncoder&) = delete;
+  TiledJpegEncoder& operator=(const TiledJpegEncoder&) = delete;
+
+  // strips 为 0 时按线程数切分, 成功返回 0, 失败返回 -1 并设置 error()
+  int Encode(const unsigned char* src, int width, int pitch, int height,
+             int pixel_format, int subsamp, int quality, int flags,
+             FrameBuffer* out, int strips = 0) {
+    if (pitch == 0) {
+      pitch = width * tjPixelSize[pixel_format];
+    }
+    const int mcu_width = tjMCUWidth[subsamp];
+    const int mcu_height = tjMCUHeight[subsamp];
+    const int mcu_cols = (width + mcu_width - 1) / mcu_width;
+    const int mcu_rows = (height + mcu_height - 1) / mcu_height;
+    if (strips <= 0) {
+      strips = static_cast<int>(pool_->num_threads());
+    }
+    const int rows_per_strip = (mcu_rows + strips - 1) / strips;
+    const int restart_interval = mcu_cols * rows_per_strip;
+    if (restart_interval > 0xFFFF) {
+      error_ = "restart interval exceeds 65535 MCUs, use more strips";
+      return -1;
+    }
+    strips = (mcu_rows + rows_per_strip - 1) / rows_per_strip;
+
+    // 渐进式和哈夫曼优化会让各条带的表不一致
+    flags &= ~TJFLAG_PROGRESSIVE;
+
+    std::vector<FrameBuffer> parts;
+    parts.reserve(strips);
+    for (int i = 0; i < strips; i++) {
+      int y = i * rows_per_strip * mcu_height;
+      int h = std::min(rows_per_strip * mcu_height, height - y);
+      parts.emplace_back(buffers_->Acquire(JpegBufSize(width, h, subsamp)));
+    }
+    std::atomic<bool> ok(true);
+    pool_->ParallelFor(0, strips, 1, [&](std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; i++) {
+        int y = static_cast<int>(i) * rows_per_strip * mcu_height;
+        int h = std::min(rows_per_strip * mcu_height, height - y);
+        const unsigned char* strip = src + static_cast<size_t>(y) * pitch;
+        if (contexts_->Get().CompressJpeg(strip, width, pitch, h, pixel_format,
+                                          subsamp, quality, flags,
+                                          &parts[i]) != 0) {
+          ok = false;
+        }
+      }
+    });
+    if (!ok) {
+      error_ = "strip encode failed";
+      return -1;
+    }
+    return Stitch(parts, height, restart_interval, out);
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+ private:
+  struct Layout {
+    size_t sof;       // SOFn 标记的位置
+    size_t sos;       // SOS 标记的位置
+    size_t scan;      // SOS 段之后熵编码数据的起始位置
+    size_t scan_end;  // EOI 标记的位置
+  };
+
+  bool Parse(const FrameBuffer& part, Layout* layout) {
+    const unsigned char* data = part.data();
+    size_t size = part.size();
+    size_t pos = 2;
+    layout->sof = 0;
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+      return false;
+    }
+    while (pos + 4 <= size) {
+      if (data[pos] != 0xFF) {
+        return false;
+      }
+      unsigned char marker = data[pos + 1];
+      size_t length = (data[pos + 2] << 8) | data[pos + 3];
+      if (marker == 0xC0 || marker == 0xC1) {
+        layout->sof = pos;
+      } else if (marker == 0xDD || (marker >= 0xC2 && marker <= 0xCF &&
+                                    marker != 0xC4 && marker != 0xC8 &&
+                                    marker != 0xCC)) {
+        return false;  // 只支持不带重启间隔的顺序式哈夫曼编码
+      }
+      if (marker == 0xDA) {
+        layout->sos = pos;
+        layout->scan = pos + 2 + length;
+        layout->scan_end = size - 2;
+        return layout->sof != 0 && layout->scan <= layout->scan_end &&
+               data[size - 2] == 0xFF && data[size - 1] == 0xD9;
+      }
+      pos += 2 + length;
+    }
+    return false;
+  }
+
+  int Stitch(const std::vector<FrameBuffer>& parts, int height,
+             int restart_interval, FrameBuffer* out) {
+    std::vector<Layout> layouts(parts.size());
+    size_t total = 0;
+    for (size_t i = 0; i < parts.size(); i++) {
+      if (!Parse(parts[i], &layouts[i])) {
+        error_ = "unexpected strip layout";
+        return -1;
+      }
+      total += layouts[i].scan_end - layouts[i].scan + 2;
+    }
+    const FrameBuffer& first = parts[0];
+    const Layout& head = layouts[0];
+    total += head.scan + 6;
+    if (!out->Reserve(total)) {
+      error_ = "out of memory";
+      return -1;
+    }
+
+    unsigned char* dst = out->data();
+    size_t pos = 0;
+    // SOI 到 SOS 之前的所有段, 在 SOS 前插入 DRI
+    std::memcpy(dst, first.data(), head.sos);
+    dst[head.sof + 5] = static_cast<unsigned char>(height >> 8);
+    dst[head.sof + 6] = static_cast<unsigned char>(height & 0xFF);
+    pos = head.sos;
+    const unsigned char dri[6] = {
+        0xFF, 0xDD, 0x00, 0x04,
+        static_cast<unsigned char>(restart_interval >> 8),
+        static_cast<unsigned char>(restart_interval & 0xFF)};
+    std::memcpy(dst + pos, dri, sizeof(dri));
+    pos += sizeof(dri);
+    std::memcpy(dst + pos, first.data() + head.sos, head.scan - head.sos);
+    pos += head.scan - head.sos;
+
+    for (size_t i = 0; i < parts.size(); i++) {
+      if (i > 0) {
+        dst[pos++] = 0xFF;
+        dst[pos++] = static_cast<unsigned char>(0xD0 + ((i - 1) & 7));
+      }
+      const Layout& layout = layouts[i];
+      size_t length = layout.scan_end - layout.scan;
+      std::memcpy(dst + pos, parts[i].data() + layout.scan, length);
+      pos += length;
+    }
+    dst[pos++] = 0xFF;
+    dst[pos++] = 0xD9;
+    out->set_size(pos);
+    return 0;
+  }
+
+  thread_pool::ThreadPool* pool_;
+  CodecContextPool* contexts_;
+  FrameBufferPool* buffers_;
+  std::string error_;
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_TILED_JPEG_HPP_
@@ -0,0 +1,225 @@
+// 帧间 zstd 压缩: 以上一帧作为前缀 (ZSTD_CCtx_refPrefix), 并开启长距离匹配
+//
+// 窗口覆盖前缀和当前帧, 上一帧同位置的数据正好在一帧大小之前.
+// 前缀只对下一次压缩有效, 同一帧可以重复压缩而不改变参考帧.
+//
+// 输出格式 (小端): ZstdSequenceHeader, 一个标准 zstd 帧
+
+#ifndef IMAGE_ENCODE_ZSTD_SEQUENCE_HPP_
+#define IMAGE_ENCODE_ZSTD_SEQUENCE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "frame_buffer.hpp"
+#include "zstd.h"
+
+namespace image_encode {
+
+struct ZstdSequenceHeader {
+  uint32_t frame_size;
+  uint32_t keyframe;  // 1 表示不参考上一帧
+};
+
+inline std::size_t ZstdSequenceBound(std::size_t frame_size) {
+  return sizeof(ZstdSequenceHeader) + ZstdBound(frame_size);
+}
+
+// 能同时容纳参考帧和当前帧的最小窗口
+inline int ZstdSequenceWindowLog(std::size_t frame_size) {
+  ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+  int log = bounds.lowerBound;
+  while (log < bounds.upperBound &&
+         (static_cast<std::size_t>(1) << log) < frame_size * 2) {
+    log++;
+  }
+  return log;
+}
+
+class ZstdSequenceEncoder {
+ public:
+  explicit ZstdSequenceEncoder(int level = 1, int keyframe_interval = 60,
+                               bool long_distance = true)
+      : level_(level),
+        keyframe_interval_(keyframe_interval),
+        long_distance_(long_distance),
+        workers_(0),
+        job_size_(0),
+        frame_size_(0),
+        frames_(0),
+        force_keyframe_(true),
+        cctx_(ZSTD_createCCtx()) {}
+
+  ZstdSequenceEncoder(const ZstdSequenceEncoder&) = delete;
+  ZstdSequenceEncoder& operator=(const ZstdSequenceEncoder&) = delete;
+
+  ~ZstdSequenceEncoder() {
+    ZSTD_freeCCtx(cctx_);
+  }
+
+  bool valid() const {
+    return cctx_ != nullptr;
+  }
+
+  void set_level(int level) {
+    level_ = level;
+  }
+
+  void set_long_distance(bool long_distance) {
+    long_distance_ = long_distance;
+  }
+
+  // 多线程压缩, 参数含义同 CodecContext::CompressZstdParallel
+  void set_workers(int workers, std::size_t job_size = 0) {
+    workers_ = workers;
+    job_size_ = job_size;
+  }
+
+  // 下一帧输出关键帧, 用于接收端丢帧后重新同步
+  void RequestKeyframe() {
+    force_keyframe_ = true;
+  }
+
+  bool NextIsKeyframe(std::size_t size) const {
+    return force_keyframe_ || size != frame_size_ ||
+           (keyframe_interval_ > 0 && frames_ % keyframe_interval_ == 0);
+  }
+
+  // 压缩一帧写入 out, 不改变参考帧, 成功返回 0
+  int Encode(const unsigned char* frame, std::size_t size, FrameBuffer* out) {
+    if (!out->Reserve(ZstdSequenceBound(size))) {
+      return -1;
+    }
+    bool keyframe = NextIsKeyframe(size);
+    ZSTD_CCtx_reset(cctx_, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level_);
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_windowLog,
+                           ZstdSequenceWindowLog(size));
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_enableLongDistanceMatching,
+                           long_distance_ ? 1 : 0);
+    if (workers_ > 0) {
+      ZSTD_CCtx_setParameter(cctx_, ZSTD_c_nbWorkers, workers_);
+      ZSTD_CCtx_setParameter(cctx_, ZSTD_c_jobSize,
+                             static_cast<int>(job_size_));
+    }
+    if (!keyframe) {
+      ZSTD_CCtx_refPrefix(cctx_, prev_.data(), frame_size_);
+    }
+    ZstdSequenceHeader header = {static_cast<uint32_t>(size),
+                                 keyframe ? 1u : 0u};
+    std::memcpy(out->data(), &header, sizeof(header));
+    std::size_t ret =
+        ZSTD_compress2(cctx_, out->data() + sizeof(header),
+                       out->capacity() - sizeof(header), frame, size);
+    if (ZSTD_isError(ret)) {
+      out->set_size(0);
+      return -1;
+    }
+    out->set_size(sizeof(header) + ret);
+    return 0;
+  }
+
+  // 把 frame 作为下一帧的参考, 和 Encode() 传入的帧相同
+  bool Commit(const unsigned char* frame, std::size_t size) {
+    if (!prev_.Reserve(size)) {
+      frame_size_ = 0;
+      return false;
+    }
+    std::memcpy(prev_.data(), frame, size);
+    prev_.set_size(size);
+    frame_size_ = size;
+    frames_++;
+    force_keyframe_ = false;
+    return true;
+  }
+
+  void Reset() {
+    frame_size_ = 0;
+    frames_ = 0;
+    force_keyframe_ = true;
+  }
+
+ private:
+  int level_;
+  int keyframe_interval_;  // 0 表示只有第一帧是关键帧
+  bool long_distance_;
+  int workers_;
+  std::size_t job_size_;
+  std::size_t frame_size_;  // 参考帧大小, 0 表示没有参考帧
+  uint64_t frames_;         // 已提交的帧数
+  bool force_keyframe_;
+  ZSTD_CCtx* cctx_;
+  FrameBuffer prev_;  // 参考帧, 压缩时作为前缀
+};
+
+class ZstdSequenceDecoder {
+ public:
+  ZstdSequenceDecoder()
+      : current_(0), frame_size_(0), dctx_(ZSTD_createDCtx()) {}
+
+  ZstdSequenceDecoder(const ZstdSequenceDecoder&) = delete;
+  ZstdSequenceDecoder& operator=(const ZstdSequenceDecoder&) = delete;
+
+  ~ZstdSequenceDecoder() {
+    ZSTD_freeDCtx(dctx_);
+  }
+
+  bool valid() const {
+    return dctx_ != nullptr;
+  }
+
+  // 解码一帧, 成功返回 0. 非关键帧缺少参考帧时返回 -1, 需要请求关键帧
+  int Decode(const unsigned char* src, std::size_t size) {
+    ZstdSequenceHeader header;
+    if (size < sizeof(header)) {
+      return -1;
+    }
+    std::memcpy(&header, src, sizeof(header));
+    std::size_t frame_size = header.frame_size;
+    bool keyframe = header.keyframe != 0;
+    if (!keyframe && frame_size != frame_size_) {
+      return -1;
+    }
+    FrameBuffer& out = history_[current_ ^ 1];
+    const FrameBuffer& prev = history_[current_];
+    if (!out.Reserve(frame_size)) {
+      return -1;
+    }
+    ZSTD_DCtx_reset(dctx_, ZSTD_reset_session_and_parameters);
+    ZSTD_DCtx_setParameter(dctx_, ZSTD_d_windowLogMax,
+                           ZstdSequenceWindowLog(frame_size));
+    if (!keyframe) {
+      ZSTD_DCtx_refPrefix(dctx_, prev.data(), frame_size_);
+    }
+    std::size_t ret =
+        ZSTD_decompressDCtx(dctx_, out.data(), frame_size,
+                            src + sizeof(header), size - sizeof(header));
+    if (ZSTD_isError(ret) || ret != frame_size) {
+      return -1;
+    }
+    out.set_size(frame_size);
+    current_ ^= 1;
+    frame_size_ = frame_size;
+    return 0;
+  }
+
+  // 最近一次解码的帧, 在下一次 Decode() 之前有效
+  const unsigned char* frame() const {
+    return history_[current_].data();
+  }
+
+  std::size_t frame_size() const {
+    return frame_size_;
+  }
+
+ private:
+  int current_;
+  std::size_t frame_size_;
+  ZSTD_DCtx* dctx_;
+  FrameBuffer history_[2];  // 交替写入, 另一个作为参考帧
+};
+
+}  // namespace image_encode
+
+#endif  // IMAGE_ENCODE_ZSTD_SEQUENCE_HPP_
@@ -1,32 +1,458 @@
 // Copyright (c) 2020 Robert Vaser
 // Combination of ThreadPool implementation by progschj and
 //   task stealing by Sean Parent
+// Per-worker queues are Chase-Lev work-stealing deques (Chase & Lev 2005,
+//   memory orders from Le et al. 2013)
+// Tasks live in fixed-size nodes recycled through per-thread free lists
+// High priority tasks are dispatched earliest deadline first at every task
+//   boundary, background tasks only when nothing else is ready
 
 #ifndef THREAD_POOL_THREAD_POOL_HPP_
 #define THREAD_POOL_THREAD_POOL_HPP_
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>  // NOLINT
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <future>  // NOLINT
 #include <memory>
-#include <queue>
+#include <mutex>  // NOLINT
+#include <new>
 #include <thread>  // NOLINT
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
 namespace thread_pool {
 
+namespace detail {
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+// Lock-free deque of pointers, Push() and Pop() work on the bottom and may
+// only be called by the owning thread, Steal() works on the top and may be
+// called by any thread. Returns nullptr when empty or when a race is lost.
+template<typename T>
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(std::size_t capacity = 256)
+      : top_(0),
+        bottom_(0),
+        array_(new Array(capacity)),
+        arrays_() {
+    arrays_.emplace_back(array_.load(std::memory_order_relaxed));
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  WorkStealingDeque(WorkStealingDeque&&) = delete;
+  WorkStealingDeque& operator=(WorkStealingDeque&&) = delete;
+
+  ~WorkStealingDeque() = default;
+
+  void Push(T* item) {
+    std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    std::int64_t t = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if (b - t > static_cast<std::int64_t>(array->capacity) - 1) {
+      array = Grow(array, t, b);
+    }
+    array->Put(b, item);
+    bottom_.store(b + 1, std::memory_order_release);
+  }
+
+  T* Pop() {
+    std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* item = array->Get(b);
+    if (t == b) {  // last item, thieves may be racing for it
+      if (!top_.compare_exchange_strong(t, t + 1,
+              std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  T* Steal() {
+    std::int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return nullptr;
+    }
+    Array* array = array_.load(std::memory_order_acquire);
+    T* item = array->Get(t);
+    if (!top_.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  bool Empty() const {
+    std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    std::int64_t t = top_.load(std::memory_order_relaxed);
+    return b <= t;
+  }
+
+ private:
+  struct Array {
+    explicit Array(std::size_t capacity)
+        : capacity(capacity),
+          mask(capacity - 1),
+          items(new std::atomic<T*>[capacity]) {
+    }
+
+    T* Get(std::int64_t i) const {
+      return items[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void Put(std::int64_t i, T* item) {
+      items[i & mask].store(item, std::memory_order_relaxed);
+    }
+
+    std::size_t capacity;  // power of two
+    std::size_t mask;
+    std::unique_ptr<std::atomic<T*>[]> items;
+  };
+
+  // old arrays are kept until destruction as thieves may still read them
+  Array* Grow(Array* array, std::int64_t t, std::int64_t b) {
+    Array* bigger = new Array(array->capacity * 2);
+    for (std::int64_t i = t; i != b; ++i) {
+      bigger->Put(i, array->Get(i));
+    }
+    arrays_.emplace_back(bigger);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  alignas(64) std::atomic<std::int64_t> top_;
+  alignas(64) std::atomic<std::int64_t> bottom_;
+  alignas(64) std::atomic<Array*> array_;
+  std::vector<std::unique_ptr<Array>> arrays_;
+};
+
+// Fixed-size task record of one cache line. Callables of up to kInlineSize
+// bytes are stored in place, larger ones are moved to the heap.
+struct alignas(64) TaskNode {
+  static constexpr std::size_t kInlineSize = 48;
+
+  // runs the callable if asked to and destroys it
+  using Invoke = void (*)(TaskNode*, bool);
+
+  template<typename F>
+  void Set(F&& f) {
+    using Callable = typename std::decay<F>::type;
+    if constexpr (sizeof(Callable) <= kInlineSize &&
+                  alignof(Callable) <= alignof(std::max_align_t)) {
+      new (storage) Callable(std::forward<F>(f));
+      invoke = [] (TaskNode* node, bool run) -> void {
+        Callable* callable = std::launder(
+            reinterpret_cast<Callable*>(node->storage));
+        if (run) {
+          (*callable)();
+        }
+        callable->~Callable();
+      };
+    } else {
+      new (storage) Callable*(new Callable(std::forward<F>(f)));
+      invoke = [] (TaskNode* node, bool run) -> void {
+        Callable* callable = *std::launder(
+            reinterpret_cast<Callable**>(node->storage));
+        if (run) {
+          (*callable)();
+        }
+        delete callable;
+      };
+    }
+  }
+
+  void Run() {
+    invoke(this, true);
+  }
+
+  Invoke invoke;
+  TaskNode* next;  // free list or injection queue link
+  alignas(std::max_align_t) unsigned char storage[kInlineSize];
+};
+
+// Per-thread free lists of task nodes. Nodes are usually freed by a
+// different thread than the one that allocated them, so surplus nodes flow
+// back through a shared list in batches of kBatchSize and the global
+// allocator is only called when the shared list is empty as well.
+class TaskArena {
+ public:
+  static TaskNode* Allocate() {
+    Cache& cache = LocalCache();
+    if (cache.head == nullptr) {
+      cache.Refill();
+    }
+    TaskNode* node = cache.head;
+    cache.head = node->next;
+    --cache.size;
+    return node;
+  }
+
+  static void Free(TaskNode* node) {
+    Cache& cache = LocalCache();
+    node->next = cache.head;
+    cache.head = node;
+    if (++cache.size >= 2 * kBatchSize) {
+      cache.Flush(kBatchSize);
+    }
+  }
+
+ private:
+  static constexpr std::size_t kBatchSize = 64;
+
+  struct Batch {
+    TaskNode* head;
+    std::size_t size;
+  };
+
+  // intentionally never destroyed, threads may exit after static
+  // destruction has begun and still return their nodes
+  struct Shared {
+    std::mutex mutex;
+    std::vector<Batch> batches;
+  };
+
+  struct Cache {
+    ~Cache() {
+      while (size != 0) {
+        Flush(std::min(size, kBatchSize));
+      }
+    }
+
+    void Refill() {
+      Shared& shared = GlobalShared();
+      {
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        if (!shared.batches.empty()) {
+          head = shared.batches.back().head;
+          size = shared.batches.back().size;
+          shared.batches.pop_back();
+          return;
+        }
+      }
+      TaskNode* nodes = new TaskNode[kBatchSize];
+      for (std::size_t i = 0; i != kBatchSize; ++i) {
+        nodes[i].next = i + 1 != kBatchSize ? &nodes[i + 1] : nullptr;
+      }
+      head = nodes;
+      size = kBatchSize;
+    }
+
+    // moves the first count nodes to the shared list
+    void Flush(std::size_t count) {
+      Batch batch = {head, count};
+      TaskNode* last = head;
+      for (std::size_t i = 1; i != count; ++i) {
+        last = last->next;
+      }
+      head = last->next;
+      last->next = nullptr;
+      size -= count;
+      Shared& shared = GlobalShared();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      shared.batches.emplace_back(batch);
+    }
+
+    TaskNode* head = nullptr;
+    std::size_t size = 0;
+  };
+
+  static Shared& GlobalShared() {
+    static Shared* shared = new Shared();
+    return *shared;
+  }
+
+  static Cache& LocalCache() {
+    static thread_local Cache cache;
+    return cache;
+  }
+};
+
+// Mutex-guarded FIFO of task nodes linked through next, size() may be read
+// without the lock to skip empty lists
+class TaskList {
+ public:
+  TaskList()
+      : head_(nullptr),
+        tail_(nullptr),
+        size_(0),
+        mutex_() {
+  }
+
+  TaskList(const TaskList&) = delete;
+  TaskList& operator=(const TaskList&) = delete;
+
+  void Push(TaskNode* node) {
+    node->next = nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tail_ == nullptr) {
+      head_ = node;
+    } else {
+      tail_->next = node;
+    }
+    tail_ = node;
+    size_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // queues node ahead of all others
+  void PushFront(TaskNode* node) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    node->next = head_;
+    head_ = node;
+    if (tail_ == nullptr) {
+      tail_ = node;
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  TaskNode* Pop() {
+    if (size_.load(std::memory_order_relaxed) == 0) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    TaskNode* node = head_;
+    if (node != nullptr) {
+      head_ = node->next;
+      if (head_ == nullptr) {
+        tail_ = nullptr;
+      }
+      size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return node;
+  }
+
+  std::size_t size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  TaskNode* head_;
+  TaskNode* tail_;
+  std::atomic<std::size_t> size_;
+  std::mutex mutex_;
+};
+
+}  // namespace detail
+
+// Half-open block [row_begin, row_end) x [col_begin, col_end) of an index
+// space, e.g. pixel rows and columns or tile rows and columns of a frame
+struct Range2d {
+  std::size_t row_begin;
+  std::size_t row_end;
+  std::size_t col_begin;
+  std::size_t col_end;
+};
+
+// Scheduling class of a task. kHigh tasks run before all others in order of
+// their deadlines. kBackground tasks run only when nothing else is ready and
+// never on all workers at once, so a worker is always free for kHigh tasks.
+enum class Priority {
+  kHigh,
+  kNormal,
+  kBackground
+};
+
+struct TaskOptions {
+  Priority priority = Priority::kNormal;
+  // orders kHigh tasks, earliest first, ignored for the other classes
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+};
+
+namespace detail {
+
+// options of tasks submitted from the current thread
+inline TaskOptions& CurrentOptions() {
+  static thread_local TaskOptions options;
+  return options;
+}
+
+}  // namespace detail
+
+// Sets the options of all tasks submitted from the current thread while the
+// object lives, including blocks of ParallelFor() and nodes of a TaskGraph.
+// Tasks submitted from within a running task inherit the options of that
+// task, so work split up by a high priority task stays high priority.
+class PriorityScope {
+ public:
+  explicit PriorityScope(const TaskOptions& options)
+      : previous_(detail::CurrentOptions()) {
+    detail::CurrentOptions() = options;
+  }
+
+  PriorityScope(const PriorityScope&) = delete;
+  PriorityScope& operator=(const PriorityScope&) = delete;
+
+  ~PriorityScope() {
+    detail::CurrentOptions() = previous_;
+  }
+
+ private:
+  TaskOptions previous_;
+};
+
 class ThreadPool {
  public:
   explicit ThreadPool(
       std::size_t num_threads = std::thread::hardware_concurrency())
       : threads_(),
         thread_map_(),
-        queues_(std::max<size_t>(1UL, num_threads)),
-        task_id_(0) {
-    for (std::size_t i = 0; i != queues_.size(); ++i) {
+        workers_(),
+        injected_(),
+        urgent_(),
+        urgent_sequence_(0),
+        urgent_size_(0),
+        urgent_mutex_(),
+        background_(),
+        background_running_(0),
+        background_limit_(std::max<size_t>(1UL, num_threads) - 1),
+        deadline_misses_(0),
+        sleepers_(0),
+        wake_epoch_(0),
+        park_mutex_(),
+        park_(),
+        is_done_(false) {
+    num_threads = std::max<size_t>(1UL, num_threads);
+    background_limit_ = std::max<size_t>(1UL, background_limit_);
+    for (std::size_t i = 0; i != num_threads; ++i) {
+      workers_.emplace_back(new Worker());
+    }
+    for (std::size_t i = 0; i != num_threads; ++i) {
       threads_.emplace_back([this, i] () -> void { Task(i); });
       thread_map_.emplace(threads_.back().get_id(), i);
     }
@@ -38,10 +464,14 @@ class ThreadPool {
   ThreadPool(ThreadPool&&) = delete;
   ThreadPool& operator=(ThreadPool&&) = delete;
 
+  // runs all submitted tasks before joining the workers
   ~ThreadPool() {
-    for (auto& it : queues_) {
-      it.Done();
+    {
+      std::unique_lock<std::mutex> lock(park_mutex_);
+      is_done_.store(true);
+      ++wake_epoch_;
     }
+    park_.notify_all();
     for (auto& it : threads_) {
       it.join();
     }
@@ -55,114 +485,567 @@ class ThreadPool {
     return thread_map_;
   }
 
+  // high priority tasks that started after their deadline
+  std::size_t deadline_misses() const {
+    return deadline_misses_.load(std::memory_order_relaxed);
+  }
+
+  // uses the options of the current thread, see PriorityScope
   template<typename T, typename... Ts>
   auto Submit(T&& routine, Ts&&... params)
       -> std::future<typename std::result_of<T(Ts...)>::type> {
-    auto task = std::make_shared<std::packaged_task<typename std::result_of<T(Ts...)>::type()>>(  // NOLINT
-        std::bind(std::forward<T>(routine), std::forward<Ts>(params)...));
-    auto task_result = task->get_future();
-    auto task_wrapper = [task] () {
-      (*task)();
+    return SubmitWith(detail::CurrentOptions(), std::forward<T>(routine),
+        std::forward<Ts>(params)...);
+  }
+
+  template<typename T, typename... Ts>
+  auto SubmitWith(const TaskOptions& options, T&& routine, Ts&&... params)
+      -> std::future<typename std::result_of<T(Ts...)>::type> {
+    std::packaged_task<typename std::result_of<T(Ts...)>::type()> task(
+        Bind(std::forward<T>(routine), std::forward<Ts>(params)...));
+    auto task_result = task.get_future();
+
+    Job* job = detail::TaskArena::Allocate();
+    job->Set(std::move(task));
+    Schedule(job, options);
+
+    return task_result;
+  }
+
+  // fire-and-forget Submit() without a future, the routine must not throw;
+  // does not allocate if the routine and params fit into a task node
+  template<typename T, typename... Ts>
+  void Execute(T&& routine, Ts&&... params) {
+    ExecuteWith(detail::CurrentOptions(), std::forward<T>(routine),
+        std::forward<Ts>(params)...);
+  }
+
+  template<typename T, typename... Ts>
+  void ExecuteWith(const TaskOptions& options, T&& routine, Ts&&... params) {
+    Job* job = detail::TaskArena::Allocate();
+    if constexpr (sizeof...(Ts) == 0) {
+      job->Set(std::forward<T>(routine));
+    } else {
+      job->Set(Bind(std::forward<T>(routine), std::forward<Ts>(params)...));
+    }
+    Schedule(job, options);
+  }
+
+  // Calls body(const Range2d&) on disjoint blocks of at most row_grain x
+  // col_grain indices covering range. Blocks are split in halves along the
+  // longer side at multiples of the grain, one half is handed to the pool
+  // and the other split further. The calling thread runs jobs until all
+  // blocks are done, body must not throw. Blocks inherit the options of
+  // the calling thread.
+  template<typename F>
+  void ParallelFor(const Range2d& range, std::size_t row_grain,
+      std::size_t col_grain, F&& body) {
+    if (range.row_begin >= range.row_end ||
+        range.col_begin >= range.col_end) {
+      return;
+    }
+    ForState<F> state = {&body, std::max<size_t>(1UL, row_grain),
+        std::max<size_t>(1UL, col_grain), {1}};
+    RunBlock(&state, range);
+    Help(state.pending);
+  }
+
+  // calls body(begin, end) on chunks of at most grain indices of [begin, end)
+  template<typename F>
+  void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain,
+      F&& body) {
+    ParallelFor(Range2d{begin, end, 0, 1}, grain, 1,
+        [&body] (const Range2d& range) -> void {
+          body(range.row_begin, range.row_end);
+        });
+  }
+
+  // Splits [begin, end) into chunks of grain indices, body(begin, end)
+  // returns the value of a chunk and join(a, b) combines two values. Chunk
+  // values are joined in index order on the calling thread starting with
+  // init, so the result does not depend on the schedule.
+  template<typename T, typename F, typename J>
+  T ParallelReduce(std::size_t begin, std::size_t end, std::size_t grain,
+      T init, F&& body, J&& join) {
+    if (begin >= end) {
+      return init;
+    }
+    grain = std::max<size_t>(1UL, grain);
+    std::size_t chunks = (end - begin + grain - 1) / grain;
+    std::vector<T> values(chunks, init);
+    ParallelFor(0, chunks, 1,
+        [&] (std::size_t first, std::size_t last) -> void {
+          for (std::size_t i = first; i != last; ++i) {
+            std::size_t chunk_begin = begin + i * grain;
+            values[i] = body(chunk_begin, std::min(end, chunk_begin + grain));
+          }
+        });
+    for (auto& it : values) {
+      init = join(std::move(init), std::move(it));
+    }
+    return init;
+  }
+
+ private:
+  friend class TaskGraph;
+
+  using Job = detail::TaskNode;
+
+  // copies routine and params like std::bind, without its overhead
+  template<typename T, typename... Ts>
+  static auto Bind(T&& routine, Ts&&... params) {
+    return [routine = std::forward<T>(routine),
+            params = std::make_tuple(std::forward<Ts>(params)...)] () mutable {
+      return std::apply(routine, params);
     };
+  }
+
+  template<typename F>
+  struct ForState {
+    typename std::remove_reference<F>::type* body;
+    std::size_t row_grain;
+    std::size_t col_grain;
+    std::atomic<std::size_t> pending;  // blocks not yet finished
+  };
+
+  // spin iterations of an idle worker before it parks, the first half
+  // pauses the core, the second half yields it to other threads
+  static constexpr std::size_t kSpinCount = 128;
+
+  struct alignas(64) Worker {
+    detail::WorkStealingDeque<Job> deque;
+  };
+
+  // identifies the pool and the worker index of the calling thread
+  struct Context {
+    const ThreadPool* pool;
+    std::size_t id;
+    std::uint64_t seed;  // xorshift state for victim selection
+  };
+
+  static Context& CurrentContext() {
+    static thread_local Context context = {nullptr, 0, 0x9E3779B97F4A7C15ULL};
+    return context;
+  }
+
+  // entry of the heap of high priority jobs
+  struct Deadline {
+    std::chrono::steady_clock::time_point deadline;
+    std::uint64_t sequence;  // keeps equal deadlines in submission order
+    Job* job;
+  };
+
+  // heap order, the earliest deadline is at the top
+  static bool Later(const Deadline& a, const Deadline& b) {
+    return a.deadline != b.deadline ? a.deadline > b.deadline
+                                    : a.sequence > b.sequence;
+  }
+
+  template<typename F>
+  void Spawn(F&& f) {
+    ExecuteWith(detail::CurrentOptions(), std::forward<F>(f));
+  }
 
-    auto task_id = task_id_++;
-    bool is_submitted = false;
-    for (std::size_t i = 0; i != queues_.size() * 42; ++i) {
-      if (queues_[(task_id + i) % queues_.size()].TryPush(task_wrapper)) {
-        is_submitted = true;
+  template<typename F>
+  void RunBlock(ForState<F>* state, Range2d range) {
+    while (true) {
+      std::size_t rows = (range.row_end - range.row_begin +
+          state->row_grain - 1) / state->row_grain;
+      std::size_t cols = (range.col_end - range.col_begin +
+          state->col_grain - 1) / state->col_grain;
+      if (rows <= 1 && cols <= 1) {
         break;
       }
+      Range2d half = range;
+      if (rows >= cols) {
+        range.row_end = range.row_begin + rows / 2 * state->row_grain;
+        half.row_begin = range.row_end;
+      } else {
+        range.col_end = range.col_begin + cols / 2 * state->col_grain;
+        half.col_begin = range.col_end;
+      }
+      state->pending.fetch_add(1, std::memory_order_relaxed);
+      Spawn([this, state, half] () -> void { RunBlock(state, half); });
     }
-    if (!is_submitted) {
-      queues_[task_id % queues_.size()].Push(task_wrapper);
+    (*state->body)(range);
+    state->pending.fetch_sub(1, std::memory_order_release);
+  }
+
+  // Runs jobs on the calling thread until pending drops to zero. Only jobs
+  // of at least the priority of the calling thread are run, so a waiting
+  // high priority task is not held up by a long background job.
+  void Help(const std::atomic<std::size_t>& pending) {
+    Priority lowest = detail::CurrentOptions().priority;
+    std::size_t idle = 0;
+    while (pending.load(std::memory_order_acquire) != 0) {
+      TaskOptions options;
+      Job* job = FindJob(lowest, false, &options);
+      if (job != nullptr) {
+        RunJob(job, options);
+        idle = 0;
+      } else if (++idle < kSpinCount / 2) {
+        detail::CpuRelax();
+      } else {
+        std::this_thread::yield();
+      }
     }
+  }
 
-    return task_result;
+  // High priority jobs go to the deadline heap and background jobs to their
+  // own queue, jobs split off a running background job at its front so
+  // started work completes before new work begins. Of the normal jobs,
+  // workers push to their own deque, other threads to the shared queue.
+  void Schedule(Job* job, const TaskOptions& options) {
+    if (options.priority == Priority::kHigh) {
+      std::lock_guard<std::mutex> lock(urgent_mutex_);
+      urgent_.push_back({options.deadline, urgent_sequence_++, job});
+      std::push_heap(urgent_.begin(), urgent_.end(), Later);
+      urgent_size_.fetch_add(1, std::memory_order_relaxed);
+    } else if (options.priority == Priority::kBackground) {
+      if (detail::CurrentOptions().priority == Priority::kBackground) {
+        background_.PushFront(job);
+      } else {
+        background_.Push(job);
+      }
+    } else {
+      const Context& context = CurrentContext();
+      if (context.pool == this) {
+        workers_[context.id]->deque.Push(job);
+      } else {
+        injected_.Push(job);
+      }
+    }
+    Notify();
+  }
+
+  // runs job with options as the options of the current thread
+  void RunJob(Job* job, const TaskOptions& options) {
+    TaskOptions& current = detail::CurrentOptions();
+    TaskOptions previous = current;
+    current = options;
+    job->Run();
+    current = previous;
+    detail::TaskArena::Free(job);
+  }
+
+  // pairs with the fence in Park() so that either the parking worker sees
+  // the new job or this thread sees the sleeper
+  void Notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(park_mutex_);
+      ++wake_epoch_;
+    }
+    park_.notify_one();
   }
 
- private:
   void Task(std::size_t thread_id) {
+    CurrentContext() = {this, thread_id,
+        0x9E3779B97F4A7C15ULL * (thread_id + 1)};
     while (true) {
-      std::function<void()> task;
-
-      for (std::size_t i = 0; i != queues_.size(); ++i) {
-        if (queues_[(thread_id + i) % queues_.size()].TryPop(&task)) {
-          break;
+      TaskOptions options;
+      Job* job = FindJob(Priority::kBackground, true, &options);
+      for (std::size_t i = 0; job == nullptr && i != kSpinCount; ++i) {
+        if (i < kSpinCount / 2) {
+          detail::CpuRelax();
+        } else {
+          std::this_thread::yield();
         }
+        job = FindJob(Priority::kBackground, true, &options);
       }
-      if (!task && !queues_[thread_id].Pop(&task)) {
-        break;
+      if (job == nullptr) {
+        if (is_done_.load() && !HasJobs()) {
+          break;
+        }
+        Park();
+        continue;
       }
 
-      task();
+      RunJob(job, options);
+      if (options.priority == Priority::kBackground) {
+        background_running_.fetch_sub(1, std::memory_order_relaxed);
+        if (background_.size() != 0) {
+          Notify();
+        }
+      }
     }
   }
 
-  struct TaskQueue {
-   public:
-    template<typename F>
-    void Push(F&& f) {
-      {
-        std::unique_lock<std::mutex> lock(mutex);
-        queue.emplace(std::forward<F>(f));
+  // Looks for a job of at least priority lowest and stores its options.
+  // High priority jobs are checked first at every call, which preempts all
+  // other work at task boundaries. Normal jobs come from the own deque
+  // (newest first), the shared queue (oldest first), then a steal; threads
+  // outside the pool skip the first step. Workers count background jobs
+  // against the limit, helping threads already occupy their thread.
+  Job* FindJob(Priority lowest, bool is_limited, TaskOptions* options) {
+    if (urgent_size_.load(std::memory_order_relaxed) != 0) {
+      std::unique_lock<std::mutex> lock(urgent_mutex_);
+      if (!urgent_.empty()) {
+        std::pop_heap(urgent_.begin(), urgent_.end(), Later);
+        Deadline entry = urgent_.back();
+        urgent_.pop_back();
+        urgent_size_.fetch_sub(1, std::memory_order_relaxed);
+        lock.unlock();
+        if (entry.deadline != std::chrono::steady_clock::time_point::max() &&
+            entry.deadline < std::chrono::steady_clock::now()) {
+          deadline_misses_.fetch_add(1, std::memory_order_relaxed);
+        }
+        *options = {Priority::kHigh, entry.deadline};
+        return entry.job;
       }
-      is_ready.notify_one();
+    }
+    if (lowest == Priority::kHigh) {
+      return nullptr;
     }
 
-    bool Pop(std::function<void()>* f) {
-      std::unique_lock<std::mutex> lock(mutex);
-      while (queue.empty() && !is_done) {
-        is_ready.wait(lock);
+    *options = TaskOptions();
+    Context& context = CurrentContext();
+    Job* job = nullptr;
+    if (context.pool == this) {
+      job = workers_[context.id]->deque.Pop();
+      if (job != nullptr) {
+        return job;
       }
-      if (queue.empty()) {
-        return false;
+    }
+    job = injected_.Pop();
+    if (job != nullptr) {
+      return job;
+    }
+    job = Steal(&context);
+    if (job != nullptr || lowest == Priority::kNormal ||
+        background_.size() == 0) {
+      return job;
+    }
+
+    if (is_limited && background_running_.fetch_add(1,
+            std::memory_order_relaxed) >= background_limit_) {
+      background_running_.fetch_sub(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    job = background_.Pop();
+    if (job == nullptr) {
+      if (is_limited) {
+        background_running_.fetch_sub(1, std::memory_order_relaxed);
       }
-      *f = std::move(queue.front());
-      queue.pop();
-      return true;
+      return nullptr;
     }
+    options->priority = Priority::kBackground;
+    return job;
+  }
 
-    template<typename F>
-    bool TryPush(F&& f) {
-      {
-        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
-        if (!lock) {
-          return false;
-        }
-        queue.emplace(std::forward<F>(f));
+  // visits all other workers starting at a random victim
+  Job* Steal(Context* context) {
+    std::size_t n = workers_.size();
+    bool is_worker = context->pool == this;
+    if (n == 1 && is_worker) {
+      return nullptr;
+    }
+    std::uint64_t& seed = context->seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    std::size_t start = seed % n;
+    for (std::size_t i = 0; i != n; ++i) {
+      std::size_t victim = (start + i) % n;
+      if (is_worker && victim == context->id) {
+        continue;
+      }
+      Job* job = workers_[victim]->deque.Steal();
+      if (job != nullptr) {
+        return job;
       }
-      is_ready.notify_one();
+    }
+    return nullptr;
+  }
+
+  bool HasJobs() const {
+    if (urgent_size_.load(std::memory_order_relaxed) != 0 ||
+        injected_.size() != 0) {
+      return true;
+    }
+    if (background_.size() != 0 &&
+        background_running_.load(std::memory_order_relaxed) <
+            background_limit_) {
       return true;
     }
+    for (const auto& it : workers_) {
+      if (!it->deque.Empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Park() {
+    std::unique_lock<std::mutex> lock(park_mutex_);
+    std::uint64_t epoch = wake_epoch_;
+    sleepers_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!HasJobs() && !is_done_.load()) {
+      park_.wait(lock, [&] () -> bool { return wake_epoch_ != epoch; });
+    }
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  std::vector<std::thread> threads_;
+  std::unordered_map<std::thread::id, std::size_t> thread_map_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  detail::TaskList injected_;  // normal jobs from threads outside the pool
+  std::vector<Deadline> urgent_;  // heap of high priority jobs
+  std::uint64_t urgent_sequence_;
+  std::atomic<std::size_t> urgent_size_;
+  std::mutex urgent_mutex_;
+  detail::TaskList background_;
+  std::atomic<std::size_t> background_running_;
+  std::size_t background_limit_;  // workers that may run background jobs
+  std::atomic<std::size_t> deadline_misses_;
+  std::atomic<std::size_t> sleepers_;
+  std::uint64_t wake_epoch_;
+  std::mutex park_mutex_;
+  std::condition_variable park_;
+  std::atomic<bool> is_done_;
+};
+
+// Dependency graph of tasks run on a ThreadPool. Each node counts its
+// unfinished predecessors and the predecessor finishing last schedules it,
+// one ready successor runs right away on the same thread as a continuation.
+// No worker ever blocks on a dependency. A graph can be run repeatedly, e.g.
+// once per frame, but not concurrently with itself or while it is modified.
+class TaskGraph {
+ public:
+  explicit TaskGraph(ThreadPool* pool)
+      : pool_(pool),
+        nodes_(),
+        pending_(0),
+        is_checked_(true) {
+  }
 
-    bool TryPop(std::function<void()>* f) {
-      std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
-      if (!lock || queue.empty()) {
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  TaskGraph(TaskGraph&&) = delete;
+  TaskGraph& operator=(TaskGraph&&) = delete;
+
+  ~TaskGraph() = default;
+
+  // adds a node running work(), which must not throw, and returns its id
+  template<typename F>
+  std::size_t Emplace(F&& work) {
+    nodes_.emplace_back(new Node(std::forward<F>(work)));
+    return nodes_.size() - 1;
+  }
+
+  // node after starts only once node before has finished
+  void Precede(std::size_t before, std::size_t after) {
+    nodes_[before]->successors.emplace_back(after);
+    ++nodes_[after]->dependencies;
+    is_checked_ = false;
+  }
+
+  std::size_t size() const {
+    return nodes_.size();
+  }
+
+  void Clear() {
+    nodes_.clear();
+    is_checked_ = true;
+  }
+
+  // runs every node once and returns when all have finished, the calling
+  // thread runs jobs meanwhile; returns false without running anything if
+  // the dependencies contain a cycle
+  bool Run() {
+    if (!is_checked_) {
+      if (!IsAcyclic()) {
         return false;
       }
-      *f = std::move(queue.front());
-      queue.pop();
+      is_checked_ = true;
+    }
+    if (nodes_.empty()) {
       return true;
     }
-
-    void Done() {
-      {
-        std::unique_lock<std::mutex> lock(mutex);
-        is_done = true;
+    pending_.store(nodes_.size(), std::memory_order_relaxed);
+    for (auto& it : nodes_) {
+      it->remaining.store(it->dependencies, std::memory_order_relaxed);
+    }
+    for (auto& it : nodes_) {
+      if (it->dependencies == 0) {
+        Node* node = it.get();
+        pool_->Spawn([this, node] () -> void { Execute(node); });
       }
-      is_ready.notify_all();
     }
+    pool_->Help(pending_);
+    return true;
+  }
 
-    std::queue<std::function<void()>> queue;
-    std::mutex mutex;
-    std::condition_variable is_ready;
-    bool is_done = false;
+ private:
+  struct Node {
+    template<typename F>
+    explicit Node(F&& work)
+        : work(std::forward<F>(work)),
+          successors(),
+          dependencies(0),
+          remaining(0) {
+    }
+
+    std::function<void()> work;
+    std::vector<std::size_t> successors;
+    std::size_t dependencies;
+    std::atomic<std::size_t> remaining;  // predecessors not yet finished
   };
 
-  std::vector<std::thread> threads_;
-  std::unordered_map<std::thread::id, std::size_t> thread_map_;
-  std::vector<TaskQueue> queues_;
-  std::atomic<std::size_t> task_id_;
+  void Execute(Node* node) {
+    while (node != nullptr) {
+      node->work();
+      Node* next = nullptr;
+      for (std::size_t it : node->successors) {
+        Node* successor = nodes_[it].get();
+        if (successor->remaining.fetch_sub(1,
+                std::memory_order_acq_rel) != 1) {
+          continue;
+        }
+        if (next == nullptr) {
+          next = successor;
+        } else {
+          pool_->Spawn([this, successor] () -> void { Execute(successor); });
+        }
+      }
+      pending_.fetch_sub(1, std::memory_order_release);
+      node = next;
+    }
+  }
+
+  // Kahn's algorithm, every node is reached iff there is no cycle
+  bool IsAcyclic() const {
+    std::vector<std::size_t> remaining(nodes_.size());
+    std::vector<std::size_t> ready;
+    for (std::size_t i = 0; i != nodes_.size(); ++i) {
+      remaining[i] = nodes_[i]->dependencies;
+      if (remaining[i] == 0) {
+        ready.emplace_back(i);
+      }
+    }
+    std::size_t visited = 0;
+    while (!ready.empty()) {
+      std::size_t i = ready.back();
+      ready.pop_back();
+      ++visited;
+      for (std::size_t it : nodes_[i]->successors) {
+        if (--remaining[it] == 0) {
+          ready.emplace_back(it);
+        }
+      }
+    }
+    return visited == nodes_.size();
+  }
+
+  ThreadPool* pool_;
+  std::vector<std::unique_ptr<Node>> nodes_;
+  std::atomic<std::size_t> pending_;  // nodes not yet finished
+  bool is_checked_;
 };
 
 }  // namespace thread_pool